@@ -0,0 +1,85 @@
+#pragma once
+
+// Std. Includes
+#include <cfloat>
+
+// GL Includes
+#include <glm/glm.hpp>
+
+// Axis aligned bounding box. An empty box has min > max.
+struct AABB
+{
+	glm::vec3 min;
+	glm::vec3 max;
+
+	AABB() : min(FLT_MAX), max(-FLT_MAX)
+	{
+	}
+
+	AABB(const glm::vec3 &min, const glm::vec3 &max) : min(min), max(max)
+	{
+	}
+
+	bool IsEmpty() const
+	{
+		return this->min.x > this->max.x;
+	}
+
+	glm::vec3 GetCenter() const
+	{
+		return (this->min + this->max) * 0.5f;
+	}
+
+	void Expand(const glm::vec3 &point)
+	{
+		this->min = glm::min(this->min, point);
+		this->max = glm::max(this->max, point);
+	}
+
+	void Expand(const AABB &box)
+	{
+		if (!box.IsEmpty())
+		{
+			this->Expand(box.min);
+			this->Expand(box.max);
+		}
+	}
+};
+
+// Bounding sphere, packed as (center, radius) so batches can be fed straight to the frustum test
+struct BoundingSphere
+{
+	glm::vec3 center;
+	float radius;
+
+	BoundingSphere() : center(0.0f), radius(0.0f)
+	{
+	}
+
+	BoundingSphere(const glm::vec3 &center, float radius) : center(center), radius(radius)
+	{
+	}
+
+	// Sphere around the box's center that encloses the box
+	static BoundingSphere FromAABB(const AABB &box)
+	{
+		if (box.IsEmpty())
+		{
+			return BoundingSphere();
+		}
+
+		return BoundingSphere(box.GetCenter(), glm::length(box.max - box.GetCenter()));
+	}
+
+	// Sphere of the same object after transform. The radius grows with the largest axis scale, so it stays
+	// conservative under non-uniform scaling.
+	BoundingSphere Transform(const glm::mat4 &transform) const
+	{
+		float scaleX = glm::length(glm::vec3(transform[0]));
+		float scaleY = glm::length(glm::vec3(transform[1]));
+		float scaleZ = glm::length(glm::vec3(transform[2]));
+		float scale = glm::max(scaleX, glm::max(scaleY, scaleZ));
+
+		return BoundingSphere(glm::vec3(transform * glm::vec4(this->center, 1.0f)), this->radius * scale);
+	}
+};
\ No newline at end of file
@@ -10,6 +10,8 @@
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 
+#include "Frustum.h"
+
 // Defines several possible options for camera movement. Used as abstraction to stay away from window-system specific input methods
 enum Camera_Movement
 {
@@ -56,6 +58,12 @@ public:
 		return glm::lookAt(this->position, this->position + this->front, this->up);
 	}
 
+	// Returns the world space frustum for the given projection, perspective or orthographic
+	Frustum ExtractFrustum(const glm::mat4 &projection)
+	{
+		return Frustum::FromMatrix(projection * this->GetViewMatrix());
+	}
+
 	// Processes input received from any keyboard-like input system. Accepts input parameter in the form of camera defined ENUM (to abstract it from windowing systems)
 	void ProcessKeyboard(Camera_Movement direction, GLfloat deltaTime)
 	{
@@ -0,0 +1,145 @@
+#pragma once
+
+// Std. Includes
+#include <string>
+#include <sstream>
+#include <iostream>
+#include <vector>
+#include <chrono>
+
+// GL Includes
+#include <GL/glew.h>
+
+#include "Shader.h"
+#include "Model.h"
+
+using namespace std;
+
+// Micro-benchmark of the CPU cost of Mesh::Draw. It times the old per-draw path (sampler names built with a
+// stringstream, glGetUniformLocation per texture, every unit unbound afterwards) against the current one on
+// the same meshes and prints ns/draw for both. Draws land in the back buffer, run it before the frame is cleared.
+class DrawBenchmark
+{
+public:
+	static void Run(const vector<Model *> &models, Shader &shader, GLuint iterations)
+	{
+		shader.Use();
+
+		GLuint draws = 0;
+
+		for (GLuint m = 0; m < models.size(); m++)
+		{
+			draws += (GLuint)models[m]->GetMeshes().size();
+		}
+
+		if (draws == 0 || iterations == 0)
+		{
+			return;
+		}
+
+		// Warm up both paths so the location tables and the driver are in the same state
+		drawLegacy(models, shader.Program);
+		GetGLState().Invalidate();
+		drawCurrent(models, shader);
+		glFinish();
+
+		chrono::high_resolution_clock::time_point start = chrono::high_resolution_clock::now();
+
+		for (GLuint i = 0; i < iterations; i++)
+		{
+			drawLegacy(models, shader.Program);
+		}
+
+		chrono::high_resolution_clock::time_point end = chrono::high_resolution_clock::now();
+		double legacyNs = (double)chrono::duration_cast<chrono::nanoseconds>(end - start).count() / ((double)draws * iterations);
+		glFinish();
+
+		// The legacy path binds behind the shadow's back
+		GetGLState().Invalidate();
+
+		start = chrono::high_resolution_clock::now();
+
+		for (GLuint i = 0; i < iterations; i++)
+		{
+			drawCurrent(models, shader);
+		}
+
+		end = chrono::high_resolution_clock::now();
+		double currentNs = (double)chrono::duration_cast<chrono::nanoseconds>(end - start).count() / ((double)draws * iterations);
+		glFinish();
+
+		cout << "DrawBenchmark: " << draws << " draws x " << iterations << " | legacy " << legacyNs << " ns/draw | current "
+			<< currentNs << " ns/draw | " << (currentNs > 0.0 ? legacyNs / currentNs : 0.0) << "x" << endl;
+	}
+
+private:
+	static void drawCurrent(const vector<Model *> &models, Shader &shader)
+	{
+		for (GLuint m = 0; m < models.size(); m++)
+		{
+			models[m]->Draw(shader);
+		}
+	}
+
+	static void drawLegacy(const vector<Model *> &models, GLuint program)
+	{
+		for (GLuint m = 0; m < models.size(); m++)
+		{
+			vector<Mesh> &meshes = models[m]->GetMeshes();
+
+			for (GLuint i = 0; i < meshes.size(); i++)
+			{
+				legacyMeshDraw(meshes[i], program);
+			}
+		}
+	}
+
+	// Mesh::Draw as it was before materials were compiled at load time. The shader was copied by value,
+	// which only copied the program name.
+	static void legacyMeshDraw(const Mesh &mesh, GLuint program)
+	{
+		// Bind appropriate textures
+		GLuint diffuseNr = 1;
+		GLuint specularNr = 1;
+
+		for (GLuint i = 0; i < mesh.textures.size(); i++)
+		{
+			glActiveTexture(GL_TEXTURE0 + i); // Active proper texture unit before binding
+			// Retrieve texture number (the N in diffuse_textureN)
+			stringstream ss;
+			string number;
+			string name = mesh.textures[i].type;
+
+			if (name == "texture_diffuse")
+			{
+				ss << diffuseNr++; // Transfer GLuint to stream
+			}
+			else if (name == "texture_specular")
+			{
+				ss << specularNr++; // Transfer GLuint to stream
+			}
+
+			number = ss.str();
+			// Now set the sampler to the correct texture unit
+			glUniform1i(glGetUniformLocation(program, (name + number).c_str()), i);
+			// And finally bind the texture
+			glBindTexture(GL_TEXTURE_2D, mesh.textures[i].id);
+		}
+
+		// Also set each mesh's shininess property to a default value (if you want you could extend this to another mesh property and possibly change this value)
+		glUniform1f(glGetUniformLocation(program, "material.shininess"), 16.0f);
+
+		// Draw mesh
+		GeometryArena &arena = GetGeometryArena();
+		glBindVertexArray(arena.GetVAO());
+		arena.DrawElements(mesh.GetIndexCount(), mesh.GetFirstIndex(), mesh.GetBaseVertex());
+		glBindVertexArray(0);
+
+		// Always good practice to set everything back to defaults once configured.
+		for (GLuint i = 0; i < mesh.textures.size(); i++)
+		{
+			glActiveTexture(GL_TEXTURE0 + i);
+			glBindTexture(GL_TEXTURE_2D, 0);
+		}
+	}
+};
\ No newline at end of file
@@ -0,0 +1,56 @@
+#pragma once
+
+// Std. Includes
+#include <string>
+#include <fstream>
+#include <cstddef>
+#include <cstdint>
+
+// 64 bit FNV-1a, the hash behind ProgramCache's keys and the content checks of MeshCache and TextureCache.
+// Start from FNV1A_OFFSET_BASIS and chain calls to hash several pieces as one.
+const uint64_t FNV1A_OFFSET_BASIS = 14695981039346656037ull;
+const uint64_t FNV1A_PRIME = 1099511628211ull;
+
+inline uint64_t Fnv1a(uint64_t hash, const void *data, size_t size)
+{
+	const unsigned char *bytes = (const unsigned char *)data;
+
+	for (size_t i = 0; i < size; i++)
+	{
+		hash ^= bytes[i];
+		hash *= FNV1A_PRIME;
+	}
+
+	return hash;
+}
+
+inline uint64_t Fnv1a(uint64_t hash, const std::string &data)
+{
+	return Fnv1a(hash, data.data(), data.size());
+}
+
+// Hashes a whole file and measures it on the way. Returns false when it can't be opened.
+inline bool Fnv1aFile(const std::string &path, uint64_t &hash, uint64_t &size)
+{
+	std::ifstream in(path.c_str(), std::ios::binary);
+
+	if (!in)
+	{
+		return false;
+	}
+
+	hash = FNV1A_OFFSET_BASIS;
+	size = 0;
+	char buffer[65536];
+
+	while (in)
+	{
+		in.read(buffer, sizeof(buffer));
+		std::streamsize count = in.gcount();
+
+		hash = Fnv1a(hash, buffer, (size_t)count);
+		size += (uint64_t)count;
+	}
+
+	return true;
+}
\ No newline at end of file
@@ -0,0 +1,312 @@
+#pragma once
+
+// Std. Includes
+#include <string>
+#include <chrono>
+#include <thread>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <algorithm>
+
+// GL Includes
+#include <GL/glew.h>
+#include <GLFW/glfw3.h>
+
+// Sleep() only wakes on the system tick (15.6 ms by default); timeBeginPeriod(1) brings it down to ~1 ms
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#include <mmsystem.h>
+#endif
+
+// The last stretch before a deadline is spun instead of slept, the OS may oversleep by about this much
+const double FRAME_PACER_SPIN_MILLISECONDS = 2.0;
+// Histogram of frame periods: fixed-width buckets, the last one collects everything slower
+const double FRAME_PACER_BUCKET_MILLISECONDS = 0.5;
+const GLuint FRAME_PACER_BUCKETS = 100;
+
+enum SwapMode
+{
+	SWAP_MODE_OFF,			// glfwSwapInterval(0): present immediately, may tear
+	SWAP_MODE_VSYNC,		// glfwSwapInterval(1): wait for the vertical blank
+	SWAP_MODE_ADAPTIVE		// glfwSwapInterval(-1): vsync, but a late frame is presented right away instead of waiting a whole refresh
+};
+
+// Command line of the pacer: --fps N (0 = no cap), --vsync off|on|adaptive, --fps-tolerance FRACTION
+struct FramePacerOptions
+{
+	double targetFps;
+	SwapMode swapMode;
+	double tolerance;		// How far the measured period may drift from the target, as a fraction of it
+	bool fpsGiven;			// --fps was on the command line
+};
+
+inline FramePacerOptions ParseFramePacerOptions(int argc, char *argv[])
+{
+	FramePacerOptions options;
+	options.targetFps = 60.0;
+	options.swapMode = SWAP_MODE_VSYNC;
+	options.tolerance = 0.05;
+	options.fpsGiven = false;
+
+	for (int i = 1; i + 1 < argc; i++)
+	{
+		if (strcmp(argv[i], "--fps") == 0)
+		{
+			options.targetFps = std::max(0.0, atof(argv[i + 1]));
+			options.fpsGiven = true;
+		}
+		else if (strcmp(argv[i], "--vsync") == 0)
+		{
+			if (strcmp(argv[i + 1], "off") == 0)
+			{
+				options.swapMode = SWAP_MODE_OFF;
+			}
+			else if (strcmp(argv[i + 1], "adaptive") == 0)
+			{
+				options.swapMode = SWAP_MODE_ADAPTIVE;
+			}
+			else
+			{
+				options.swapMode = SWAP_MODE_VSYNC;
+			}
+		}
+		else if (strcmp(argv[i], "--fps-tolerance") == 0 && atof(argv[i + 1]) > 0.0)
+		{
+			options.tolerance = atof(argv[i + 1]);
+		}
+	}
+
+	return options;
+}
+
+// Frame rate limiter and swap interval control. Wait() goes right before the swap (or the glFinish of a headless
+// frame): it sleeps until FRAME_PACER_SPIN_MILLISECONDS before the frame's deadline and spins the rest against
+// steady_clock, so frames leave at a fixed period instead of whenever the driver lets them. Deadlines advance by
+// exactly one period from the previous one, so a frame that wakes a bit late doesn't push the next ones back;
+// a frame later than a whole period restarts the grid instead of rushing the following ones to catch up.
+// Every period between two Wait() calls goes into a histogram to show how steady the delivery really is.
+class FramePacer
+{
+public:
+	FramePacer() : period(0.0), swapMode(SWAP_MODE_OFF), started(false)
+	{
+#ifdef _WIN32
+		timeBeginPeriod(1);
+#endif
+		this->ResetHistogram();
+	}
+
+	~FramePacer()
+	{
+#ifdef _WIN32
+		timeEndPeriod(1);
+#endif
+	}
+
+	// 0 takes the cap off, the swap interval alone sets the pace then
+	void SetTargetFps(double fps)
+	{
+		this->period = fps > 0.0 ? 1000.0 / fps : 0.0;
+		this->started = false;
+	}
+
+	double GetTargetFps() const
+	{
+		return this->period > 0.0 ? 1000.0 / this->period : 0.0;
+	}
+
+	// Needs the window's context current. Adaptive vsync falls back to plain vsync when the driver lacks swap_control_tear.
+	void SetSwapMode(SwapMode mode)
+	{
+		if (mode == SWAP_MODE_ADAPTIVE && !glfwExtensionSupported("WGL_EXT_swap_control_tear") && !glfwExtensionSupported("GLX_EXT_swap_control_tear"))
+		{
+			std::cout << "ERROR::FRAME_PACER::ADAPTIVE_VSYNC_NOT_SUPPORTED, using vsync" << std::endl;
+			mode = SWAP_MODE_VSYNC;
+		}
+
+		this->swapMode = mode;
+		glfwSwapInterval(mode == SWAP_MODE_OFF ? 0 : (mode == SWAP_MODE_VSYNC ? 1 : -1));
+		this->started = false;
+	}
+
+	SwapMode GetSwapMode() const
+	{
+		return this->swapMode;
+	}
+
+	// Blocks until the current frame's deadline and records the period since the previous call
+	void Wait()
+	{
+		if (this->started && this->period > 0.0)
+		{
+			this->waitUntil(this->deadline);
+		}
+
+		Clock::time_point now = Clock::now();
+
+		if (this->started)
+		{
+			this->record(milliseconds(now - this->lastFrame));
+		}
+
+		this->lastFrame = now;
+
+		Clock::duration step = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double, std::milli>(this->period));
+		this->deadline = this->started ? this->deadline + step : now + step;
+
+		if (this->deadline < now)
+		{
+			this->deadline = now + step;
+		}
+
+		this->started = true;
+	}
+
+	// Forget the previous frame, e.g. after the loop slept waiting for events, so that gap isn't counted as a frame
+	void Resync()
+	{
+		this->started = false;
+	}
+
+	void ResetHistogram()
+	{
+		memset(this->buckets, 0, sizeof(this->buckets));
+		this->frames = 0;
+		this->sum = 0.0;
+		this->sumSquares = 0.0;
+		this->minimum = 0.0;
+		this->maximum = 0.0;
+	}
+
+	GLuint GetFrameCount() const
+	{
+		return this->frames;
+	}
+
+	double GetAverageMilliseconds() const
+	{
+		return this->frames > 0 ? this->sum / this->frames : 0.0;
+	}
+
+	// Standard deviation of the period
+	double GetJitterMilliseconds() const
+	{
+		if (this->frames == 0)
+		{
+			return 0.0;
+		}
+
+		double average = this->GetAverageMilliseconds();
+
+		return std::sqrt(std::max(0.0, this->sumSquares / this->frames - average * average));
+	}
+
+	// Upper edge of the bucket holding that fraction of the frames, so it is never optimistic by more than a bucket
+	double GetPercentileMilliseconds(double fraction) const
+	{
+		GLuint wanted = (GLuint)std::ceil(fraction * this->frames), seen = 0;
+
+		for (GLuint i = 0; i < FRAME_PACER_BUCKETS; i++)
+		{
+			seen += this->buckets[i];
+
+			if (seen >= wanted && seen > 0)
+			{
+				return i + 1 < FRAME_PACER_BUCKETS ? (i + 1) * FRAME_PACER_BUCKET_MILLISECONDS : this->maximum;
+			}
+		}
+
+		return this->maximum;
+	}
+
+	// Average period within tolerance of the target, and 95% of the frames no slower than that. Always true without a cap.
+	bool IsWithinTolerance(double tolerance) const
+	{
+		if (this->period <= 0.0 || this->frames == 0)
+		{
+			return true;
+		}
+
+		double limit = this->period * tolerance;
+
+		return std::abs(this->GetAverageMilliseconds() - this->period) <= limit && this->GetPercentileMilliseconds(0.95) <= this->period + std::max(limit, FRAME_PACER_BUCKET_MILLISECONDS);
+	}
+
+	void Print() const
+	{
+		if (this->frames == 0)
+		{
+			return;
+		}
+
+		std::cout << "FramePacer: target " << this->period << " ms (" << this->GetTargetFps() << " fps, "
+			<< (this->swapMode == SWAP_MODE_OFF ? "no vsync" : (this->swapMode == SWAP_MODE_VSYNC ? "vsync" : "adaptive vsync")) << ") | "
+			<< this->frames << " frames | avg " << this->GetAverageMilliseconds() << " ms | jitter " << this->GetJitterMilliseconds()
+			<< " ms | min " << this->minimum << " | p50 " << this->GetPercentileMilliseconds(0.50) << " | p95 " << this->GetPercentileMilliseconds(0.95)
+			<< " | p99 " << this->GetPercentileMilliseconds(0.99) << " | max " << this->maximum << std::endl;
+
+		GLuint largest = *std::max_element(this->buckets, this->buckets + FRAME_PACER_BUCKETS);
+
+		for (GLuint i = 0; i < FRAME_PACER_BUCKETS; i++)
+		{
+			if (this->buckets[i] == 0)
+			{
+				continue;
+			}
+
+			GLuint width = std::max(1u, this->buckets[i] * 40 / largest);
+			std::cout << "  " << i * FRAME_PACER_BUCKET_MILLISECONDS << (i + 1 < FRAME_PACER_BUCKETS ? " ms " : "+ ms ") << std::string(width, '#')
+				<< " " << this->buckets[i] << std::endl;
+		}
+	}
+
+private:
+	typedef std::chrono::steady_clock Clock;
+
+	double period;			// Target frame time in ms, 0 without a cap
+	SwapMode swapMode;
+	bool started;
+	Clock::time_point deadline, lastFrame;
+
+	GLuint buckets[FRAME_PACER_BUCKETS];
+	GLuint frames;
+	double sum, sumSquares, minimum, maximum;
+
+	static double milliseconds(Clock::duration duration)
+	{
+		return std::chrono::duration<double, std::milli>(duration).count();
+	}
+
+	void waitUntil(Clock::time_point target) const
+	{
+		Clock::duration spin = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double, std::milli>(FRAME_PACER_SPIN_MILLISECONDS));
+		Clock::time_point now = Clock::now();
+
+		if (target - now > spin)
+		{
+			std::this_thread::sleep_for(target - now - spin);
+		}
+
+		while (Clock::now() < target)
+		{
+			std::this_thread::yield();
+		}
+	}
+
+	void record(double frameMilliseconds)
+	{
+		GLuint bucket = std::min((GLuint)(frameMilliseconds / FRAME_PACER_BUCKET_MILLISECONDS), FRAME_PACER_BUCKETS - 1);
+		this->buckets[bucket]++;
+
+		this->minimum = this->frames == 0 ? frameMilliseconds : std::min(this->minimum, frameMilliseconds);
+		this->maximum = std::max(this->maximum, frameMilliseconds);
+		this->sum += frameMilliseconds;
+		this->sumSquares += frameMilliseconds * frameMilliseconds;
+		this->frames++;
+	}
+};
\ No newline at end of file
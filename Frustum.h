@@ -0,0 +1,220 @@
+#pragma once
+
+// Std. Includes
+#include <vector>
+
+// SSE is part of every x64 target and of x86 builds with /arch:SSE or higher
+#if defined(_M_X64) || defined(__x86_64__) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1) || defined(__SSE__)
+#define FRUSTUM_USE_SSE 1
+#include <xmmintrin.h>
+#else
+#define FRUSTUM_USE_SSE 0
+#endif
+
+// GL Includes
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include "Bounds.h"
+
+using namespace std;
+
+// The six planes of a view volume, each stored as (normal, distance) with the normal pointing inwards
+struct Frustum
+{
+	enum Plane
+	{
+		LEFT_PLANE,
+		RIGHT_PLANE,
+		BOTTOM_PLANE,
+		TOP_PLANE,
+		NEAR_PLANE,
+		FAR_PLANE,
+		PLANE_COUNT
+	};
+
+	glm::vec4 planes[PLANE_COUNT];
+
+	// Extracts the planes from a projection * view matrix (Gribb/Hartmann). Works for perspective and
+	// orthographic projections alike, the planes come out in world space.
+	static Frustum FromMatrix(const glm::mat4 &viewProjection)
+	{
+		// glm is column major, row i of the matrix is (m[0][i], m[1][i], m[2][i], m[3][i])
+		glm::vec4 row0(viewProjection[0][0], viewProjection[1][0], viewProjection[2][0], viewProjection[3][0]);
+		glm::vec4 row1(viewProjection[0][1], viewProjection[1][1], viewProjection[2][1], viewProjection[3][1]);
+		glm::vec4 row2(viewProjection[0][2], viewProjection[1][2], viewProjection[2][2], viewProjection[3][2]);
+		glm::vec4 row3(viewProjection[0][3], viewProjection[1][3], viewProjection[2][3], viewProjection[3][3]);
+
+		Frustum frustum;
+		frustum.planes[LEFT_PLANE] = row3 + row0;
+		frustum.planes[RIGHT_PLANE] = row3 - row0;
+		frustum.planes[BOTTOM_PLANE] = row3 + row1;
+		frustum.planes[TOP_PLANE] = row3 - row1;
+		frustum.planes[NEAR_PLANE] = row3 + row2;
+		frustum.planes[FAR_PLANE] = row3 - row2;
+
+		// Normalize so plane distances are in world units and can be compared against sphere radii
+		for (GLuint i = 0; i < PLANE_COUNT; i++)
+		{
+			frustum.planes[i] /= glm::length(glm::vec3(frustum.planes[i]));
+		}
+
+		return frustum;
+	}
+
+	// A sphere is outside when it lies entirely behind any plane
+	bool IntersectsSphere(const BoundingSphere &sphere) const
+	{
+		for (GLuint i = 0; i < PLANE_COUNT; i++)
+		{
+			if (glm::dot(glm::vec3(this->planes[i]), sphere.center) + this->planes[i].w < -sphere.radius)
+			{
+				return false;
+			}
+		}
+
+		return true;
+	}
+};
+
+// Per-frame culling counters
+struct CullStats
+{
+	GLuint tested;
+	GLuint visible;
+	GLuint culled;
+};
+
+// Tests bounding spheres against the frame's frustum. Batches are tested four spheres at a time with SSE:
+// the spheres are kept in structure-of-arrays form so each plane costs three multiply-adds per four spheres.
+class FrustumCuller
+{
+public:
+	FrustumCuller()
+	{
+		this->ResetStats();
+	}
+
+	void SetFrustum(const Frustum &frustum)
+	{
+		this->frustum = frustum;
+	}
+
+	const Frustum &GetFrustum() const
+	{
+		return this->frustum;
+	}
+
+	void ResetStats()
+	{
+		this->stats.tested = 0;
+		this->stats.visible = 0;
+		this->stats.culled = 0;
+	}
+
+	const CullStats &GetStats() const
+	{
+		return this->stats;
+	}
+
+	// Single sphere, for objects that are submitted one at a time
+	bool IsVisible(const BoundingSphere &sphere)
+	{
+		bool visible = this->frustum.IntersectsSphere(sphere);
+		this->count(1, visible ? 1 : 0);
+
+		return visible;
+	}
+
+	// Tests count spheres and writes 1 (visible) or 0 (culled) to visible[i]. Returns the number of visible spheres.
+	GLuint CullSpheres(const BoundingSphere *spheres, GLuint count, unsigned char *visible)
+	{
+		if (count == 0)
+		{
+			return 0;
+		}
+
+		// Pad to a multiple of four so the SIMD loop has no tail
+		GLuint padded = (count + 3) & ~3u;
+		this->centersX.resize(padded);
+		this->centersY.resize(padded);
+		this->centersZ.resize(padded);
+		this->radii.resize(padded);
+
+		for (GLuint i = 0; i < padded; i++)
+		{
+			const BoundingSphere &sphere = i < count ? spheres[i] : spheres[count - 1];
+			this->centersX[i] = sphere.center.x;
+			this->centersY[i] = sphere.center.y;
+			this->centersZ[i] = sphere.center.z;
+			this->radii[i] = sphere.radius;
+		}
+
+		GLuint visibleCount = 0;
+
+		for (GLuint i = 0; i < padded; i += 4)
+		{
+			int mask = this->testFour(i);
+
+			for (GLuint j = 0; j < 4 && i + j < count; j++)
+			{
+				visible[i + j] = (mask >> j) & 1;
+				visibleCount += visible[i + j];
+			}
+		}
+
+		this->count(count, visibleCount);
+
+		return visibleCount;
+	}
+
+private:
+	Frustum frustum;
+	CullStats stats;
+
+	// Structure-of-arrays scratch for the batch test, kept between frames to avoid allocations
+	vector<float> centersX, centersY, centersZ, radii;
+
+	void count(GLuint tested, GLuint visible)
+	{
+		this->stats.tested += tested;
+		this->stats.visible += visible;
+		this->stats.culled += tested - visible;
+	}
+
+	// Returns a 4 bit mask, bit j set when sphere first + j is at least partly inside
+	int testFour(GLuint first) const
+	{
+#if FRUSTUM_USE_SSE
+		__m128 x = _mm_loadu_ps(&this->centersX[first]);
+		__m128 y = _mm_loadu_ps(&this->centersY[first]);
+		__m128 z = _mm_loadu_ps(&this->centersZ[first]);
+		__m128 negativeRadius = _mm_sub_ps(_mm_setzero_ps(), _mm_loadu_ps(&this->radii[first]));
+		__m128 inside = _mm_cmpeq_ps(x, x);	// All bits set (centers are never NaN)
+
+		for (GLuint p = 0; p < Frustum::PLANE_COUNT; p++)
+		{
+			const glm::vec4 &plane = this->frustum.planes[p];
+			__m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, _mm_set1_ps(plane.x)), _mm_mul_ps(y, _mm_set1_ps(plane.y))),
+				_mm_add_ps(_mm_mul_ps(z, _mm_set1_ps(plane.z)), _mm_set1_ps(plane.w)));
+			inside = _mm_and_ps(inside, _mm_cmpge_ps(distance, negativeRadius));
+		}
+
+		return _mm_movemask_ps(inside);
+#else
+		int mask = 0;
+
+		for (GLuint j = 0; j < 4; j++)
+		{
+			BoundingSphere sphere(glm::vec3(this->centersX[first + j], this->centersY[first + j], this->centersZ[first + j]), this->radii[first + j]);
+
+			if (this->frustum.IntersectsSphere(sphere))
+			{
+				mask |= 1 << j;
+			}
+		}
+
+		return mask;
+#endif
+	}
+};
\ No newline at end of file
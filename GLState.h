@@ -0,0 +1,450 @@
+#pragma once
+
+// Std. Includes
+#include <iostream>
+
+// GL Includes
+#include <GL/glew.h>
+
+#include "RenderStats.h"
+
+// Set to 1 to check the shadow against glGet* before every tracked call (slow, for debugging only)
+#ifndef GL_STATE_VALIDATE
+#define GL_STATE_VALIDATE 0
+#endif
+
+// Texture units whose GL_TEXTURE_2D and GL_TEXTURE_BUFFER bindings are shadowed; binds to higher units go straight to GL
+const GLuint GL_STATE_TEXTURE_UNITS = 16;
+
+// Thin shadow of the GL bindings the renderer touches: program, VAO, the generic buffer bindings, active texture
+// unit, the GL_TEXTURE_2D and GL_TEXTURE_BUFFER bindings of every unit, the usual enable bits and the depth/color write state. A call
+// that wouldn't change anything is dropped. Everything that binds one of these has to go through here, or call
+// Invalidate() afterwards.
+// GL_ELEMENT_ARRAY_BUFFER belongs to the VAO, so it is passed through without being shadowed.
+class GLState
+{
+public:
+	GLState()
+	{
+		this->Invalidate();
+	}
+
+	void UseProgram(GLuint program)
+	{
+		this->check();
+
+		if (this->program != program)
+		{
+			glUseProgram(program);
+			this->program = program;
+			GetRenderStats().programBinds++;
+		}
+	}
+
+	void BindVertexArray(GLuint vao)
+	{
+		this->check();
+
+		if (this->vertexArray != vao)
+		{
+			glBindVertexArray(vao);
+			this->vertexArray = vao;
+			GetRenderStats().vaoBinds++;
+		}
+	}
+
+	void BindBuffer(GLenum target, GLuint buffer)
+	{
+		this->check();
+
+		GLint slot = bufferSlot(target);
+
+		if (slot < 0)
+		{
+			glBindBuffer(target, buffer);
+			return;
+		}
+
+		if (this->buffers[slot] != buffer)
+		{
+			glBindBuffer(target, buffer);
+			this->buffers[slot] = buffer;
+		}
+	}
+
+	// Indexed binds also replace the generic binding of the target
+	void BindBufferBase(GLenum target, GLuint index, GLuint buffer)
+	{
+		this->check();
+
+		glBindBufferBase(target, index, buffer);
+
+		GLint slot = bufferSlot(target);
+
+		if (slot >= 0)
+		{
+			this->buffers[slot] = buffer;
+		}
+	}
+
+	void ActiveTexture(GLuint unit)
+	{
+		this->check();
+
+		if (this->activeUnit != unit)
+		{
+			glActiveTexture(GL_TEXTURE0 + unit);
+			this->activeUnit = unit;
+		}
+	}
+
+	// Binds a GL_TEXTURE_2D to a unit, making it the active one only if the bind is needed. Returns true when a bind was issued.
+	bool BindTexture(GLuint unit, GLuint texture)
+	{
+		this->check();
+
+		if (unit < GL_STATE_TEXTURE_UNITS && this->textures[unit] == texture)
+		{
+			return false;
+		}
+
+		this->ActiveTexture(unit);
+		glBindTexture(GL_TEXTURE_2D, texture);
+		GetRenderStats().textureBinds++;
+
+		if (unit < GL_STATE_TEXTURE_UNITS)
+		{
+			this->textures[unit] = texture;
+		}
+
+		return true;
+	}
+
+	// Same for a GL_TEXTURE_BUFFER; a unit keeps one binding per target, so this doesn't disturb its GL_TEXTURE_2D
+	bool BindTextureBuffer(GLuint unit, GLuint texture)
+	{
+		this->check();
+
+		if (unit < GL_STATE_TEXTURE_UNITS && this->bufferTextures[unit] == texture)
+		{
+			return false;
+		}
+
+		this->ActiveTexture(unit);
+		glBindTexture(GL_TEXTURE_BUFFER, texture);
+		GetRenderStats().textureBinds++;
+
+		if (unit < GL_STATE_TEXTURE_UNITS)
+		{
+			this->bufferTextures[unit] = texture;
+		}
+
+		return true;
+	}
+
+	// GL unbinds a deleted texture from every unit, so the cache must forget it too or a new texture reusing the
+	// name would look already bound
+	void DeleteTexture(GLuint texture)
+	{
+		this->check();
+
+		glDeleteTextures(1, &texture);
+
+		for (GLuint i = 0; i < GL_STATE_TEXTURE_UNITS; i++)
+		{
+			if (this->textures[i] == texture)
+			{
+				this->textures[i] = 0;
+			}
+		}
+	}
+
+	void Enable(GLenum capability)
+	{
+		this->setCapability(capability, true);
+	}
+
+	void Disable(GLenum capability)
+	{
+		this->setCapability(capability, false);
+	}
+
+	void DepthFunc(GLenum func)
+	{
+		this->check();
+
+		if (this->depthFunc != func)
+		{
+			glDepthFunc(func);
+			this->depthFunc = func;
+		}
+	}
+
+	void DepthMask(bool write)
+	{
+		this->check();
+
+		if (this->depthMask != (write ? 1 : 0))
+		{
+			glDepthMask(write ? GL_TRUE : GL_FALSE);
+			this->depthMask = write ? 1 : 0;
+		}
+	}
+
+	// All four channels at once, which is all the renderer needs
+	void ColorMask(bool write)
+	{
+		this->check();
+
+		if (this->colorMask != (write ? 1 : 0))
+		{
+			GLboolean value = write ? GL_TRUE : GL_FALSE;
+			glColorMask(value, value, value, value);
+			this->colorMask = write ? 1 : 0;
+		}
+	}
+
+	GLuint GetProgram() const
+	{
+		return this->program;
+	}
+
+	GLuint GetVertexArray() const
+	{
+		return this->vertexArray;
+	}
+
+	// Forgets everything; the next call for every piece of state goes to GL
+	void Invalidate()
+	{
+		this->program = UNKNOWN;
+		this->vertexArray = UNKNOWN;
+		this->activeUnit = UNKNOWN;
+		this->depthFunc = UNKNOWN;
+		this->depthMask = -1;
+		this->colorMask = -1;
+
+		for (GLuint i = 0; i < BUFFER_SLOTS; i++)
+		{
+			this->buffers[i] = UNKNOWN;
+		}
+
+		for (GLuint i = 0; i < GL_STATE_TEXTURE_UNITS; i++)
+		{
+			this->textures[i] = UNKNOWN;
+			this->bufferTextures[i] = UNKNOWN;
+		}
+
+		for (GLuint i = 0; i < CAPABILITY_SLOTS; i++)
+		{
+			this->capabilities[i] = -1;
+		}
+	}
+
+	// Compares every known piece of the shadow with glGet* and reports mismatches on cout. Returns true when they all match.
+	bool Validate() const
+	{
+		bool valid = true;
+		GLint value = 0;
+
+		if (this->program != UNKNOWN)
+		{
+			glGetIntegerv(GL_CURRENT_PROGRAM, &value);
+			valid &= report("program", 0, this->program, (GLuint)value);
+		}
+
+		if (this->vertexArray != UNKNOWN)
+		{
+			glGetIntegerv(GL_VERTEX_ARRAY_BINDING, &value);
+			valid &= report("vertex array", 0, this->vertexArray, (GLuint)value);
+		}
+
+		for (GLuint i = 0; i < BUFFER_SLOTS; i++)
+		{
+			if (this->buffers[i] != UNKNOWN)
+			{
+				glGetIntegerv(bufferQueries()[i], &value);
+				valid &= report("buffer slot", i, this->buffers[i], (GLuint)value);
+			}
+		}
+
+		GLint active = 0;
+		glGetIntegerv(GL_ACTIVE_TEXTURE, &active);
+
+		if (this->activeUnit != UNKNOWN)
+		{
+			valid &= report("active texture unit", 0, this->activeUnit, (GLuint)(active - GL_TEXTURE0));
+		}
+
+		for (GLuint i = 0; i < GL_STATE_TEXTURE_UNITS; i++)
+		{
+			if (this->textures[i] != UNKNOWN)
+			{
+				glActiveTexture(GL_TEXTURE0 + i);
+				glGetIntegerv(GL_TEXTURE_BINDING_2D, &value);
+				valid &= report("texture unit", i, this->textures[i], (GLuint)value);
+			}
+
+			if (this->bufferTextures[i] != UNKNOWN)
+			{
+				glActiveTexture(GL_TEXTURE0 + i);
+				glGetIntegerv(GL_TEXTURE_BINDING_BUFFER, &value);
+				valid &= report("buffer texture unit", i, this->bufferTextures[i], (GLuint)value);
+			}
+		}
+
+		// Put back whatever unit was really active, the query mustn't change state
+		glActiveTexture((GLenum)active);
+
+		for (GLuint i = 0; i < CAPABILITY_SLOTS; i++)
+		{
+			if (this->capabilities[i] >= 0)
+			{
+				valid &= report("capability", i, (GLuint)this->capabilities[i], glIsEnabled(capabilityList()[i]) ? 1 : 0);
+			}
+		}
+
+		if (this->depthFunc != UNKNOWN)
+		{
+			glGetIntegerv(GL_DEPTH_FUNC, &value);
+			valid &= report("depth func", 0, this->depthFunc, (GLuint)value);
+		}
+
+		GLboolean masks[4];
+
+		if (this->depthMask >= 0)
+		{
+			glGetBooleanv(GL_DEPTH_WRITEMASK, masks);
+			valid &= report("depth mask", 0, (GLuint)this->depthMask, masks[0] ? 1 : 0);
+		}
+
+		if (this->colorMask >= 0)
+		{
+			glGetBooleanv(GL_COLOR_WRITEMASK, masks);
+			valid &= report("color mask", 0, (GLuint)this->colorMask, masks[0] ? 1 : 0);
+		}
+
+		return valid;
+	}
+
+private:
+	static const GLuint UNKNOWN = (GLuint)-1;
+	static const GLuint BUFFER_SLOTS = 6;
+	static const GLuint CAPABILITY_SLOTS = 7;
+
+	// Generic buffer targets that are shadowed, and the query for each one. Function-local tables, so the header
+	// can be included by more than one translation unit.
+	static const GLenum *bufferTargets()
+	{
+		static const GLenum targets[BUFFER_SLOTS] =
+		{
+			GL_ARRAY_BUFFER, GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, GL_UNIFORM_BUFFER, GL_DRAW_INDIRECT_BUFFER, GL_SHADER_STORAGE_BUFFER
+		};
+
+		return targets;
+	}
+
+	static const GLenum *bufferQueries()
+	{
+		static const GLenum queries[BUFFER_SLOTS] =
+		{
+			GL_ARRAY_BUFFER_BINDING, GL_COPY_READ_BUFFER_BINDING, GL_COPY_WRITE_BUFFER_BINDING, GL_UNIFORM_BUFFER_BINDING, GL_DRAW_INDIRECT_BUFFER_BINDING, GL_SHADER_STORAGE_BUFFER_BINDING
+		};
+
+		return queries;
+	}
+
+	static const GLenum *capabilityList()
+	{
+		static const GLenum capabilities[CAPABILITY_SLOTS] =
+		{
+			GL_DEPTH_TEST, GL_BLEND, GL_CULL_FACE, GL_STENCIL_TEST, GL_SCISSOR_TEST, GL_POLYGON_OFFSET_FILL, GL_FRAMEBUFFER_SRGB
+		};
+
+		return capabilities;
+	}
+
+	GLuint program;
+	GLuint vertexArray;
+	GLuint buffers[BUFFER_SLOTS];
+	GLuint activeUnit;
+	GLuint textures[GL_STATE_TEXTURE_UNITS];
+	GLuint bufferTextures[GL_STATE_TEXTURE_UNITS];
+	GLint capabilities[CAPABILITY_SLOTS];	// -1 unknown, 0 disabled, 1 enabled
+	GLenum depthFunc;
+	GLint depthMask, colorMask;				// -1 unknown, 0 off, 1 on
+
+	static GLint bufferSlot(GLenum target)
+	{
+		for (GLuint i = 0; i < BUFFER_SLOTS; i++)
+		{
+			if (bufferTargets()[i] == target)
+			{
+				return (GLint)i;
+			}
+		}
+
+		return -1;
+	}
+
+	void setCapability(GLenum capability, bool enabled)
+	{
+		this->check();
+
+		GLint slot = -1;
+
+		for (GLuint i = 0; i < CAPABILITY_SLOTS; i++)
+		{
+			if (capabilityList()[i] == capability)
+			{
+				slot = (GLint)i;
+			}
+		}
+
+		if (slot >= 0 && this->capabilities[slot] == (enabled ? 1 : 0))
+		{
+			return;
+		}
+
+		if (enabled)
+		{
+			glEnable(capability);
+		}
+		else
+		{
+			glDisable(capability);
+		}
+
+		if (slot >= 0)
+		{
+			this->capabilities[slot] = enabled ? 1 : 0;
+		}
+	}
+
+	static bool report(const char *what, GLuint index, GLuint expected, GLuint actual)
+	{
+		if (expected == actual)
+		{
+			return true;
+		}
+
+		std::cout << "ERROR::GLSTATE::SHADOW_MISMATCH " << what << " " << index << ": shadow " << expected << ", GL " << actual << std::endl;
+
+		return false;
+	}
+
+	// Validation mode: every tracked call first checks that nobody changed the state behind our back
+	void check() const
+	{
+#if GL_STATE_VALIDATE
+		this->Validate();
+#endif
+	}
+};
+
+inline GLState &GetGLState()
+{
+	static GLState state;
+
+	return state;
+}
\ No newline at end of file
@@ -0,0 +1,485 @@
+#pragma once
+
+// Std. Includes
+#include <vector>
+#include <cstddef>
+
+// GL Includes
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include "Transform.h"
+#include "GLState.h"
+#include "RenderStats.h"
+
+using namespace std;
+
+struct Vertex
+{
+	// Position
+	glm::vec3 Position;
+	// Normal
+	glm::vec3 Normal;
+	// TexCoords
+	glm::vec2 TexCoords;
+};
+
+// First attribute location of the per-instance model matrix (it spans locations 3, 4, 5 and 6)
+const GLuint INSTANCE_MATRIX_LOCATION = 3;
+// First attribute location of the per-instance normal matrix (locations 7, 8 and 9)
+const GLuint INSTANCE_NORMAL_LOCATION = 7;
+
+// One element of the instance stream. The normal matrix columns are padded to vec4 so the same buffer can be
+// read as a std430 array by the indirect shader.
+struct InstanceData
+{
+	glm::mat4 model;
+	glm::vec4 normal[3];
+};
+
+// Shader storage bindings used by the multi-draw-indirect path (see Shader/lighting_mdi.vs)
+const GLuint TRANSFORMS_SSBO_BINDING = 0;
+const GLuint DRAW_DATA_SSBO_BINDING = 1;
+
+// Layout fixed by glMultiDrawElementsIndirect
+struct DrawElementsIndirectCommand
+{
+	GLuint count;
+	GLuint instanceCount;
+	GLuint firstIndex;
+	GLint baseVertex;
+	GLuint baseInstance;
+};
+
+// Hands out consecutive ranges of elements from the front of a growing capacity. Ranges are never given back
+// (see GeometryArena), so there is no free list to search or merge.
+class RangeAllocator
+{
+public:
+	RangeAllocator() : capacity(0), used(0)
+	{
+	}
+
+	GLuint GetCapacity() const
+	{
+		return this->capacity;
+	}
+
+	// Returns false when the rest of the capacity is too small
+	bool Allocate(GLuint size, GLuint &offset)
+	{
+		if (this->capacity - this->used < size)
+		{
+			return false;
+		}
+
+		offset = this->used;
+		this->used += size;
+
+		return true;
+	}
+
+	// Appends newCapacity - capacity elements of free space at the end
+	void Grow(GLuint newCapacity)
+	{
+		this->capacity = newCapacity;
+	}
+
+private:
+	GLuint capacity;
+	GLuint used;
+};
+
+// Owns the geometry of every Mesh: one interleaved vertex buffer, one index buffer and a single VAO for
+// the Vertex format, so switching meshes never switches VAOs. Meshes only keep their baseVertex/firstIndex.
+// Positions are also kept in a second, tightly packed buffer (same baseVertex) with its own VAO, so a
+// depth-only pass fetches 12 bytes per vertex instead of a whole Vertex.
+// It also owns the per-frame instance stream (model matrices) that instanced and indirect draws read from.
+// The arena only grows: meshes are plain copyable values that don't own their ranges, and the scene is loaded
+// once, so nothing is ever freed.
+class GeometryArena
+{
+public:
+	GeometryArena() : VAO(0), VBO(0), IBO(0), depthVAO(0), positionVBO(0), instanceVBO(0), instanceCapacity(0), uploadedInstances(0),
+		indirectBuffer(0), drawDataBuffer(0), indirectCapacity(0), drawDataCapacity(0)
+	{
+	}
+
+	// Copies the vertices and indices into the shared buffers. Indices stay relative to the mesh (use baseVertex).
+	void Allocate(const vector<Vertex> &vertices, const vector<GLuint> &indices, GLint &baseVertex, GLuint &firstIndex)
+	{
+		this->Allocate(vertices.data(), (GLuint)vertices.size(), NULL, indices.data(), (GLuint)indices.size(), baseVertex, firstIndex);
+	}
+
+	// Same from raw arrays, e.g. a mapped mesh cache. positions is the packed copy of the vertex positions for the
+	// depth stream; when NULL it is extracted from vertices.
+	void Allocate(const Vertex *vertices, GLuint vertexCount, const glm::vec3 *positions, const GLuint *indices, GLuint indexCount, GLint &baseVertex, GLuint &firstIndex)
+	{
+		this->init();
+
+		GLuint vertexOffset = 0, indexOffset = 0;
+
+		while (!this->vertexRanges.Allocate(vertexCount, vertexOffset))
+		{
+			// Both vertex streams share the vertex ranges, so they grow together
+			GLuint newCapacity = this->grownCapacity(this->vertexRanges, vertexCount);
+			this->resizeBuffer(this->VBO, sizeof(Vertex), this->vertexRanges.GetCapacity(), newCapacity);
+			this->resizeBuffer(this->positionVBO, sizeof(glm::vec3), this->vertexRanges.GetCapacity(), newCapacity);
+			this->vertexRanges.Grow(newCapacity);
+		}
+
+		while (!this->indexRanges.Allocate(indexCount, indexOffset))
+		{
+			GLuint newCapacity = this->grownCapacity(this->indexRanges, indexCount);
+			this->resizeBuffer(this->IBO, sizeof(GLuint), this->indexRanges.GetCapacity(), newCapacity);
+			this->indexRanges.Grow(newCapacity);
+		}
+
+		GetGLState().BindBuffer(GL_ARRAY_BUFFER, this->VBO);
+		glBufferSubData(GL_ARRAY_BUFFER, vertexOffset * sizeof(Vertex), vertexCount * sizeof(Vertex), vertices);
+		CountUpload(vertexCount * sizeof(Vertex));
+
+		// Position-only copy for the depth pass
+		if (positions == NULL)
+		{
+			this->positions.resize(vertexCount);
+
+			for (GLuint i = 0; i < vertexCount; i++)
+			{
+				this->positions[i] = vertices[i].Position;
+			}
+
+			positions = this->positions.data();
+		}
+
+		GetGLState().BindBuffer(GL_ARRAY_BUFFER, this->positionVBO);
+		glBufferSubData(GL_ARRAY_BUFFER, vertexOffset * sizeof(glm::vec3), vertexCount * sizeof(glm::vec3), positions);
+		CountUpload(vertexCount * sizeof(glm::vec3));
+
+		// The element buffer binding is VAO state, so upload through GL_COPY_WRITE_BUFFER instead
+		GetGLState().BindBuffer(GL_COPY_WRITE_BUFFER, this->IBO);
+		glBufferSubData(GL_COPY_WRITE_BUFFER, indexOffset * sizeof(GLuint), indexCount * sizeof(GLuint), indices);
+		CountUpload(indexCount * sizeof(GLuint));
+
+		baseVertex = (GLint)vertexOffset;
+		firstIndex = indexOffset;
+	}
+
+	GLuint GetVAO() const
+	{
+		return this->VAO;
+	}
+
+	// VAO with only the position stream (location 0) and the instance model matrix (locations 3 to 6)
+	GLuint GetDepthVAO() const
+	{
+		return this->depthVAO;
+	}
+
+	// Starts a new frame of the instance stream
+	void BeginFrame()
+	{
+		this->instances.clear();
+		this->uploadedInstances = 0;
+
+		// Orphan last frame's storage so the driver never waits on draws still reading it
+		if (this->instanceVBO != 0)
+		{
+			GetGLState().BindBuffer(GL_ARRAY_BUFFER, this->instanceVBO);
+			glBufferData(GL_ARRAY_BUFFER, this->instanceCapacity * sizeof(InstanceData), NULL, GL_STREAM_DRAW);
+		}
+	}
+
+	// Appends model matrices, with their normal matrices, to this frame's stream and returns the index of the first one
+	GLuint PushInstances(const glm::mat4 *transforms, GLsizei count)
+	{
+		GLuint baseInstance = (GLuint)this->instances.size();
+		this->instances.resize(baseInstance + count);
+
+		for (GLsizei i = 0; i < count; i++)
+		{
+			InstanceData &instance = this->instances[baseInstance + i];
+			glm::mat3 normalMatrix = ComputeNormalMatrix(transforms[i]);
+
+			instance.model = transforms[i];
+			instance.normal[0] = glm::vec4(normalMatrix[0], 0.0f);
+			instance.normal[1] = glm::vec4(normalMatrix[1], 0.0f);
+			instance.normal[2] = glm::vec4(normalMatrix[2], 0.0f);
+		}
+
+		return baseInstance;
+	}
+
+	// Uploads the matrices pushed since the last sync with a single glBufferSubData
+	void SyncInstances()
+	{
+		this->init();
+
+		if (this->uploadedInstances == this->instances.size())
+		{
+			return;
+		}
+
+		GetGLState().BindBuffer(GL_ARRAY_BUFFER, this->instanceVBO);
+
+		if (this->instances.size() > this->instanceCapacity)
+		{
+			// Same buffer name, so the VAO attribute pointers stay valid; the whole stream is sent again
+			while (this->instanceCapacity < this->instances.size())
+			{
+				this->instanceCapacity *= 2;
+			}
+
+			glBufferData(GL_ARRAY_BUFFER, this->instanceCapacity * sizeof(InstanceData), NULL, GL_STREAM_DRAW);
+			this->uploadedInstances = 0;
+		}
+
+		glBufferSubData(GL_ARRAY_BUFFER, this->uploadedInstances * sizeof(InstanceData), (this->instances.size() - this->uploadedInstances) * sizeof(InstanceData),
+			&this->instances[this->uploadedInstances]);
+		CountUpload((this->instances.size() - this->uploadedInstances) * sizeof(InstanceData));
+
+		this->uploadedInstances = this->instances.size();
+	}
+
+	// Draws a mesh range. Expects the arena VAO (or the depth VAO) to be bound.
+	void DrawElements(GLsizei count, GLuint firstIndex, GLint baseVertex) const
+	{
+		glDrawElementsBaseVertex(GL_TRIANGLES, count, GL_UNSIGNED_INT, (GLvoid *)(firstIndex * sizeof(GLuint)), baseVertex);
+		CountDraw(count);
+	}
+
+	// Draws instanceCount copies of a mesh range reading matrices [baseInstance, baseInstance + instanceCount)
+	// from the instance stream. Expects the arena VAO (or the depth VAO) to be bound and the stream to be synced.
+	void DrawElementsInstanced(GLsizei count, GLuint firstIndex, GLint baseVertex, GLsizei instanceCount, GLuint baseInstance) const
+	{
+		CountDraw(count, instanceCount);
+
+		if (GLEW_VERSION_4_2 || GLEW_ARB_base_instance)
+		{
+			glDrawElementsInstancedBaseVertexBaseInstance(GL_TRIANGLES, count, GL_UNSIGNED_INT, (GLvoid *)(firstIndex * sizeof(GLuint)), instanceCount, baseVertex, baseInstance);
+			return;
+		}
+
+		// GL 3.3 has no base instance: point the matrix attributes at the first matrix instead
+		this->pointInstanceAttributes(baseInstance);
+		glDrawElementsInstancedBaseVertex(GL_TRIANGLES, count, GL_UNSIGNED_INT, (GLvoid *)(firstIndex * sizeof(GLuint)), instanceCount, baseVertex);
+		this->pointInstanceAttributes(0);
+	}
+
+	// glMultiDrawElementsIndirect and gl_DrawIDARB are needed for the indirect path
+	bool SupportsMultiDrawIndirect() const
+	{
+		return (GLEW_VERSION_4_3 != 0) && (GLEW_VERSION_4_6 || GLEW_ARB_shader_draw_parameters);
+	}
+
+	// Uploads a frame's worth of indirect commands plus, for each command, the index of its first matrix in
+	// the instance stream, and binds everything the indirect shader reads. Call once per frame before MultiDraw.
+	void SetIndirectCommands(const vector<DrawElementsIndirectCommand> &commands, const vector<GLuint> &firstTransforms)
+	{
+		this->init();
+		this->SyncInstances();
+
+		if (this->indirectBuffer == 0)
+		{
+			glGenBuffers(1, &this->indirectBuffer);
+			glGenBuffers(1, &this->drawDataBuffer);
+		}
+
+		GetGLState().BindBuffer(GL_DRAW_INDIRECT_BUFFER, this->indirectBuffer);
+		this->streamUpload(GL_DRAW_INDIRECT_BUFFER, this->indirectCapacity, commands.size() * sizeof(DrawElementsIndirectCommand), commands.data());
+
+		GetGLState().BindBuffer(GL_SHADER_STORAGE_BUFFER, this->drawDataBuffer);
+		this->streamUpload(GL_SHADER_STORAGE_BUFFER, this->drawDataCapacity, firstTransforms.size() * sizeof(GLuint), firstTransforms.data());
+
+		// The instance stream doubles as the transform SSBO
+		GetGLState().BindBufferBase(GL_SHADER_STORAGE_BUFFER, TRANSFORMS_SSBO_BINDING, this->instanceVBO);
+		GetGLState().BindBufferBase(GL_SHADER_STORAGE_BUFFER, DRAW_DATA_SSBO_BINDING, this->drawDataBuffer);
+	}
+
+	// Issues drawCount commands starting at firstCommand of the buffer given to SetIndirectCommands.
+	// Expects the arena VAO and the indirect buffer to be bound. Counts the call; the arena doesn't keep the
+	// commands, so their vertices are counted by whoever built them (CountVertices).
+	void MultiDraw(GLuint firstCommand, GLsizei drawCount) const
+	{
+		CountDrawCall();
+		glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, (const GLvoid *)(firstCommand * sizeof(DrawElementsIndirectCommand)), drawCount, 0);
+	}
+
+private:
+	GLuint VAO, VBO, IBO;
+	RangeAllocator vertexRanges, indexRanges;
+
+	// Depth pass stream
+	GLuint depthVAO, positionVBO;
+	vector<glm::vec3> positions;	// Scratch for Allocate
+
+	// Per-frame instance stream
+	GLuint instanceVBO;
+	size_t instanceCapacity;
+	size_t uploadedInstances;
+	vector<InstanceData> instances;
+
+	// Indirect path
+	GLuint indirectBuffer, drawDataBuffer;
+	size_t indirectCapacity, drawDataCapacity;
+
+	void init()
+	{
+		if (this->VAO != 0)
+		{
+			return;
+		}
+
+		const GLuint initialVertices = 1 << 18;	// 8 MB of Vertex
+		const GLuint initialIndices = 1 << 20;	// 4 MB of GLuint
+		this->instanceCapacity = 256;
+
+		glGenVertexArrays(1, &this->VAO);
+		glGenBuffers(1, &this->VBO);
+		glGenBuffers(1, &this->IBO);
+		glGenBuffers(1, &this->instanceVBO);
+		glGenVertexArrays(1, &this->depthVAO);
+		glGenBuffers(1, &this->positionVBO);
+
+		GetGLState().BindVertexArray(this->VAO);
+
+		GetGLState().BindBuffer(GL_ARRAY_BUFFER, this->VBO);
+		glBufferData(GL_ARRAY_BUFFER, initialVertices * sizeof(Vertex), NULL, GL_STATIC_DRAW);
+		this->vertexRanges.Grow(initialVertices);
+
+		GetGLState().BindBuffer(GL_ELEMENT_ARRAY_BUFFER, this->IBO);
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, initialIndices * sizeof(GLuint), NULL, GL_STATIC_DRAW);
+		this->indexRanges.Grow(initialIndices);
+
+		// Set the vertex attribute pointers
+		// Vertex Positions
+		glEnableVertexAttribArray(0);
+		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid *)0);
+		// Vertex Normals
+		glEnableVertexAttribArray(1);
+		glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid *)offsetof(Vertex, Normal));
+		// Vertex Texture Coords
+		glEnableVertexAttribArray(2);
+		glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid *)offsetof(Vertex, TexCoords));
+
+		// Per-instance model matrix, one column per location
+		GetGLState().BindBuffer(GL_ARRAY_BUFFER, this->instanceVBO);
+		glBufferData(GL_ARRAY_BUFFER, this->instanceCapacity * sizeof(InstanceData), NULL, GL_STREAM_DRAW);
+
+		for (GLuint i = 0; i < 4; i++)
+		{
+			glEnableVertexAttribArray(INSTANCE_MATRIX_LOCATION + i);
+			glVertexAttribDivisor(INSTANCE_MATRIX_LOCATION + i, 1);
+		}
+
+		for (GLuint i = 0; i < 3; i++)
+		{
+			glEnableVertexAttribArray(INSTANCE_NORMAL_LOCATION + i);
+			glVertexAttribDivisor(INSTANCE_NORMAL_LOCATION + i, 1);
+		}
+
+		this->pointInstanceAttributes(0);
+
+		// Depth VAO: packed positions, the same indices and the instance model matrix. No normals or UVs.
+		GetGLState().BindVertexArray(this->depthVAO);
+
+		GetGLState().BindBuffer(GL_ARRAY_BUFFER, this->positionVBO);
+		glBufferData(GL_ARRAY_BUFFER, initialVertices * sizeof(glm::vec3), NULL, GL_STATIC_DRAW);
+		glEnableVertexAttribArray(0);
+		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), (GLvoid *)0);
+
+		GetGLState().BindBuffer(GL_ELEMENT_ARRAY_BUFFER, this->IBO);
+
+		for (GLuint i = 0; i < 4; i++)
+		{
+			glEnableVertexAttribArray(INSTANCE_MATRIX_LOCATION + i);
+			glVertexAttribDivisor(INSTANCE_MATRIX_LOCATION + i, 1);
+		}
+
+		this->pointInstanceAttributes(0);
+
+		// Keep later GL_ELEMENT_ARRAY_BUFFER binds from landing in the arena VAOs
+		GetGLState().BindVertexArray(0);
+	}
+
+	// Expects the arena VAO to be bound
+	void pointInstanceAttributes(GLuint baseInstance) const
+	{
+		GetGLState().BindBuffer(GL_ARRAY_BUFFER, this->instanceVBO);
+
+		for (GLuint i = 0; i < 4; i++)
+		{
+			glVertexAttribPointer(INSTANCE_MATRIX_LOCATION + i, 4, GL_FLOAT, GL_FALSE, sizeof(InstanceData),
+				(GLvoid *)(baseInstance * sizeof(InstanceData) + offsetof(InstanceData, model) + sizeof(glm::vec4) * i));
+		}
+
+		// Only xyz of each padded column
+		for (GLuint i = 0; i < 3; i++)
+		{
+			glVertexAttribPointer(INSTANCE_NORMAL_LOCATION + i, 3, GL_FLOAT, GL_FALSE, sizeof(InstanceData),
+				(GLvoid *)(baseInstance * sizeof(InstanceData) + offsetof(InstanceData, normal) + sizeof(glm::vec4) * i));
+		}
+	}
+
+	// Doubles the capacity of a range allocator until `needed` more elements fit
+	static GLuint grownCapacity(const RangeAllocator &ranges, GLuint needed)
+	{
+		GLuint oldCapacity = ranges.GetCapacity();
+		GLuint newCapacity = oldCapacity * 2;
+
+		while (newCapacity - oldCapacity < needed)
+		{
+			newCapacity *= 2;
+		}
+
+		return newCapacity;
+	}
+
+	// Reallocates a buffer to newCapacity elements, keeping its name (and so the VAO bindings) and contents
+	void resizeBuffer(GLuint buffer, GLsizeiptr elementSize, GLuint oldCapacity, GLuint newCapacity)
+	{
+		GLuint scratch;
+		glGenBuffers(1, &scratch);
+		GetGLState().BindBuffer(GL_COPY_WRITE_BUFFER, scratch);
+		glBufferData(GL_COPY_WRITE_BUFFER, oldCapacity * elementSize, NULL, GL_STREAM_COPY);
+		GetGLState().BindBuffer(GL_COPY_READ_BUFFER, buffer);
+		glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, oldCapacity * elementSize);
+
+		// Reallocate through the copy targets so neither the element buffer binding of the VAO nor
+		// GL_ARRAY_BUFFER is disturbed, then copy the old contents back
+		glBufferData(GL_COPY_READ_BUFFER, newCapacity * elementSize, NULL, GL_STATIC_DRAW);
+		GetGLState().BindBuffer(GL_COPY_READ_BUFFER, scratch);
+		GetGLState().BindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+		glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, oldCapacity * elementSize);
+
+		// Deleting a bound buffer silently unbinds it, so unbind through the shadow first
+		GetGLState().BindBuffer(GL_COPY_READ_BUFFER, 0);
+		GetGLState().BindBuffer(GL_COPY_WRITE_BUFFER, 0);
+		glDeleteBuffers(1, &scratch);
+	}
+
+	// Orphans and refills a per-frame buffer bound to target, growing it when needed
+	void streamUpload(GLenum target, size_t &capacity, size_t size, const GLvoid *data)
+	{
+		if (size > capacity)
+		{
+			capacity = size * 2;
+		}
+
+		glBufferData(target, capacity, NULL, GL_STREAM_DRAW);
+
+		if (size > 0)
+		{
+			glBufferSubData(target, 0, size, data);
+			CountUpload(size);
+		}
+	}
+};
+
+// The arena shared by every Mesh in the process
+inline GeometryArena &GetGeometryArena()
+{
+	static GeometryArena arena;
+
+	return arena;
+}
\ No newline at end of file
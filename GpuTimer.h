@@ -0,0 +1,93 @@
+#pragma once
+
+// GL Includes
+#include <GL/glew.h>
+
+// Queries in flight per timer; results are read QUERY_RING - 1 frames late so the CPU never waits on the GPU
+const GLuint GPU_TIMER_QUERY_RING = 3;
+
+// Measures the GPU time of a block of commands with GL_TIME_ELAPSED queries (core since 3.3).
+// Call Begin()/End() around the block every frame it runs; GetMilliseconds() returns the newest finished result.
+// Timers can't be nested, GL only allows one GL_TIME_ELAPSED query at a time.
+class GpuTimer
+{
+public:
+	GpuTimer() : next(0), skipped(false), milliseconds(0.0)
+	{
+		for (GLuint i = 0; i < GPU_TIMER_QUERY_RING; i++)
+		{
+			this->queries[i] = 0;
+			this->pending[i] = false;
+		}
+	}
+
+	void Begin()
+	{
+		if (this->queries[0] == 0)
+		{
+			glGenQueries(GPU_TIMER_QUERY_RING, this->queries);
+		}
+
+		// The oldest query gets reused; collect it first if it finished
+		this->collect(this->next);
+
+		if (this->pending[this->next])
+		{
+			// Still running after a whole ring of frames, skip this frame rather than stall
+			this->skipped = true;
+			return;
+		}
+
+		this->skipped = false;
+		glBeginQuery(GL_TIME_ELAPSED, this->queries[this->next]);
+	}
+
+	void End()
+	{
+		if (this->skipped)
+		{
+			return;
+		}
+
+		glEndQuery(GL_TIME_ELAPSED);
+		this->pending[this->next] = true;
+		this->next = (this->next + 1) % GPU_TIMER_QUERY_RING;
+	}
+
+	double GetMilliseconds()
+	{
+		for (GLuint i = 0; i < GPU_TIMER_QUERY_RING; i++)
+		{
+			this->collect((this->next + i) % GPU_TIMER_QUERY_RING);
+		}
+
+		return this->milliseconds;
+	}
+
+private:
+	GLuint queries[GPU_TIMER_QUERY_RING];
+	bool pending[GPU_TIMER_QUERY_RING];
+	GLuint next;
+	bool skipped;
+	double milliseconds;
+
+	// Reads a query's result if it is available, without blocking
+	void collect(GLuint index)
+	{
+		if (!this->pending[index])
+		{
+			return;
+		}
+
+		GLint available = 0;
+		glGetQueryObjectiv(this->queries[index], GL_QUERY_RESULT_AVAILABLE, &available);
+
+		if (available)
+		{
+			GLuint64 nanoseconds = 0;
+			glGetQueryObjectui64v(this->queries[index], GL_QUERY_RESULT, &nanoseconds);
+			this->milliseconds = (double)nanoseconds / 1000000.0;
+			this->pending[index] = false;
+		}
+	}
+};
\ No newline at end of file
@@ -0,0 +1,391 @@
+#pragma once
+
+// Std. Includes
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <algorithm>
+
+// GL Includes
+#include <GL/glew.h>
+#include <GLFW/glfw3.h>
+
+// Define HEADLESS_EGL to create the headless context through EGL (surfaceless, or a 1x1 pbuffer when the driver
+// lacks EGL_KHR_surfaceless_context) instead of a hidden GLFW window. That one needs no display server at all,
+// Mesa's llvmpipe is enough, but GLEW then has to be built with EGL support (GLEW_EGL).
+#ifdef HEADLESS_EGL
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
+
+// Command line of a headless run: --headless [WIDTHxHEIGHT] [FRAMES]
+struct HeadlessOptions
+{
+	bool enabled;
+	int width, height;
+	GLuint frames;
+};
+
+inline HeadlessOptions ParseHeadlessOptions(int argc, char *argv[])
+{
+	HeadlessOptions options;
+	options.enabled = false;
+	options.width = 1920;
+	options.height = 1080;
+	options.frames = 600;
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "--headless") != 0)
+		{
+			continue;
+		}
+
+		options.enabled = true;
+
+		int width = 0, height = 0;
+
+		if (i + 1 < argc && sscanf(argv[i + 1], "%dx%d", &width, &height) == 2 && width > 0 && height > 0)
+		{
+			options.width = width;
+			options.height = height;
+			i++;
+		}
+
+		if (i + 1 < argc && atoi(argv[i + 1]) > 0)
+		{
+			options.frames = (GLuint)atoi(argv[i + 1]);
+			i++;
+		}
+	}
+
+	return options;
+}
+
+// GL 3.3 core context without anything on screen
+class HeadlessContext
+{
+public:
+	HeadlessContext() : window(NULL)
+#ifdef HEADLESS_EGL
+		, display(EGL_NO_DISPLAY), surface(EGL_NO_SURFACE), context(EGL_NO_CONTEXT)
+#endif
+	{
+	}
+
+	// Creates the context and makes it current. Prints the reason and returns false when it can't.
+	bool Create()
+	{
+#ifdef HEADLESS_EGL
+		// Mesa's surfaceless platform first, it doesn't need X11 or a GPU
+		PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay = (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+
+		if (getPlatformDisplay != NULL)
+		{
+			this->display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+		}
+
+		if (this->display == EGL_NO_DISPLAY)
+		{
+			this->display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+		}
+
+		EGLint major = 0, minor = 0;
+
+		if (this->display == EGL_NO_DISPLAY || !eglInitialize(this->display, &major, &minor))
+		{
+			std::cout << "ERROR::HEADLESS::EGL_INITIALIZE_FAILED" << std::endl;
+			return false;
+		}
+
+		const EGLint configAttributes[] =
+		{
+			EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+			EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+			EGL_NONE
+		};
+		EGLConfig config;
+		EGLint configCount = 0;
+
+		if (!eglChooseConfig(this->display, configAttributes, &config, 1, &configCount) || configCount == 0 || !eglBindAPI(EGL_OPENGL_API))
+		{
+			std::cout << "ERROR::HEADLESS::EGL_NO_OPENGL_CONFIG" << std::endl;
+			return false;
+		}
+
+		const EGLint contextAttributes[] =
+		{
+			EGL_CONTEXT_MAJOR_VERSION, 3,
+			EGL_CONTEXT_MINOR_VERSION, 3,
+			EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+			EGL_NONE
+		};
+		this->context = eglCreateContext(this->display, config, EGL_NO_CONTEXT, contextAttributes);
+
+		if (this->context == EGL_NO_CONTEXT)
+		{
+			std::cout << "ERROR::HEADLESS::EGL_CREATE_CONTEXT_FAILED" << std::endl;
+			return false;
+		}
+
+		// Everything is drawn into an FBO, the surface is only there for drivers that insist on one
+		const char *extensions = eglQueryString(this->display, EGL_EXTENSIONS);
+
+		if (extensions == NULL || strstr(extensions, "EGL_KHR_surfaceless_context") == NULL)
+		{
+			const EGLint surfaceAttributes[] = { EGL_WIDTH, 1, EGL_HEIGHT, 1, EGL_NONE };
+			this->surface = eglCreatePbufferSurface(this->display, config, surfaceAttributes);
+		}
+
+		if (!eglMakeCurrent(this->display, this->surface, this->surface, this->context))
+		{
+			std::cout << "ERROR::HEADLESS::EGL_MAKE_CURRENT_FAILED" << std::endl;
+			return false;
+		}
+#else
+		if (!glfwInit())
+		{
+			std::cout << "ERROR::HEADLESS::GLFW_INIT_FAILED" << std::endl;
+			return false;
+		}
+
+		// A window is still needed for the context, it just never gets shown
+		glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+		this->window = glfwCreateWindow(1, 1, "", NULL, NULL);
+
+		if (this->window == NULL)
+		{
+			std::cout << "ERROR::HEADLESS::GLFW_WINDOW_FAILED" << std::endl;
+			glfwTerminate();
+			return false;
+		}
+
+		glfwMakeContextCurrent(this->window);
+#endif
+
+		return true;
+	}
+
+	// glewInit() looks at the window system, which isn't there with EGL
+	GLenum InitGLEW()
+	{
+		glewExperimental = GL_TRUE;
+#ifdef HEADLESS_EGL
+		return glewContextInit();
+#else
+		return glewInit();
+#endif
+	}
+
+	void Destroy()
+	{
+#ifdef HEADLESS_EGL
+		if (this->display != EGL_NO_DISPLAY)
+		{
+			eglMakeCurrent(this->display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+
+			if (this->surface != EGL_NO_SURFACE)
+			{
+				eglDestroySurface(this->display, this->surface);
+			}
+
+			if (this->context != EGL_NO_CONTEXT)
+			{
+				eglDestroyContext(this->display, this->context);
+			}
+
+			eglTerminate(this->display);
+			this->display = EGL_NO_DISPLAY;
+		}
+#else
+		if (this->window != NULL)
+		{
+			glfwDestroyWindow(this->window);
+			this->window = NULL;
+			glfwTerminate();
+		}
+#endif
+	}
+
+private:
+	GLFWwindow *window;
+#ifdef HEADLESS_EGL
+	EGLDisplay display;
+	EGLSurface surface;
+	EGLContext context;
+#endif
+};
+
+// Color + depth framebuffer that replaces the default one in a headless run
+class OffscreenTarget
+{
+public:
+	OffscreenTarget() : framebuffer(0), color(0), depth(0)
+	{
+	}
+
+	bool Init(GLsizei width, GLsizei height)
+	{
+		glGenFramebuffers(1, &this->framebuffer);
+		glGenRenderbuffers(1, &this->color);
+		glGenRenderbuffers(1, &this->depth);
+
+		glBindRenderbuffer(GL_RENDERBUFFER, this->color);
+		glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+		glBindRenderbuffer(GL_RENDERBUFFER, this->depth);
+		glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, width, height);
+		glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+		glBindFramebuffer(GL_FRAMEBUFFER, this->framebuffer);
+		glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, this->color);
+		glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, this->depth);
+
+		if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+		{
+			std::cout << "ERROR::HEADLESS::FRAMEBUFFER_INCOMPLETE" << std::endl;
+			return false;
+		}
+
+		return true;
+	}
+
+	void Bind() const
+	{
+		glBindFramebuffer(GL_FRAMEBUFFER, this->framebuffer);
+	}
+
+	GLuint GetFramebuffer() const
+	{
+		return this->framebuffer;
+	}
+
+private:
+	GLuint framebuffer, color, depth;
+};
+
+// Frame times and CPU time per phase of a headless run. Mark(phase) charges the time since the previous mark
+// (or since BeginFrame) to that phase; EndFrame closes the frame. Does nothing until Start() is called.
+class FrameReport
+{
+public:
+	FrameReport() : enabled(false), triangles(0)
+	{
+	}
+
+	void Start(GLuint frames)
+	{
+		this->enabled = true;
+		this->frameMilliseconds.reserve(frames);
+	}
+
+	void BeginFrame()
+	{
+		if (!this->enabled)
+		{
+			return;
+		}
+
+		this->frameStart = std::chrono::high_resolution_clock::now();
+		this->lastMark = this->frameStart;
+	}
+
+	void Mark(const char *phase)
+	{
+		if (!this->enabled)
+		{
+			return;
+		}
+
+		std::chrono::high_resolution_clock::time_point now = std::chrono::high_resolution_clock::now();
+		double milliseconds = (double)std::chrono::duration_cast<std::chrono::nanoseconds>(now - this->lastMark).count() / 1000000.0;
+		this->lastMark = now;
+
+		for (GLuint i = 0; i < this->phases.size(); i++)
+		{
+			if (this->phases[i].name == phase)
+			{
+				this->phases[i].milliseconds += milliseconds;
+				return;
+			}
+		}
+
+		Phase entry;
+		entry.name = phase;
+		entry.milliseconds = milliseconds;
+		this->phases.push_back(entry);
+	}
+
+	// triangles: what the frame drew, for the throughput
+	void EndFrame(GLuint frameTriangles)
+	{
+		if (!this->enabled)
+		{
+			return;
+		}
+
+		std::chrono::high_resolution_clock::time_point now = std::chrono::high_resolution_clock::now();
+		this->frameMilliseconds.push_back((double)std::chrono::duration_cast<std::chrono::nanoseconds>(now - this->frameStart).count() / 1000000.0);
+		this->triangles += frameTriangles;
+	}
+
+	void Print(int width, int height) const
+	{
+		if (this->frameMilliseconds.empty())
+		{
+			return;
+		}
+
+		std::vector<double> sorted(this->frameMilliseconds);
+		std::sort(sorted.begin(), sorted.end());
+
+		double total = 0.0;
+
+		for (GLuint i = 0; i < sorted.size(); i++)
+		{
+			total += sorted[i];
+		}
+
+		GLuint frames = (GLuint)sorted.size();
+		double average = total / frames;
+
+		std::cout << "Headless " << width << "x" << height << ", " << frames << " frames in " << total / 1000.0 << " s ("
+			<< (average > 0.0 ? 1000.0 / average : 0.0) << " fps)" << std::endl;
+		std::cout << "  frame ms: avg " << average << " | p50 " << percentile(sorted, 0.50) << " | p90 " << percentile(sorted, 0.90)
+			<< " | p95 " << percentile(sorted, 0.95) << " | p99 " << percentile(sorted, 0.99) << " | max " << sorted.back() << std::endl;
+
+		for (GLuint i = 0; i < this->phases.size(); i++)
+		{
+			std::cout << "  " << this->phases[i].name << ": " << this->phases[i].milliseconds / frames << " ms/frame ("
+				<< (total > 0.0 ? 100.0 * this->phases[i].milliseconds / total : 0.0) << "%)" << std::endl;
+		}
+
+		std::cout << "  triangles: " << this->triangles / frames << " per frame | "
+			<< (total > 0.0 ? (double)this->triangles / (total / 1000.0) / 1000000.0 : 0.0) << " M/s" << std::endl;
+	}
+
+private:
+	struct Phase
+	{
+		std::string name;
+		double milliseconds;
+	};
+
+	bool enabled;
+	std::vector<double> frameMilliseconds;
+	std::vector<Phase> phases;
+	uint64_t triangles;
+	std::chrono::high_resolution_clock::time_point frameStart, lastMark;
+
+	// Nearest rank on an ascending list
+	static double percentile(const std::vector<double> &sorted, double fraction)
+	{
+		size_t rank = (size_t)(fraction * (double)(sorted.size() - 1) + 0.5);
+
+		return sorted[std::min(rank, sorted.size() - 1)];
+	}
+};
\ No newline at end of file
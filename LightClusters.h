@@ -0,0 +1,392 @@
+#pragma once
+
+// Std. Includes
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <chrono>
+
+// GL Includes
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include "Frustum.h"
+#include "GLState.h"
+#include "RenderStats.h"
+#include "LightRig.h"
+#include "Shader.h"
+
+using namespace std;
+
+// Froxel grid: screen tiles along x and y, exponential depth slices along z. Must leave every slice a
+// multiple of four clusters so the SIMD test has no tail.
+const GLuint CLUSTER_COUNT_X = 16;
+const GLuint CLUSTER_COUNT_Y = 9;
+const GLuint CLUSTER_COUNT_Z = 24;
+const GLuint CLUSTERS_PER_SLICE = CLUSTER_COUNT_X * CLUSTER_COUNT_Y;
+const GLuint CLUSTER_COUNT = CLUSTERS_PER_SLICE * CLUSTER_COUNT_Z;
+
+static_assert(CLUSTERS_PER_SLICE % 4 == 0, "A depth slice must hold a multiple of four clusters");
+static_assert(MAX_POINT_LIGHTS <= 65536, "Light indices are stored as 16 bit integers");
+
+// Texture units of the grid and index buffer textures ("clusterGrid" and "clusterLightIndices" in lighting.frag)
+const GLuint CLUSTER_GRID_TEXTURE_UNIT = 14;
+const GLuint CLUSTER_INDEX_TEXTURE_UNIT = 15;
+
+// Per-frame binning counters
+struct ClusterStats
+{
+	GLuint lights;			// Point lights considered
+	GLuint indices;			// Entries in the light index list, one per (cluster, light) pair
+	GLuint maxPerCluster;	// Longest list a fragment may have to walk
+	double buildMicroseconds;
+};
+
+// Clustered light assignment. Build() splits the view volume into CLUSTER_COUNT froxels, bins every point light
+// of the rig into the froxels its range sphere touches and uploads two buffer textures: the grid, with one
+// (first index, count) pair per cluster, and the index list those pairs point into. lighting.frag finds the
+// cluster of each fragment from gl_FragCoord and its view depth and only walks that cluster's lights.
+// Binning runs on the CPU: the cluster boxes are kept in view space in structure-of-arrays form and each light
+// sphere is tested against four of them at a time with SSE, only across the depth slices the sphere reaches.
+class LightClusters
+{
+public:
+	LightClusters() : gridBuffer(0), gridTexture(0), indexBuffer(0), indexTexture(0), indexCapacity(0), viewportWidth(0), viewportHeight(0),
+		nearPlane(0.0f), farPlane(0.0f), tileWidth(1.0f), tileHeight(1.0f)
+	{
+		this->stats.lights = 0;
+		this->stats.indices = 0;
+		this->stats.maxPerCluster = 0;
+		this->stats.buildMicroseconds = 0.0;
+	}
+
+	// Creates the buffer textures with an empty grid, so shading before the first Build() sees no point lights.
+	// Needs a current GL context.
+	void Init()
+	{
+		this->grid.assign(CLUSTER_COUNT * 2, 0);
+		this->counts.assign(CLUSTER_COUNT, 0);
+		this->clusterMinX.resize(CLUSTER_COUNT);
+		this->clusterMinY.resize(CLUSTER_COUNT);
+		this->clusterMinZ.resize(CLUSTER_COUNT);
+		this->clusterMaxX.resize(CLUSTER_COUNT);
+		this->clusterMaxY.resize(CLUSTER_COUNT);
+		this->clusterMaxZ.resize(CLUSTER_COUNT);
+
+		glGenBuffers(1, &this->gridBuffer);
+		glBindBuffer(GL_TEXTURE_BUFFER, this->gridBuffer);
+		glBufferData(GL_TEXTURE_BUFFER, this->grid.size() * sizeof(GLuint), &this->grid[0], GL_STREAM_DRAW);
+
+		glGenTextures(1, &this->gridTexture);
+		GetGLState().BindTextureBuffer(CLUSTER_GRID_TEXTURE_UNIT, this->gridTexture);
+		glTexBuffer(GL_TEXTURE_BUFFER, GL_RG32UI, this->gridBuffer);
+
+		this->indexCapacity = CLUSTER_COUNT;
+		glGenBuffers(1, &this->indexBuffer);
+		glBindBuffer(GL_TEXTURE_BUFFER, this->indexBuffer);
+		glBufferData(GL_TEXTURE_BUFFER, this->indexCapacity * sizeof(GLushort), NULL, GL_STREAM_DRAW);
+
+		glGenTextures(1, &this->indexTexture);
+		GetGLState().BindTextureBuffer(CLUSTER_INDEX_TEXTURE_UNIT, this->indexTexture);
+		glTexBuffer(GL_TEXTURE_BUFFER, GL_R16UI, this->indexBuffer);
+	}
+
+	// Points the sampler uniforms of a lit program at the cluster texture units. Once per program.
+	static void BindSamplers(Shader &shader)
+	{
+		shader.Use();
+		shader.SetInt(shader.GetUniformLocation("pointLightData"), POINT_LIGHTS_TEXTURE_UNIT);
+		shader.SetInt(shader.GetUniformLocation("clusterGrid"), CLUSTER_GRID_TEXTURE_UNIT);
+		shader.SetInt(shader.GetUniformLocation("clusterLightIndices"), CLUSTER_INDEX_TEXTURE_UNIT);
+	}
+
+	// Bins the rig's point lights for this camera and uploads the lists. Also writes the cluster parameters
+	// into the rig, so call it before LightRig::Upload(). nearPlane and farPlane must be the ones baked
+	// into projection; width and height are the viewport size in pixels.
+	void Build(LightRig &rig, const glm::mat4 &view, const glm::mat4 &projection, float nearPlane, float farPlane, int width, int height)
+	{
+		chrono::high_resolution_clock::time_point start = chrono::high_resolution_clock::now();
+
+		// The boxes only depend on the projection; the camera moving leaves them alone
+		if (projection != this->projection || nearPlane != this->nearPlane || farPlane != this->farPlane
+			|| width != this->viewportWidth || height != this->viewportHeight)
+		{
+			this->projection = projection;
+			this->nearPlane = nearPlane;
+			this->farPlane = farPlane;
+			this->viewportWidth = width;
+			this->viewportHeight = height;
+			this->buildClusterBoxes();
+		}
+
+		float sliceScale = (float)CLUSTER_COUNT_Z / std::log(farPlane / nearPlane);
+		float sliceBias = -sliceScale * std::log(nearPlane);
+
+		ClusterParams params;
+		params.depthPlane = -glm::vec4(view[0][2], view[1][2], view[2][2], view[3][2]);
+		params.scale = glm::vec4(this->tileWidth, this->tileHeight, sliceScale, sliceBias);
+		params.counts[0] = CLUSTER_COUNT_X;
+		params.counts[1] = CLUSTER_COUNT_Y;
+		params.counts[2] = CLUSTER_COUNT_Z;
+		rig.SetClusterParams(params);
+
+		// Pass 1: every (cluster, light) pair, counted per cluster
+		this->hitClusters.clear();
+		this->hitLights.clear();
+		std::fill(this->counts.begin(), this->counts.end(), 0);
+
+		int lightCount = rig.GetPointLightCount();
+
+		for (int i = 0; i < lightCount; i++)
+		{
+			const PointLightData &light = rig.GetPointLight(i);
+
+			if (light.range <= 0.0f)
+			{
+				continue;
+			}
+
+			glm::vec3 center(view * glm::vec4(light.position, 1.0f));
+			float depth = -center.z;
+
+			if (depth + light.range < nearPlane || depth - light.range > farPlane)
+			{
+				continue;
+			}
+
+			GLuint firstSlice = this->sliceOf(depth - light.range, sliceScale, sliceBias);
+			GLuint lastSlice = this->sliceOf(depth + light.range, sliceScale, sliceBias);
+
+			for (GLuint slice = firstSlice; slice <= lastSlice; slice++)
+			{
+				this->binSlice(slice, center, light.range, (GLushort)i);
+			}
+		}
+
+		// Pass 2: prefix sum into offsets, then scatter. Lights were visited in order, so each list comes out sorted.
+		GLuint offset = 0;
+		GLuint longest = 0;
+
+		for (GLuint c = 0; c < CLUSTER_COUNT; c++)
+		{
+			this->grid[c * 2] = offset;
+			this->grid[c * 2 + 1] = 0;
+			offset += this->counts[c];
+
+			if (this->counts[c] > longest)
+			{
+				longest = this->counts[c];
+			}
+		}
+
+		this->indices.resize(offset);
+
+		for (GLuint h = 0; h < this->hitClusters.size(); h++)
+		{
+			GLuint c = this->hitClusters[h];
+			this->indices[this->grid[c * 2] + this->grid[c * 2 + 1]++] = this->hitLights[h];
+		}
+
+		this->upload();
+
+		this->stats.lights = (GLuint)lightCount;
+		this->stats.indices = offset;
+		this->stats.maxPerCluster = longest;
+		this->stats.buildMicroseconds = (double)chrono::duration_cast<chrono::nanoseconds>(chrono::high_resolution_clock::now() - start).count() / 1000.0;
+	}
+
+	// Binds the point light, grid and index textures to their units. Through GLState, so it's free when nothing changed.
+	void Bind(const LightRig &rig) const
+	{
+		GetGLState().BindTextureBuffer(POINT_LIGHTS_TEXTURE_UNIT, rig.GetPointLightTexture());
+		GetGLState().BindTextureBuffer(CLUSTER_GRID_TEXTURE_UNIT, this->gridTexture);
+		GetGLState().BindTextureBuffer(CLUSTER_INDEX_TEXTURE_UNIT, this->indexTexture);
+	}
+
+	const ClusterStats &GetStats() const
+	{
+		return this->stats;
+	}
+
+private:
+	GLuint gridBuffer, gridTexture;
+	GLuint indexBuffer, indexTexture;
+	GLuint indexCapacity;	// In indices
+
+	// Projection the boxes were built for
+	glm::mat4 projection;
+	int viewportWidth, viewportHeight;
+	float nearPlane, farPlane;
+	float tileWidth, tileHeight;
+
+	// View space box of every cluster, structure-of-arrays, index x + y * CLUSTER_COUNT_X + z * CLUSTERS_PER_SLICE
+	vector<float> clusterMinX, clusterMinY, clusterMinZ;
+	vector<float> clusterMaxX, clusterMaxY, clusterMaxZ;
+
+	// Scratch kept between frames to avoid allocations
+	vector<GLuint> hitClusters;
+	vector<GLushort> hitLights;
+	vector<GLuint> counts;
+	vector<GLuint> grid;
+	vector<GLushort> indices;
+
+	ClusterStats stats;
+
+	GLuint sliceOf(float depth, float sliceScale, float sliceBias) const
+	{
+		if (depth <= this->nearPlane)
+		{
+			return 0;
+		}
+
+		float slice = std::log(depth) * sliceScale + sliceBias;
+
+		return slice >= (float)(CLUSTER_COUNT_Z - 1) ? CLUSTER_COUNT_Z - 1 : (GLuint)slice;
+	}
+
+	// Unprojects the corners of every tile onto the near and far planes and cuts each of those edges at the
+	// slice depths. The edges are straight lines for perspective and orthographic projections alike.
+	void buildClusterBoxes()
+	{
+		glm::mat4 inverseProjection = glm::inverse(this->projection);
+
+		this->tileWidth = std::ceil((float)this->viewportWidth / CLUSTER_COUNT_X);
+		this->tileHeight = std::ceil((float)this->viewportHeight / CLUSTER_COUNT_Y);
+
+		for (GLuint y = 0; y < CLUSTER_COUNT_Y; y++)
+		{
+			for (GLuint x = 0; x < CLUSTER_COUNT_X; x++)
+			{
+				// Tile corners in NDC; the last row and column may run past the viewport, clamp them
+				float left = glm::min(2.0f * x * this->tileWidth / this->viewportWidth - 1.0f, 1.0f);
+				float right = glm::min(2.0f * (x + 1) * this->tileWidth / this->viewportWidth - 1.0f, 1.0f);
+				float bottom = glm::min(2.0f * y * this->tileHeight / this->viewportHeight - 1.0f, 1.0f);
+				float top = glm::min(2.0f * (y + 1) * this->tileHeight / this->viewportHeight - 1.0f, 1.0f);
+
+				glm::vec2 corners[4] = { glm::vec2(left, bottom), glm::vec2(right, bottom), glm::vec2(left, top), glm::vec2(right, top) };
+				glm::vec3 nearPoints[4], farPoints[4];
+
+				for (GLuint i = 0; i < 4; i++)
+				{
+					glm::vec4 nearPoint = inverseProjection * glm::vec4(corners[i], -1.0f, 1.0f);
+					glm::vec4 farPoint = inverseProjection * glm::vec4(corners[i], 1.0f, 1.0f);
+					nearPoints[i] = glm::vec3(nearPoint) / nearPoint.w;
+					farPoints[i] = glm::vec3(farPoint) / farPoint.w;
+				}
+
+				for (GLuint z = 0; z < CLUSTER_COUNT_Z; z++)
+				{
+					float sliceNear = this->sliceDepth(z);
+					float sliceFar = this->sliceDepth(z + 1);
+					AABB box;
+
+					for (GLuint i = 0; i < 4; i++)
+					{
+						box.Expand(this->pointAtDepth(nearPoints[i], farPoints[i], sliceNear));
+						box.Expand(this->pointAtDepth(nearPoints[i], farPoints[i], sliceFar));
+					}
+
+					GLuint c = x + y * CLUSTER_COUNT_X + z * CLUSTERS_PER_SLICE;
+					this->clusterMinX[c] = box.min.x;
+					this->clusterMinY[c] = box.min.y;
+					this->clusterMinZ[c] = box.min.z;
+					this->clusterMaxX[c] = box.max.x;
+					this->clusterMaxY[c] = box.max.y;
+					this->clusterMaxZ[c] = box.max.z;
+				}
+			}
+		}
+	}
+
+	// View depth of the near boundary of slice z (z == CLUSTER_COUNT_Z gives the far plane)
+	float sliceDepth(GLuint z) const
+	{
+		return this->nearPlane * std::pow(this->farPlane / this->nearPlane, (float)z / CLUSTER_COUNT_Z);
+	}
+
+	glm::vec3 pointAtDepth(const glm::vec3 &nearPoint, const glm::vec3 &farPoint, float depth) const
+	{
+		float t = (depth - this->nearPlane) / (this->farPlane - this->nearPlane);
+
+		return nearPoint + (farPoint - nearPoint) * t;
+	}
+
+	// Records every cluster of one slice whose box the sphere touches
+	void binSlice(GLuint slice, const glm::vec3 &center, float radius, GLushort light)
+	{
+		GLuint first = slice * CLUSTERS_PER_SLICE;
+
+		for (GLuint c = first; c < first + CLUSTERS_PER_SLICE; c += 4)
+		{
+			int mask = this->testFour(c, center, radius);
+
+			for (GLuint j = 0; j < 4; j++)
+			{
+				if (mask & (1 << j))
+				{
+					this->hitClusters.push_back(c + j);
+					this->hitLights.push_back(light);
+					this->counts[c + j]++;
+				}
+			}
+		}
+	}
+
+	// Returns a 4 bit mask, bit j set when the sphere touches the box of cluster first + j. The squared distance
+	// from the center to each box is compared against the squared radius, which is infinite for lights that never fade.
+	int testFour(GLuint first, const glm::vec3 &center, float radius) const
+	{
+#if FRUSTUM_USE_SSE
+		__m128 zero = _mm_setzero_ps();
+		__m128 x = _mm_set1_ps(center.x);
+		__m128 y = _mm_set1_ps(center.y);
+		__m128 z = _mm_set1_ps(center.z);
+
+		__m128 dx = _mm_add_ps(_mm_max_ps(_mm_sub_ps(_mm_loadu_ps(&this->clusterMinX[first]), x), zero), _mm_max_ps(_mm_sub_ps(x, _mm_loadu_ps(&this->clusterMaxX[first])), zero));
+		__m128 dy = _mm_add_ps(_mm_max_ps(_mm_sub_ps(_mm_loadu_ps(&this->clusterMinY[first]), y), zero), _mm_max_ps(_mm_sub_ps(y, _mm_loadu_ps(&this->clusterMaxY[first])), zero));
+		__m128 dz = _mm_add_ps(_mm_max_ps(_mm_sub_ps(_mm_loadu_ps(&this->clusterMinZ[first]), z), zero), _mm_max_ps(_mm_sub_ps(z, _mm_loadu_ps(&this->clusterMaxZ[first])), zero));
+		__m128 distanceSquared = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+
+		return _mm_movemask_ps(_mm_cmple_ps(distanceSquared, _mm_set1_ps(radius * radius)));
+#else
+		int mask = 0;
+
+		for (GLuint j = 0; j < 4; j++)
+		{
+			GLuint c = first + j;
+			float dx = glm::max(this->clusterMinX[c] - center.x, 0.0f) + glm::max(center.x - this->clusterMaxX[c], 0.0f);
+			float dy = glm::max(this->clusterMinY[c] - center.y, 0.0f) + glm::max(center.y - this->clusterMaxY[c], 0.0f);
+			float dz = glm::max(this->clusterMinZ[c] - center.z, 0.0f) + glm::max(center.z - this->clusterMaxZ[c], 0.0f);
+
+			if (dx * dx + dy * dy + dz * dz <= radius * radius)
+			{
+				mask |= 1 << j;
+			}
+		}
+
+		return mask;
+#endif
+	}
+
+	// The grid has a fixed size and is replaced whole; the index list is orphaned each frame and grows when needed
+	void upload()
+	{
+		glBindBuffer(GL_TEXTURE_BUFFER, this->gridBuffer);
+		glBufferData(GL_TEXTURE_BUFFER, this->grid.size() * sizeof(GLuint), &this->grid[0], GL_STREAM_DRAW);
+		CountUpload(this->grid.size() * sizeof(GLuint));
+
+		while (this->indexCapacity < this->indices.size())
+		{
+			this->indexCapacity *= 2;
+		}
+
+		glBindBuffer(GL_TEXTURE_BUFFER, this->indexBuffer);
+		glBufferData(GL_TEXTURE_BUFFER, this->indexCapacity * sizeof(GLushort), NULL, GL_STREAM_DRAW);
+
+		if (!this->indices.empty())
+		{
+			glBufferSubData(GL_TEXTURE_BUFFER, 0, this->indices.size() * sizeof(GLushort), &this->indices[0]);
+			CountUpload(this->indices.size() * sizeof(GLushort));
+		}
+	}
+};
\ No newline at end of file
@@ -0,0 +1,328 @@
+#pragma once
+
+#include <cstddef>
+#include <cstring>
+#include <cstdint>
+#include <cmath>
+#include <cfloat>
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include "GLState.h"
+#include "RenderStats.h"
+
+// Point lights live in a buffer texture indexed through the light clusters (LightClusters.h), not in the uniform block
+const int MAX_POINT_LIGHTS = 256;
+
+// Lights dimmer than 1/256 of their brightest channel are treated as out of range when binning them into clusters
+const float POINT_LIGHT_CUTOFF = 1.0f / 256.0f;
+
+// Texture unit of the point light buffer texture ("pointLightData" in lighting.frag), above the material units
+const GLuint POINT_LIGHTS_TEXTURE_UNIT = 13;
+
+// Uniform buffer binding point shared by every program that declares the "Lights" block
+const GLuint LIGHTS_BINDING_POINT = 0;
+
+// CPU mirrors of the std140 structs in lighting.frag. glm::vec3 is 12 bytes, so each one is followed
+// by the float (or explicit padding) that completes its 16 byte row.
+struct DirLightData
+{
+	glm::vec3 direction;
+	float padding0;
+	glm::vec3 ambient;
+	float padding1;
+	glm::vec3 diffuse;
+	float padding2;
+	glm::vec3 specular;
+	float padding3;
+
+	DirLightData(glm::vec3 direction = glm::vec3(0.0f), glm::vec3 ambient = glm::vec3(0.0f), glm::vec3 diffuse = glm::vec3(0.0f), glm::vec3 specular = glm::vec3(0.0f))
+		: direction(direction), padding0(0.0f), ambient(ambient), padding1(0.0f), diffuse(diffuse), padding2(0.0f), specular(specular), padding3(0.0f)
+	{
+	}
+};
+
+struct PointLightData
+{
+	glm::vec3 position;
+	float constant;
+	glm::vec3 ambient;
+	float linear;
+	glm::vec3 diffuse;
+	float quadratic;
+	glm::vec3 specular;
+	float range;	// Filled in by LightRig::SetPointLight, see ComputePointLightRange
+
+	PointLightData(glm::vec3 position = glm::vec3(0.0f), glm::vec3 ambient = glm::vec3(0.0f), glm::vec3 diffuse = glm::vec3(0.0f), glm::vec3 specular = glm::vec3(0.0f),
+		float constant = 1.0f, float linear = 0.0f, float quadratic = 0.0f)
+		: position(position), constant(constant), ambient(ambient), linear(linear), diffuse(diffuse), quadratic(quadratic), specular(specular), range(0.0f)
+	{
+	}
+};
+
+struct SpotLightData
+{
+	glm::vec3 position;
+	float cutOff;
+	glm::vec3 direction;
+	float outerCutOff;
+	glm::vec3 ambient;
+	float constant;
+	glm::vec3 diffuse;
+	float linear;
+	glm::vec3 specular;
+	float quadratic;
+
+	SpotLightData(glm::vec3 position = glm::vec3(0.0f), glm::vec3 direction = glm::vec3(0.0f, 0.0f, -1.0f), float cutOff = 1.0f, float outerCutOff = 1.0f,
+		glm::vec3 ambient = glm::vec3(0.0f), glm::vec3 diffuse = glm::vec3(0.0f), glm::vec3 specular = glm::vec3(0.0f),
+		float constant = 1.0f, float linear = 0.0f, float quadratic = 0.0f)
+		: position(position), cutOff(cutOff), direction(direction), outerCutOff(outerCutOff), ambient(ambient), constant(constant),
+		diffuse(diffuse), linear(linear), specular(specular), quadratic(quadratic)
+	{
+	}
+};
+
+// What lighting.frag needs to find the cluster of a fragment. Written every frame by LightClusters::Build.
+struct ClusterParams
+{
+	glm::vec4 depthPlane;	// View space depth of a world position p is dot(depthPlane, vec4(p, 1))
+	glm::vec4 scale;		// Tile size in pixels (x, y), depth slice scale (z) and bias (w) applied to log(depth)
+	GLuint counts[4];		// Clusters along x, y and z; the last one is unused
+
+	ClusterParams() : depthPlane(0.0f), scale(1.0f, 1.0f, 0.0f, 0.0f)
+	{
+		this->counts[0] = this->counts[1] = this->counts[2] = 1;
+		this->counts[3] = 0;
+	}
+};
+
+// Whole contents of the "Lights" block, byte for byte. The camera-driven spot light is placed next to
+// the cluster parameters, which also follow the camera, so a typical frame dirties a single short range.
+struct LightBlock
+{
+	DirLightData dirLight;
+	SpotLightData spotLight;
+	ClusterParams clusters;
+};
+
+static_assert(sizeof(DirLightData) == 64, "DirLightData must match the std140 DirLight layout");
+static_assert(sizeof(PointLightData) == 64, "PointLightData must be four RGBA32F texels of the point light buffer texture");
+static_assert(sizeof(SpotLightData) == 80, "SpotLightData must match the std140 SpotLight layout");
+static_assert(offsetof(LightBlock, spotLight) == 64 && offsetof(LightBlock, clusters) == 144 && sizeof(LightBlock) == 192, "LightBlock must match the std140 Lights block");
+
+// Distance at which the light's attenuation drops below POINT_LIGHT_CUTOFF of its brightest channel.
+// Lights without linear or quadratic falloff never fade and get FLT_MAX, which reaches every cluster.
+inline float ComputePointLightRange(const PointLightData &light)
+{
+	glm::vec3 brightest = glm::max(light.ambient, glm::max(light.diffuse, light.specular));
+	float intensity = glm::max(brightest.x, glm::max(brightest.y, brightest.z));
+
+	if (intensity <= 0.0f)
+	{
+		return 0.0f;
+	}
+
+	// Solve quadratic * d^2 + linear * d + constant = intensity / cutoff for d
+	float target = intensity / POINT_LIGHT_CUTOFF - light.constant;
+
+	if (target <= 0.0f)
+	{
+		return 0.0f;
+	}
+
+	if (light.quadratic > 0.0f)
+	{
+		return (-light.linear + std::sqrt(light.linear * light.linear + 4.0f * light.quadratic * target)) / (2.0f * light.quadratic);
+	}
+
+	if (light.linear > 0.0f)
+	{
+		return target / light.linear;
+	}
+
+	return FLT_MAX;
+}
+
+// Owns the uniform buffer behind the "Lights" block and the buffer texture with the point lights. Setters
+// only touch the CPU mirrors and record the changed ranges; Upload() then sends each range with a single
+// glBufferSubData, or nothing at all when no light changed since the last frame.
+class LightRig
+{
+public:
+	LightRig() : UBO(0), pointLightBuffer(0), pointLightTexture(0), pointLightCount(0), dirtyBegin(sizeof(LightBlock)), dirtyEnd(0),
+		pointDirtyBegin(MAX_POINT_LIGHTS), pointDirtyEnd(0), version(0)
+	{
+	}
+
+	// Creates the buffers and attaches the uniform one to LIGHTS_BINDING_POINT. Needs a current GL context.
+	void Init()
+	{
+		glGenBuffers(1, &this->UBO);
+		GetGLState().BindBuffer(GL_UNIFORM_BUFFER, this->UBO);
+		glBufferData(GL_UNIFORM_BUFFER, sizeof(LightBlock), &this->block, GL_DYNAMIC_DRAW);
+		GetGLState().BindBuffer(GL_UNIFORM_BUFFER, 0);
+
+		GetGLState().BindBufferBase(GL_UNIFORM_BUFFER, LIGHTS_BINDING_POINT, this->UBO);
+		this->clearDirty();
+
+		// Room for every light up front, four RGBA32F texels each
+		glGenBuffers(1, &this->pointLightBuffer);
+		glBindBuffer(GL_TEXTURE_BUFFER, this->pointLightBuffer);
+		glBufferData(GL_TEXTURE_BUFFER, sizeof(this->pointLights), this->pointLights, GL_DYNAMIC_DRAW);
+
+		glGenTextures(1, &this->pointLightTexture);
+		GetGLState().BindTextureBuffer(POINT_LIGHTS_TEXTURE_UNIT, this->pointLightTexture);
+		glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, this->pointLightBuffer);
+		this->pointDirtyBegin = MAX_POINT_LIGHTS;
+		this->pointDirtyEnd = 0;
+	}
+
+	void SetDirLight(const DirLightData &light)
+	{
+		this->write(&this->block.dirLight, &light, sizeof(light));
+	}
+
+	// Index must be below MAX_POINT_LIGHTS. Only the first GetPointLightCount() lights are binned and shaded.
+	void SetPointLight(int index, const PointLightData &light)
+	{
+		PointLightData ranged = light;
+		ranged.range = ComputePointLightRange(light);
+
+		if (memcmp(&this->pointLights[index], &ranged, sizeof(ranged)) == 0)
+		{
+			return;
+		}
+
+		this->pointLights[index] = ranged;
+		this->version++;
+
+		if (index < this->pointDirtyBegin)
+		{
+			this->pointDirtyBegin = index;
+		}
+
+		if (index + 1 > this->pointDirtyEnd)
+		{
+			this->pointDirtyEnd = index + 1;
+		}
+	}
+
+	void SetPointLightCount(int count)
+	{
+		count = glm::clamp(count, 0, MAX_POINT_LIGHTS);
+
+		if (count != this->pointLightCount)
+		{
+			this->pointLightCount = count;
+			this->version++;
+		}
+	}
+
+	// Bumped by every change to any light (or to the cluster parameters), so a cached image of the lit scene
+	// can tell whether it is still current
+	uint64_t GetVersion() const
+	{
+		return this->version;
+	}
+
+	int GetPointLightCount() const
+	{
+		return this->pointLightCount;
+	}
+
+	const PointLightData &GetPointLight(int index) const
+	{
+		return this->pointLights[index];
+	}
+
+	GLuint GetPointLightTexture() const
+	{
+		return this->pointLightTexture;
+	}
+
+	void SetClusterParams(const ClusterParams &params)
+	{
+		this->write(&this->block.clusters, &params, sizeof(params));
+	}
+
+	void SetSpotLight(const SpotLightData &light)
+	{
+		this->write(&this->block.spotLight, &light, sizeof(light));
+	}
+
+	const LightBlock &GetBlock() const
+	{
+		return this->block;
+	}
+
+	// Sends the changed ranges to the GPU
+	void Upload()
+	{
+		if (this->pointDirtyBegin < this->pointDirtyEnd)
+		{
+			glBindBuffer(GL_TEXTURE_BUFFER, this->pointLightBuffer);
+			glBufferSubData(GL_TEXTURE_BUFFER, this->pointDirtyBegin * sizeof(PointLightData), (this->pointDirtyEnd - this->pointDirtyBegin) * sizeof(PointLightData),
+				&this->pointLights[this->pointDirtyBegin]);
+			CountUpload((this->pointDirtyEnd - this->pointDirtyBegin) * sizeof(PointLightData));
+			this->pointDirtyBegin = MAX_POINT_LIGHTS;
+			this->pointDirtyEnd = 0;
+		}
+
+		if (this->dirtyBegin >= this->dirtyEnd)
+		{
+			return;
+		}
+
+		GetGLState().BindBuffer(GL_UNIFORM_BUFFER, this->UBO);
+		glBufferSubData(GL_UNIFORM_BUFFER, this->dirtyBegin, this->dirtyEnd - this->dirtyBegin, (const char *)&this->block + this->dirtyBegin);
+		CountUpload(this->dirtyEnd - this->dirtyBegin);
+		this->clearDirty();
+	}
+
+private:
+	LightBlock block;
+	GLuint UBO;
+
+	PointLightData pointLights[MAX_POINT_LIGHTS];
+	GLuint pointLightBuffer, pointLightTexture;
+	int pointLightCount;
+
+	// Byte range [dirtyBegin, dirtyEnd) of the block that differs from the GPU copy
+	size_t dirtyBegin, dirtyEnd;
+
+	// Same for the point lights, in whole lights
+	int pointDirtyBegin, pointDirtyEnd;
+
+	uint64_t version;
+
+	void write(void *destination, const void *source, size_t size)
+	{
+		if (memcmp(destination, source, size) == 0)
+		{
+			return;
+		}
+
+		memcpy(destination, source, size);
+		this->version++;
+
+		size_t begin = (const char *)destination - (const char *)&this->block;
+		size_t end = begin + size;
+
+		if (begin < this->dirtyBegin)
+		{
+			this->dirtyBegin = begin;
+		}
+
+		if (end > this->dirtyEnd)
+		{
+			this->dirtyEnd = end;
+		}
+	}
+
+	void clearDirty()
+	{
+		this->dirtyBegin = sizeof(LightBlock);
+		this->dirtyEnd = 0;
+	}
+};
@@ -0,0 +1,194 @@
+#pragma once
+
+// Std. Includes
+#include <string>
+#include <sstream>
+#include <vector>
+#include <map>
+#include <utility>
+
+// GL Includes
+#include <GL/glew.h>
+#include <assimp/scene.h>
+
+#include "Shader.h"
+#include "GLState.h"
+#include "ShaderVariants.h"
+
+using namespace std;
+
+struct Texture
+{
+	GLuint id;
+	string type;
+	aiString path;
+};
+
+// Texture units a material can use; extra textures are ignored
+const GLuint MAX_MATERIAL_TEXTURES = 8;
+
+// A mesh material compiled once at load time: texture ids per unit, the sampler name of every unit and,
+// for the last program it was used with, the sampler and shininess locations. Applying it never allocates.
+// The first specular texture is also bound to lighting.frag's material.specular, which only the
+// SHADER_SPECULAR_MAP variants sample.
+class MaterialBinding
+{
+public:
+	MaterialBinding() : id(0), sortKey(0), textureCount(0), specularUnit(-1), resolvedProgram(0), resolvedGeneration(0), shininessLocation(-1),
+		specularLocation(-1)
+	{
+	}
+
+	// Builds the record from the loaded textures. Samplers follow the texture_diffuseN / texture_specularN convention.
+	explicit MaterialBinding(const vector<Texture> &textures) : id(0), sortKey(0), textureCount(0), specularUnit(-1), resolvedProgram(0),
+		resolvedGeneration(0), shininessLocation(-1), specularLocation(-1)
+	{
+		GLuint diffuseNr = 1;
+		GLuint specularNr = 1;
+
+		for (GLuint i = 0; i < textures.size() && i < MAX_MATERIAL_TEXTURES; i++)
+		{
+			// Retrieve texture number (the N in diffuse_textureN)
+			stringstream ss;
+			const string &name = textures[i].type;
+
+			if (name == "texture_diffuse")
+			{
+				ss << diffuseNr++; // Transfer GLuint to stream
+			}
+			else if (name == "texture_specular")
+			{
+				if (specularNr == 1)
+				{
+					this->specularUnit = (GLint)i;
+				}
+
+				ss << specularNr++; // Transfer GLuint to stream
+			}
+
+			this->textureIds[i] = textures[i].id;
+			this->samplerNames[i] = name + ss.str();
+			this->samplerLocations[i] = -1;
+			this->textureCount++;
+
+			// Groups materials with similar texture sets in the render queue's sort; different sets may share it
+			this->sortKey = this->sortKey * 31 + textures[i].id;
+		}
+
+		this->id = intern(this->textureIds, this->samplerNames, this->textureCount);
+	}
+
+	// Identifies the texture set and samplers: materials with the same id can be drawn without applying or
+	// rebinding anything. 0 only for a default constructed binding.
+	GLuint GetId() const
+	{
+		return this->id;
+	}
+
+	// Hash of the texture ids, only meant for ordering. Equal keys don't mean equal materials.
+	GLuint GetSortKey() const
+	{
+		return this->sortKey;
+	}
+
+	GLuint GetTextureCount() const
+	{
+		return this->textureCount;
+	}
+
+	// Shader features this material needs on top of the lights (see ShaderVariants.h)
+	GLuint GetFeatures() const
+	{
+		return this->specularUnit >= 0 ? SHADER_SPECULAR_MAP : 0;
+	}
+
+	// Sets the sampler and shininess uniforms on the current program
+	void Apply(const Shader &shader)
+	{
+		// Locations only change with the program, resolve them once per program. The name alone isn't enough: a hot
+		// reload deletes the old program and a later link may get the same name back.
+		if (shader.Program != this->resolvedProgram || shader.GetGeneration() != this->resolvedGeneration)
+		{
+			this->resolve(shader);
+		}
+
+		for (GLuint i = 0; i < this->textureCount; i++)
+		{
+			shader.SetInt(this->samplerLocations[i], i);
+		}
+
+		shader.SetFloat(this->shininessLocation, 16.0f);
+
+		if (this->specularUnit >= 0)
+		{
+			shader.SetInt(this->specularLocation, this->specularUnit);
+		}
+	}
+
+	// Binds every texture to its unit, skipping units that already hold it. Returns the number of binds issued.
+	GLuint BindTextures() const
+	{
+		GLState &state = GetGLState();
+		GLuint binds = 0;
+
+		for (GLuint i = 0; i < this->textureCount; i++)
+		{
+			if (state.BindTexture(i, this->textureIds[i]))
+			{
+				binds++;
+			}
+		}
+
+		return binds;
+	}
+
+private:
+	GLuint id;
+	GLuint sortKey;
+	GLuint textureCount;
+	GLuint textureIds[MAX_MATERIAL_TEXTURES];
+	string samplerNames[MAX_MATERIAL_TEXTURES];
+	GLint specularUnit;	// Unit of the first specular texture, -1 without one
+
+	// Uniform locations for the program they were last resolved against
+	GLuint resolvedProgram;
+	GLuint resolvedGeneration;
+	GLint samplerLocations[MAX_MATERIAL_TEXTURES];
+	GLint shininessLocation;
+	GLint specularLocation;
+
+	// Table lookups only: the names were built at load time
+	void resolve(const Shader &shader)
+	{
+		for (GLuint i = 0; i < this->textureCount; i++)
+		{
+			this->samplerLocations[i] = shader.GetUniformLocation(this->samplerNames[i]);
+		}
+
+		this->shininessLocation = shader.GetUniformLocation("material.shininess");
+		this->specularLocation = shader.GetUniformLocation("material.specular");
+		this->resolvedProgram = shader.Program;
+		this->resolvedGeneration = shader.GetGeneration();
+	}
+
+	// Same textures under the same samplers get the same id, every other set a new one. Materials are built at
+	// load time on the GL thread only.
+	static GLuint intern(const GLuint *textureIds, const string *samplerNames, GLuint count)
+	{
+		typedef std::pair<vector<GLuint>, vector<string> > Key;
+		static std::map<Key, GLuint> ids;
+
+		Key key(vector<GLuint>(textureIds, textureIds + count), vector<string>(samplerNames, samplerNames + count));
+		std::map<Key, GLuint>::iterator found = ids.find(key);
+
+		if (found != ids.end())
+		{
+			return found->second;
+		}
+
+		GLuint id = (GLuint)ids.size() + 1;
+		ids[key] = id;
+
+		return id;
+	}
+};
\ No newline at end of file
@@ -16,24 +16,27 @@
 
 
 #include "Shader.h"
+#include "GeometryArena.h"
+#include "Material.h"
+#include "Bounds.h"
 
 using namespace std;
 
-struct Vertex
+// A texture a mesh's material asks for, before it is loaded
+struct TextureReference
 {
-	// Position
-	glm::vec3 Position;
-	// Normal
-	glm::vec3 Normal;
-	// TexCoords
-	glm::vec2 TexCoords;
+	string type;	// texture_diffuse or texture_specular
+	string path;	// As the material names it, relative to the model's directory
 };
 
-struct Texture
+// A mesh as the importer produces it, before anything touches GL (see Model::Prepare)
+struct MeshData
 {
-	GLuint id;
-	string type;
-	aiString path;
+	vector<Vertex> vertices;
+	vector<GLuint> indices;
+	vector<TextureReference> textures;
+	AABB bounds;
+	BoundingSphere sphere;
 };
 
 class Mesh
@@ -45,99 +48,121 @@ public:
 	vector<Texture> textures;
 
 	/*  Functions  */
-	// Constructor
-	Mesh(vector<Vertex> vertices, vector<GLuint> indices, vector<Texture> textures)
+	// Constructor. The bounds are in model space and are computed by whoever builds the mesh (see Model::processMesh).
+	Mesh(vector<Vertex> vertices, vector<GLuint> indices, vector<Texture> textures, const AABB &bounds, const BoundingSphere &sphere)
 	{
 		this->vertices = vertices;
 		this->indices = indices;
 		this->textures = textures;
+		this->material = MaterialBinding(textures);
+		this->bounds = bounds;
+		this->sphere = sphere;
+		this->indexCount = (GLsizei)indices.size();
 
 		// Now that we have all the required data, set the vertex buffers and its attribute pointers.
 		this->setupMesh();
 	}
 
-	// Render the mesh
-	void Draw(Shader shader)
+	// Constructor for data that is already laid out for upload (see MeshCache): the arrays go straight to the
+	// geometry arena and no CPU copy is kept, so vertices and indices stay empty.
+	Mesh(const Vertex *vertices, GLuint vertexCount, const glm::vec3 *positions, const GLuint *indices, GLuint indexCount, vector<Texture> textures,
+		const AABB &bounds, const BoundingSphere &sphere)
+	{
+		this->textures = textures;
+		this->material = MaterialBinding(textures);
+		this->bounds = bounds;
+		this->sphere = sphere;
+		this->indexCount = (GLsizei)indexCount;
+
+		GetGeometryArena().Allocate(vertices, vertexCount, positions, indices, indexCount, this->baseVertex, this->firstIndex);
+	}
+
+	// Render the mesh. Allocation free: the material was compiled at load time, and the textures and VAO
+	// only get bound when GLState says they differ (they are left bound for the next draw).
+	void Draw(Shader &shader)
 	{
-		// Bind appropriate textures
-		GLuint diffuseNr = 1;
-		GLuint specularNr = 1;
-
-		for (GLuint i = 0; i < this->textures.size(); i++)
-		{
-			glActiveTexture(GL_TEXTURE0 + i); // Active proper texture unit before binding
-											  // Retrieve texture number (the N in diffuse_textureN)
-			stringstream ss;
-			string number;
-			string name = this->textures[i].type;
-
-			if (name == "texture_diffuse")
-			{
-				ss << diffuseNr++; // Transfer GLuint to stream
-			}
-			else if (name == "texture_specular")
-			{
-				ss << specularNr++; // Transfer GLuint to stream
-			}
-
-			number = ss.str();
-			// Now set the sampler to the correct texture unit
-			glUniform1i(glGetUniformLocation(shader.Program, (name + number).c_str()), i);
-			// And finally bind the texture
-			glBindTexture(GL_TEXTURE_2D, this->textures[i].id);
-		}
-
-		// Also set each mesh's shininess property to a default value (if you want you could extend this to another mesh property and possibly change this value)
-		glUniform1f(glGetUniformLocation(shader.Program, "material.shininess"), 16.0f);
+		this->material.Apply(shader);
+		this->material.BindTextures();
 
 		// Draw mesh
-		glBindVertexArray(this->VAO);
-		glDrawElements(GL_TRIANGLES, this->indices.size(), GL_UNSIGNED_INT, 0);
-		glBindVertexArray(0);
-
-		// Always good practice to set everything back to defaults once configured.
-		for (GLuint i = 0; i < this->textures.size(); i++)
-		{
-			glActiveTexture(GL_TEXTURE0 + i);
-			glBindTexture(GL_TEXTURE_2D, 0);
-		}
+		GeometryArena &arena = GetGeometryArena();
+		GetGLState().BindVertexArray(arena.GetVAO());
+		arena.DrawElements(this->GetIndexCount(), this->firstIndex, this->baseVertex);
+	}
+
+	// Render instanceCount copies of the mesh, taking the model matrices [baseInstance, baseInstance + instanceCount)
+	// from the arena's instance stream (see GeometryArena::PushInstances)
+	void DrawInstanced(Shader &shader, GLsizei instanceCount, GLuint baseInstance)
+	{
+		this->material.Apply(shader);
+		this->material.BindTextures();
+
+		GeometryArena &arena = GetGeometryArena();
+		arena.SyncInstances();
+		GetGLState().BindVertexArray(arena.GetVAO());
+		arena.DrawElementsInstanced(this->GetIndexCount(), this->firstIndex, this->baseVertex, instanceCount, baseInstance);
+	}
+
+	MaterialBinding &GetMaterial()
+	{
+		return this->material;
+	}
+
+	const AABB &GetBounds() const
+	{
+		return this->bounds;
+	}
+
+	const BoundingSphere &GetBoundingSphere() const
+	{
+		return this->sphere;
+	}
+
+	// Every mesh lives in the shared arena, so they all report the same VAO
+	GLuint GetVAO() const
+	{
+		return GetGeometryArena().GetVAO();
+	}
+
+	GLsizei GetIndexCount() const
+	{
+		return this->indexCount;
+	}
+
+	GLuint GetFirstIndex() const
+	{
+		return this->firstIndex;
+	}
+
+	GLint GetBaseVertex() const
+	{
+		return this->baseVertex;
+	}
+
+	// Sort key of the material (a hash of its texture set, see MaterialBinding::GetSortKey)
+	GLuint GetMaterialSortKey() const
+	{
+		return this->material.GetSortKey();
 	}
 
 private:
 	/*  Render data  */
-	GLuint VAO, VBO, EBO;
+	// Location of the mesh inside the geometry arena
+	GLint baseVertex;
+	GLuint firstIndex;
+	GLsizei indexCount;
+
+	// Textures and sampler locations, compiled once at load time
+	MaterialBinding material;
+
+	// Model space bounds
+	AABB bounds;
+	BoundingSphere sphere;
 
 	/*  Functions    */
-	// Initializes all the buffer objects/arrays
+	// Copies the vertices and indices into the shared geometry arena
 	void setupMesh()
 	{
-		// Create buffers/arrays
-		glGenVertexArrays(1, &this->VAO);
-		glGenBuffers(1, &this->VBO);
-		glGenBuffers(1, &this->EBO);
-
-		glBindVertexArray(this->VAO);
-		// Load data into vertex buffers
-		glBindBuffer(GL_ARRAY_BUFFER, this->VBO);
-		// A great thing about structs is that their memory layout is sequential for all its items.
-		// The effect is that we can simply pass a pointer to the struct and it translates perfectly to a glm::vec3/2 array which
-		// again translates to 3/2 floats which translates to a byte array.
-		glBufferData(GL_ARRAY_BUFFER, this->vertices.size() * sizeof(Vertex), &this->vertices[0], GL_STATIC_DRAW);
-
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, this->EBO);
-		glBufferData(GL_ELEMENT_ARRAY_BUFFER, this->indices.size() * sizeof(GLuint), &this->indices[0], GL_STATIC_DRAW);
-
-		// Set the vertex attribute pointers
-		// Vertex Positions
-		glEnableVertexAttribArray(0);
-		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid *)0);
-		// Vertex Normals
-		glEnableVertexAttribArray(1);
-		glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid *)offsetof(Vertex, Normal));
-		// Vertex Texture Coords
-		glEnableVertexAttribArray(2);
-		glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid *)offsetof(Vertex, TexCoords));
-
-		glBindVertexArray(0);
+		GetGeometryArena().Allocate(this->vertices, this->indices, this->baseVertex, this->firstIndex);
 	}
 };
\ No newline at end of file
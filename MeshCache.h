@@ -0,0 +1,603 @@
+#pragma once
+
+// Std. Includes
+#include <string>
+#include <vector>
+#include <fstream>
+#include <iostream>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+
+// GL Includes
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include "Mesh.h"
+#include "Bounds.h"
+#include "Fnv1a.h"
+
+// Appended to the source path: Models/Rey.obj is cached in Models/Rey.obj.meshcache
+#define MESH_CACHE_EXTENSION ".meshcache"
+
+// Bumped when the file layout or the import (Assimp flags, vertex processing) changes, old files are then rebuilt
+const uint32_t MESH_CACHE_VERSION = 2;
+// Every blob starts on this boundary, so the mapping can be handed to GL as is
+const uint64_t MESH_CACHE_ALIGNMENT = 16;
+
+// Per-run counters
+struct MeshCacheStats
+{
+	GLuint hits;			// Models loaded from their cache
+	GLuint misses;			// Models imported with Assimp (no cache, stale cache or a different version)
+	double milliseconds;	// Time spent loading models either way, textures included
+};
+
+// Read-only view of a whole file through the OS page cache
+class MappedFile
+{
+public:
+	MappedFile() : data(NULL), size(0)
+#ifdef _WIN32
+		, file(INVALID_HANDLE_VALUE), mapping(NULL)
+#endif
+	{
+	}
+
+	~MappedFile()
+	{
+		this->Close();
+	}
+
+	bool Open(const std::string &path)
+	{
+		this->Close();
+
+#ifdef _WIN32
+		this->file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+
+		if (this->file == INVALID_HANDLE_VALUE)
+		{
+			return false;
+		}
+
+		LARGE_INTEGER fileSize;
+
+		if (!GetFileSizeEx(this->file, &fileSize) || fileSize.QuadPart == 0)
+		{
+			this->Close();
+			return false;
+		}
+
+		this->mapping = CreateFileMappingA(this->file, NULL, PAGE_READONLY, 0, 0, NULL);
+		this->data = this->mapping != NULL ? (const unsigned char *)MapViewOfFile(this->mapping, FILE_MAP_READ, 0, 0, 0) : NULL;
+		this->size = (uint64_t)fileSize.QuadPart;
+#else
+		int descriptor = open(path.c_str(), O_RDONLY);
+
+		if (descriptor < 0)
+		{
+			return false;
+		}
+
+		struct stat info;
+
+		if (fstat(descriptor, &info) != 0 || info.st_size == 0)
+		{
+			close(descriptor);
+			return false;
+		}
+
+		void *view = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, descriptor, 0);
+		// The mapping keeps the file alive on its own
+		close(descriptor);
+
+		this->data = view != MAP_FAILED ? (const unsigned char *)view : NULL;
+		this->size = (uint64_t)info.st_size;
+#endif
+
+		if (this->data == NULL)
+		{
+			this->Close();
+			return false;
+		}
+
+		return true;
+	}
+
+	void Close()
+	{
+#ifdef _WIN32
+		if (this->data != NULL)
+		{
+			UnmapViewOfFile(this->data);
+		}
+
+		if (this->mapping != NULL)
+		{
+			CloseHandle(this->mapping);
+		}
+
+		if (this->file != INVALID_HANDLE_VALUE)
+		{
+			CloseHandle(this->file);
+		}
+
+		this->file = INVALID_HANDLE_VALUE;
+		this->mapping = NULL;
+#else
+		if (this->data != NULL)
+		{
+			munmap((void *)this->data, (size_t)this->size);
+		}
+#endif
+
+		this->data = NULL;
+		this->size = 0;
+	}
+
+	const unsigned char *GetData() const
+	{
+		return this->data;
+	}
+
+	uint64_t GetSize() const
+	{
+		return this->size;
+	}
+
+private:
+	const unsigned char *data;
+	uint64_t size;
+#ifdef _WIN32
+	HANDLE file, mapping;
+#endif
+
+	// One mapping, one owner
+	MappedFile(const MappedFile &);
+	MappedFile &operator=(const MappedFile &);
+};
+
+// File layout, all offsets from the start of the file:
+//   MeshCacheHeader
+//   MeshCacheMesh[meshCount]
+//   MeshCacheTexture[textureCount]		material references of every mesh, in mesh order
+//   strings								texture types and paths, not terminated
+//   per mesh, each aligned to MESH_CACHE_ALIGNMENT: Vertex[vertexCount], glm::vec3 positions[vertexCount], GLuint indices[indexCount]
+struct MeshCacheHeader
+{
+	char magic[4];				// "MSHC"
+	uint32_t version;			// MESH_CACHE_VERSION
+	uint32_t vertexSize;		// sizeof(Vertex) when written, guards against a changed vertex format
+	uint32_t meshCount;
+	uint32_t textureCount;
+	float acmrBefore;			// Post-transform cache misses per triangle as imported and after MeshOptimizer
+	float acmrAfter;
+	uint32_t reserved;
+	int64_t sourceTime;			// Modification time of the source when the cache was written
+	uint64_t sourceSize;
+	uint64_t sourceHash;		// FNV-1a of the source's bytes
+	uint64_t texturesOffset;
+	uint64_t stringsOffset;
+	uint64_t fileSize;			// A cache cut short by a crash while writing never matches
+};
+
+struct MeshCacheMesh
+{
+	uint64_t verticesOffset;
+	uint64_t positionsOffset;
+	uint64_t indicesOffset;
+	uint32_t vertexCount;
+	uint32_t indexCount;
+	uint32_t firstTexture;
+	uint32_t textureCount;
+	float boundsMin[3];
+	float boundsMax[3];
+	float sphere[4];			// Center and radius
+};
+
+struct MeshCacheTexture
+{
+	uint32_t typeOffset, typeLength;	// Into the strings block
+	uint32_t pathOffset, pathLength;
+};
+
+// Binary cache of an imported model, so a warm start skips Assimp and the aiScene walk entirely. The cache
+// belongs to one source file and is trusted while the source keeps its modification time and size; when those
+// change the source is hashed, and only a different hash makes the model go through Assimp again (after a
+// checkout that touched the file the cache is just re-stamped). Only the source itself is checked: touch the
+// .obj after editing its .mtl. Open() maps the file and the blobs are uploaded straight from the mapping.
+class MeshCache
+{
+public:
+	MeshCache() : header(NULL), meshes(NULL), textures(NULL), strings(NULL)
+	{
+	}
+
+	// Maps the cache of sourcePath if it is current. Returns false when the model has to be imported.
+	bool Open(const std::string &sourcePath)
+	{
+		this->file.Close();
+
+		std::string cachePath = sourcePath + MESH_CACHE_EXTENSION;
+		MeshCacheHeader stored;
+
+		if (!readHeader(cachePath, stored) || !isCurrent(sourcePath, cachePath, stored) || !this->file.Open(cachePath))
+		{
+			return false;
+		}
+
+		// The header was checked above, what is left is making sure no table points outside the mapping
+		this->header = (const MeshCacheHeader *)this->file.GetData();
+		this->meshes = (const MeshCacheMesh *)(this->header + 1);
+		this->textures = (const MeshCacheTexture *)(this->file.GetData() + this->header->texturesOffset);
+		this->strings = (const char *)(this->file.GetData() + this->header->stringsOffset);
+
+		if (this->file.GetSize() != this->header->fileSize || !this->validate())
+		{
+			std::cout << "ERROR::MESH_CACHE::CORRUPT " << cachePath << std::endl;
+			this->file.Close();
+			return false;
+		}
+
+		return true;
+	}
+
+	GLuint GetMeshCount() const
+	{
+		return this->header->meshCount;
+	}
+
+	// ACMR of the model when it was imported, before and after MeshOptimizer
+	float GetAcmrBefore() const
+	{
+		return this->header->acmrBefore;
+	}
+
+	float GetAcmrAfter() const
+	{
+		return this->header->acmrAfter;
+	}
+
+	const MeshCacheMesh &GetMesh(GLuint index) const
+	{
+		return this->meshes[index];
+	}
+
+	const Vertex *GetVertices(const MeshCacheMesh &mesh) const
+	{
+		return (const Vertex *)(this->file.GetData() + mesh.verticesOffset);
+	}
+
+	const glm::vec3 *GetPositions(const MeshCacheMesh &mesh) const
+	{
+		return (const glm::vec3 *)(this->file.GetData() + mesh.positionsOffset);
+	}
+
+	const GLuint *GetIndices(const MeshCacheMesh &mesh) const
+	{
+		return (const GLuint *)(this->file.GetData() + mesh.indicesOffset);
+	}
+
+	std::string GetTextureType(const MeshCacheMesh &mesh, GLuint texture) const
+	{
+		const MeshCacheTexture &entry = this->textures[mesh.firstTexture + texture];
+
+		return std::string(this->strings + entry.typeOffset, entry.typeLength);
+	}
+
+	std::string GetTexturePath(const MeshCacheMesh &mesh, GLuint texture) const
+	{
+		const MeshCacheTexture &entry = this->textures[mesh.firstTexture + texture];
+
+		return std::string(this->strings + entry.pathOffset, entry.pathLength);
+	}
+
+	// Unmaps the file; everything returned above is invalid afterwards
+	void Close()
+	{
+		this->file.Close();
+	}
+
+	// Writes the cache of sourcePath from the imported meshes. Touches no GL, any thread may call it.
+	static bool Write(const std::string &sourcePath, const vector<MeshData> &meshes, float acmrBefore, float acmrAfter)
+	{
+		MeshCacheHeader header;
+		memset(&header, 0, sizeof(header));
+		memcpy(header.magic, "MSHC", 4);
+		header.version = MESH_CACHE_VERSION;
+		header.vertexSize = sizeof(Vertex);
+		header.meshCount = (uint32_t)meshes.size();
+		header.acmrBefore = acmrBefore;
+		header.acmrAfter = acmrAfter;
+
+		uint64_t hashedSize = 0;
+
+		if (!sourceInfo(sourcePath, header.sourceTime, header.sourceSize) || !Fnv1aFile(sourcePath, header.sourceHash, hashedSize))
+		{
+			return false;
+		}
+
+		// Tables first, then the blobs
+		vector<MeshCacheMesh> table(meshes.size());
+		vector<MeshCacheTexture> textureTable;
+		std::string strings;
+
+		for (GLuint i = 0; i < meshes.size(); i++)
+		{
+			const MeshData &mesh = meshes[i];
+			MeshCacheMesh &entry = table[i];
+			memset(&entry, 0, sizeof(entry));
+
+			entry.vertexCount = (uint32_t)mesh.vertices.size();
+			entry.indexCount = (uint32_t)mesh.indices.size();
+			entry.firstTexture = (uint32_t)textureTable.size();
+			entry.textureCount = (uint32_t)mesh.textures.size();
+
+			const AABB &bounds = mesh.bounds;
+			const BoundingSphere &sphere = mesh.sphere;
+
+			for (GLuint axis = 0; axis < 3; axis++)
+			{
+				entry.boundsMin[axis] = bounds.min[axis];
+				entry.boundsMax[axis] = bounds.max[axis];
+				entry.sphere[axis] = sphere.center[axis];
+			}
+
+			entry.sphere[3] = sphere.radius;
+
+			for (GLuint t = 0; t < mesh.textures.size(); t++)
+			{
+				MeshCacheTexture texture;
+				texture.typeOffset = (uint32_t)strings.size();
+				texture.typeLength = (uint32_t)mesh.textures[t].type.size();
+				strings += mesh.textures[t].type;
+
+				const std::string &path = mesh.textures[t].path;
+				texture.pathOffset = (uint32_t)strings.size();
+				texture.pathLength = (uint32_t)path.size();
+				strings += path;
+
+				textureTable.push_back(texture);
+			}
+		}
+
+		header.textureCount = (uint32_t)textureTable.size();
+		header.texturesOffset = sizeof(MeshCacheHeader) + table.size() * sizeof(MeshCacheMesh);
+		header.stringsOffset = header.texturesOffset + textureTable.size() * sizeof(MeshCacheTexture);
+
+		uint64_t offset = header.stringsOffset + strings.size();
+
+		for (GLuint i = 0; i < table.size(); i++)
+		{
+			table[i].verticesOffset = align(offset);
+			table[i].positionsOffset = align(table[i].verticesOffset + (uint64_t)table[i].vertexCount * sizeof(Vertex));
+			table[i].indicesOffset = align(table[i].positionsOffset + (uint64_t)table[i].vertexCount * sizeof(glm::vec3));
+			offset = table[i].indicesOffset + (uint64_t)table[i].indexCount * sizeof(GLuint);
+		}
+
+		header.fileSize = offset;
+
+		// Written beside the real file and renamed at the end, a reader never sees half a cache
+		std::string cachePath = sourcePath + MESH_CACHE_EXTENSION;
+		std::string temporaryPath = cachePath + ".tmp";
+		std::ofstream out(temporaryPath.c_str(), std::ios::binary | std::ios::trunc);
+
+		if (!out)
+		{
+			std::cout << "ERROR::MESH_CACHE::WRITE_FAILED " << cachePath << std::endl;
+			return false;
+		}
+
+		out.write((const char *)&header, sizeof(header));
+
+		if (!table.empty())
+		{
+			out.write((const char *)&table[0], table.size() * sizeof(MeshCacheMesh));
+		}
+
+		if (!textureTable.empty())
+		{
+			out.write((const char *)&textureTable[0], textureTable.size() * sizeof(MeshCacheTexture));
+		}
+
+		out.write(strings.data(), strings.size());
+
+		vector<glm::vec3> positions;
+
+		for (GLuint i = 0; i < table.size(); i++)
+		{
+			const MeshData &mesh = meshes[i];
+			positions.resize(mesh.vertices.size());
+
+			for (GLuint v = 0; v < mesh.vertices.size(); v++)
+			{
+				positions[v] = mesh.vertices[v].Position;
+			}
+
+			pad(out, table[i].verticesOffset);
+			out.write((const char *)mesh.vertices.data(), mesh.vertices.size() * sizeof(Vertex));
+			pad(out, table[i].positionsOffset);
+			out.write((const char *)positions.data(), positions.size() * sizeof(glm::vec3));
+			pad(out, table[i].indicesOffset);
+			out.write((const char *)mesh.indices.data(), mesh.indices.size() * sizeof(GLuint));
+		}
+
+		bool written = (bool)out;
+		out.close();
+
+		if (!written)
+		{
+			std::cout << "ERROR::MESH_CACHE::WRITE_FAILED " << cachePath << std::endl;
+			remove(temporaryPath.c_str());
+			return false;
+		}
+
+		// rename() won't replace an existing file on Windows
+		remove(cachePath.c_str());
+
+		if (rename(temporaryPath.c_str(), cachePath.c_str()) != 0)
+		{
+			std::cout << "ERROR::MESH_CACHE::WRITE_FAILED " << cachePath << std::endl;
+			remove(temporaryPath.c_str());
+			return false;
+		}
+
+		return true;
+	}
+
+private:
+	MappedFile file;
+	const MeshCacheHeader *header;
+	const MeshCacheMesh *meshes;
+	const MeshCacheTexture *textures;
+	const char *strings;
+
+	static uint64_t align(uint64_t offset)
+	{
+		return (offset + MESH_CACHE_ALIGNMENT - 1) & ~(MESH_CACHE_ALIGNMENT - 1);
+	}
+
+	static void pad(std::ofstream &out, uint64_t offset)
+	{
+		static const char zeros[MESH_CACHE_ALIGNMENT] = { 0 };
+		uint64_t position = (uint64_t)out.tellp();
+
+		if (offset > position)
+		{
+			out.write(zeros, (std::streamsize)(offset - position));
+		}
+	}
+
+	static bool readHeader(const std::string &cachePath, MeshCacheHeader &header)
+	{
+		std::ifstream in(cachePath.c_str(), std::ios::binary);
+
+		if (!in)
+		{
+			return false;
+		}
+
+		in.read((char *)&header, sizeof(header));
+
+		return in && memcmp(header.magic, "MSHC", 4) == 0 && header.version == MESH_CACHE_VERSION && header.vertexSize == sizeof(Vertex);
+	}
+
+	// Same time and size: current. Otherwise the hash decides, and a matching hash re-stamps the header.
+	static bool isCurrent(const std::string &sourcePath, const std::string &cachePath, MeshCacheHeader &header)
+	{
+		int64_t time = 0;
+		uint64_t size = 0, hash = 0;
+
+		if (!sourceInfo(sourcePath, time, size))
+		{
+			// Without a source there is nothing to import either, the cache is all there is
+			return true;
+		}
+
+		if (time == header.sourceTime && size == header.sourceSize)
+		{
+			return true;
+		}
+
+		if (size != header.sourceSize || !Fnv1aFile(sourcePath, hash, size) || hash != header.sourceHash)
+		{
+			return false;
+		}
+
+		header.sourceTime = time;
+		std::fstream patch(cachePath.c_str(), std::ios::binary | std::ios::in | std::ios::out);
+
+		if (patch)
+		{
+			patch.write((const char *)&header, sizeof(header));
+		}
+
+		return true;
+	}
+
+	// Every offset and count inside the mapping
+	bool validate() const
+	{
+		uint64_t size = this->file.GetSize();
+
+		if (sizeof(MeshCacheHeader) + (uint64_t)this->header->meshCount * sizeof(MeshCacheMesh) > this->header->texturesOffset
+			|| this->header->texturesOffset + (uint64_t)this->header->textureCount * sizeof(MeshCacheTexture) > this->header->stringsOffset
+			|| this->header->stringsOffset > size)
+		{
+			return false;
+		}
+
+		uint64_t stringsSize = size - this->header->stringsOffset;
+
+		for (GLuint i = 0; i < this->header->meshCount; i++)
+		{
+			const MeshCacheMesh &mesh = this->meshes[i];
+
+			if ((uint64_t)mesh.firstTexture + mesh.textureCount > this->header->textureCount
+				|| mesh.verticesOffset + (uint64_t)mesh.vertexCount * sizeof(Vertex) > size
+				|| mesh.positionsOffset + (uint64_t)mesh.vertexCount * sizeof(glm::vec3) > size
+				|| mesh.indicesOffset + (uint64_t)mesh.indexCount * sizeof(GLuint) > size
+				|| (mesh.verticesOffset | mesh.positionsOffset | mesh.indicesOffset) % MESH_CACHE_ALIGNMENT != 0)
+			{
+				return false;
+			}
+		}
+
+		for (GLuint i = 0; i < this->header->textureCount; i++)
+		{
+			const MeshCacheTexture &texture = this->textures[i];
+
+			if ((uint64_t)texture.typeOffset + texture.typeLength > stringsSize || (uint64_t)texture.pathOffset + texture.pathLength > stringsSize)
+			{
+				return false;
+			}
+		}
+
+		return true;
+	}
+
+	static bool sourceInfo(const std::string &path, int64_t &time, uint64_t &size)
+	{
+#ifdef _WIN32
+		struct _stat64 info;
+
+		if (_stat64(path.c_str(), &info) != 0)
+		{
+			return false;
+		}
+#else
+		struct stat info;
+
+		if (stat(path.c_str(), &info) != 0)
+		{
+			return false;
+		}
+#endif
+
+		time = (int64_t)info.st_mtime;
+		size = (uint64_t)info.st_size;
+
+		return true;
+	}
+};
+
+inline MeshCacheStats &GetMeshCacheStats()
+{
+	static MeshCacheStats stats = { 0, 0, 0.0 };
+
+	return stats;
+}
\ No newline at end of file
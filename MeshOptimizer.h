@@ -0,0 +1,397 @@
+#pragma once
+
+// Std. Includes
+#include <vector>
+#include <algorithm>
+#include <unordered_map>
+#include <cstring>
+
+// GL Includes
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include "Mesh.h"
+
+// Entries of the simulated post-transform cache. A FIFO of 16 is about what the hardware of the last decade
+// behaves like, and tipsify's own cache size is the same number.
+const GLuint MESH_OPTIMIZER_CACHE_SIZE = 16;
+// The overdraw order is kept only while it costs less than this much ACMR over the cache-optimized order
+const float MESH_OPTIMIZER_OVERDRAW_THRESHOLD = 1.05f;
+
+// Reorders a freshly imported mesh so the GPU does less work per draw, without changing what is drawn:
+//   1. Weld: vertices identical to the last bit become one, so the post-transform cache can reuse them at all
+//      (the OBJ importer emits one vertex per face corner).
+//   2. Vertex cache: triangles reordered with tipsify (Sander, Nehab and Barczak, "Fast Triangle Reordering for
+//      Vertex Locality and Reduced Overdraw", 2007), fanning around the vertex most likely to still be cached.
+//   3. Overdraw: the clusters tipsify leaves between cache flushes are sorted so the ones facing away from the
+//      mesh's center, which tend to occlude the rest from any viewpoint, come first.
+//   4. Vertex fetch: vertices renumbered in the order the triangles first use them.
+// ACMR (average cache miss ratio) is transformed vertices per triangle, simulated with a FIFO of
+// MESH_OPTIMIZER_CACHE_SIZE; 3 is no reuse at all and a regular grid tends to 0.5. Runs at import time only,
+// the mesh cache stores the result.
+class MeshOptimizer
+{
+public:
+	// All the stages on every mesh of a model. acmrBefore/acmrAfter are for the whole model, as imported and as optimized.
+	static void Optimize(vector<MeshData> &meshes, float &acmrBefore, float &acmrAfter)
+	{
+		GLuint triangles = 0, missesBefore = 0, missesAfter = 0;
+
+		for (GLuint i = 0; i < meshes.size(); i++)
+		{
+			GLuint before = 0, after = 0;
+			Optimize(meshes[i], before, after);
+
+			triangles += (GLuint)meshes[i].indices.size() / 3;
+			missesBefore += before;
+			missesAfter += after;
+		}
+
+		acmrBefore = triangles > 0 ? (float)missesBefore / triangles : 0.0f;
+		acmrAfter = triangles > 0 ? (float)missesAfter / triangles : 0.0f;
+	}
+
+	// missesBefore/missesAfter: vertices the simulated cache had to transform
+	static void Optimize(MeshData &mesh, GLuint &missesBefore, GLuint &missesAfter)
+	{
+		missesBefore = SimulateCache(mesh.indices, (GLuint)mesh.vertices.size());
+
+		// Only triangle lists; a mesh with lines or points left by the importer is kept as it is
+		if (mesh.indices.size() % 3 == 0 && !mesh.indices.empty())
+		{
+			Weld(mesh.vertices, mesh.indices);
+
+			vector<GLuint> clusters;
+			OptimizeVertexCache(mesh.indices, (GLuint)mesh.vertices.size(), clusters);
+			OptimizeOverdraw(mesh.vertices, mesh.indices, clusters);
+			OptimizeVertexFetch(mesh.vertices, mesh.indices);
+		}
+
+		missesAfter = SimulateCache(mesh.indices, (GLuint)mesh.vertices.size());
+	}
+
+	// Vertices a FIFO post-transform cache would transform to draw the indices
+	static GLuint SimulateCache(const vector<GLuint> &indices, GLuint vertexCount)
+	{
+		// A vertex is cached while fewer than MESH_OPTIMIZER_CACHE_SIZE misses happened since it was loaded
+		vector<GLuint> loadedAt(vertexCount, 0);
+		GLuint time = MESH_OPTIMIZER_CACHE_SIZE + 1, misses = 0;
+
+		for (GLuint i = 0; i < indices.size(); i++)
+		{
+			GLuint v = indices[i];
+
+			if (time - loadedAt[v] > MESH_OPTIMIZER_CACHE_SIZE)
+			{
+				loadedAt[v] = time++;
+				misses++;
+			}
+		}
+
+		return misses;
+	}
+
+	// Merges bitwise identical vertices. Returns how many were removed.
+	static GLuint Weld(vector<Vertex> &vertices, vector<GLuint> &indices)
+	{
+		std::unordered_map<Vertex, GLuint, VertexHash, VertexEqual> unique;
+		unique.reserve(vertices.size());
+
+		vector<Vertex> welded;
+		welded.reserve(vertices.size());
+		vector<GLuint> remap(vertices.size());
+
+		for (GLuint i = 0; i < vertices.size(); i++)
+		{
+			std::pair<std::unordered_map<Vertex, GLuint, VertexHash, VertexEqual>::iterator, bool> inserted = unique.insert(std::make_pair(vertices[i], (GLuint)welded.size()));
+
+			if (inserted.second)
+			{
+				welded.push_back(vertices[i]);
+			}
+
+			remap[i] = inserted.first->second;
+		}
+
+		for (GLuint i = 0; i < indices.size(); i++)
+		{
+			indices[i] = remap[indices[i]];
+		}
+
+		GLuint removed = (GLuint)(vertices.size() - welded.size());
+		vertices.swap(welded);
+
+		return removed;
+	}
+
+	// Tipsify. clusters receives the first triangle of every cluster: a new one starts wherever the walk had to jump
+	// to a vertex that is no longer in the cache, so clusters can be drawn in any order at little cost in ACMR.
+	static void OptimizeVertexCache(vector<GLuint> &indices, GLuint vertexCount, vector<GLuint> &clusters)
+	{
+		const GLuint triangleCount = (GLuint)indices.size() / 3;
+
+		// Triangles around each vertex, as offsets into one array
+		vector<GLuint> live(vertexCount, 0), firstAdjacent(vertexCount + 1, 0), adjacent(indices.size());
+
+		for (GLuint i = 0; i < indices.size(); i++)
+		{
+			live[indices[i]]++;
+		}
+
+		for (GLuint v = 0; v < vertexCount; v++)
+		{
+			firstAdjacent[v + 1] = firstAdjacent[v] + live[v];
+		}
+
+		vector<GLuint> filled(firstAdjacent.begin(), firstAdjacent.end() - 1);
+
+		for (GLuint i = 0; i < indices.size(); i++)
+		{
+			adjacent[filled[indices[i]]++] = i / 3;
+		}
+
+		vector<GLuint> cachedAt(vertexCount, 0);
+		vector<bool> emitted(triangleCount, false);
+		vector<GLuint> deadEnd, candidates, result;
+		result.reserve(indices.size());
+		clusters.clear();
+
+		GLuint time = MESH_OPTIMIZER_CACHE_SIZE + 1, scan = 0;
+		GLint fanning = 0;
+
+		while (fanning >= 0)
+		{
+			candidates.clear();
+
+			for (GLuint a = firstAdjacent[fanning]; a < firstAdjacent[fanning + 1]; a++)
+			{
+				GLuint triangle = adjacent[a];
+
+				if (emitted[triangle])
+				{
+					continue;
+				}
+
+				for (GLuint corner = 0; corner < 3; corner++)
+				{
+					GLuint v = indices[triangle * 3 + corner];
+					result.push_back(v);
+					deadEnd.push_back(v);
+					candidates.push_back(v);
+					live[v]--;
+
+					if (time - cachedAt[v] > MESH_OPTIMIZER_CACHE_SIZE)
+					{
+						cachedAt[v] = time++;
+					}
+				}
+
+				emitted[triangle] = true;
+			}
+
+			// Next fan: the candidate that stays in the cache longest while its remaining triangles are emitted
+			GLint next = -1, best = -1;
+
+			for (GLuint c = 0; c < candidates.size(); c++)
+			{
+				GLuint v = candidates[c];
+
+				if (live[v] == 0)
+				{
+					continue;
+				}
+
+				GLint priority = 0;
+				GLuint age = time - cachedAt[v];
+
+				if (age + 2 * live[v] <= MESH_OPTIMIZER_CACHE_SIZE)
+				{
+					priority = (GLint)age;
+				}
+
+				if (priority > best)
+				{
+					best = priority;
+					next = (GLint)v;
+				}
+			}
+
+			if (next < 0)
+			{
+				next = skipDeadEnd(deadEnd, live, scan);
+
+				if (next >= 0 && time - cachedAt[next] > MESH_OPTIMIZER_CACHE_SIZE)
+				{
+					clusters.push_back((GLuint)result.size() / 3);
+				}
+			}
+
+			fanning = next;
+		}
+
+		if (clusters.empty() || clusters[0] != 0)
+		{
+			clusters.insert(clusters.begin(), 0);
+		}
+
+		indices.swap(result);
+	}
+
+	// Sorts the clusters from tipsify by how much they face away from the mesh's center, outermost first. Kept
+	// only while the ACMR stays within MESH_OPTIMIZER_OVERDRAW_THRESHOLD of the order it was given.
+	static void OptimizeOverdraw(const vector<Vertex> &vertices, vector<GLuint> &indices, const vector<GLuint> &clusters)
+	{
+		const GLuint triangleCount = (GLuint)indices.size() / 3;
+
+		if (clusters.size() < 2)
+		{
+			return;
+		}
+
+		vector<glm::vec3> centroids(clusters.size(), glm::vec3(0.0f)), normals(clusters.size(), glm::vec3(0.0f));
+		vector<float> areas(clusters.size(), 0.0f);
+		glm::vec3 center(0.0f);
+		float totalArea = 0.0f;
+
+		for (GLuint c = 0; c < clusters.size(); c++)
+		{
+			GLuint end = c + 1 < clusters.size() ? clusters[c + 1] : triangleCount;
+
+			for (GLuint t = clusters[c]; t < end; t++)
+			{
+				const glm::vec3 &p0 = vertices[indices[t * 3]].Position;
+				const glm::vec3 &p1 = vertices[indices[t * 3 + 1]].Position;
+				const glm::vec3 &p2 = vertices[indices[t * 3 + 2]].Position;
+
+				// Twice the area, and its direction
+				glm::vec3 normal = glm::cross(p1 - p0, p2 - p0);
+				float area = glm::length(normal);
+
+				centroids[c] += (p0 + p1 + p2) * (area / 3.0f);
+				normals[c] += normal;
+				areas[c] += area;
+			}
+
+			center += centroids[c];
+			totalArea += areas[c];
+
+			if (areas[c] > 0.0f)
+			{
+				centroids[c] = centroids[c] / areas[c];
+			}
+		}
+
+		if (totalArea <= 0.0f)
+		{
+			return;
+		}
+
+		center = center / totalArea;
+
+		vector<float> keys(clusters.size());
+		vector<GLuint> order(clusters.size());
+
+		for (GLuint c = 0; c < clusters.size(); c++)
+		{
+			float length = glm::length(normals[c]);
+			keys[c] = length > 0.0f ? glm::dot(centroids[c] - center, normals[c] / length) : 0.0f;
+			order[c] = c;
+		}
+
+		std::stable_sort(order.begin(), order.end(), [&keys](GLuint a, GLuint b) { return keys[a] > keys[b]; });
+
+		vector<GLuint> sorted;
+		sorted.reserve(indices.size());
+
+		for (GLuint i = 0; i < order.size(); i++)
+		{
+			GLuint c = order[i];
+			GLuint end = c + 1 < clusters.size() ? clusters[c + 1] : triangleCount;
+			sorted.insert(sorted.end(), indices.begin() + clusters[c] * 3, indices.begin() + end * 3);
+		}
+
+		GLuint vertexCount = (GLuint)vertices.size();
+
+		if (SimulateCache(sorted, vertexCount) <= SimulateCache(indices, vertexCount) * MESH_OPTIMIZER_OVERDRAW_THRESHOLD)
+		{
+			indices.swap(sorted);
+		}
+	}
+
+	// Renumbers the vertices in order of first use and drops the ones no triangle uses
+	static void OptimizeVertexFetch(vector<Vertex> &vertices, vector<GLuint> &indices)
+	{
+		const GLuint unused = 0xFFFFFFFFu;
+		vector<GLuint> remap(vertices.size(), unused);
+		vector<Vertex> ordered;
+		ordered.reserve(vertices.size());
+
+		for (GLuint i = 0; i < indices.size(); i++)
+		{
+			GLuint &target = remap[indices[i]];
+
+			if (target == unused)
+			{
+				target = (GLuint)ordered.size();
+				ordered.push_back(vertices[indices[i]]);
+			}
+
+			indices[i] = target;
+		}
+
+		vertices.swap(ordered);
+	}
+
+private:
+	struct VertexHash
+	{
+		size_t operator()(const Vertex &vertex) const
+		{
+			const unsigned char *bytes = (const unsigned char *)&vertex;
+			size_t hash = 2166136261u;
+
+			for (size_t i = 0; i < sizeof(Vertex); i++)
+			{
+				hash ^= bytes[i];
+				hash *= 16777619u;
+			}
+
+			return hash;
+		}
+	};
+
+	struct VertexEqual
+	{
+		bool operator()(const Vertex &a, const Vertex &b) const
+		{
+			return memcmp(&a, &b, sizeof(Vertex)) == 0;
+		}
+	};
+
+	// Most recent vertex of the dead-end stack that still has triangles, else the next one in index order
+	static GLint skipDeadEnd(vector<GLuint> &deadEnd, const vector<GLuint> &live, GLuint &scan)
+	{
+		while (!deadEnd.empty())
+		{
+			GLuint v = deadEnd.back();
+			deadEnd.pop_back();
+
+			if (live[v] > 0)
+			{
+				return (GLint)v;
+			}
+		}
+
+		while (scan < live.size())
+		{
+			if (live[scan] > 0)
+			{
+				return (GLint)scan;
+			}
+
+			scan++;
+		}
+
+		return -1;
+	}
+};
\ No newline at end of file
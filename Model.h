@@ -6,6 +6,7 @@
 #include <iostream>
 #include <map>
 #include <vector>
+#include <chrono>
 
 #include <GL/glew.h>
 #include <glm/glm.hpp>
@@ -16,11 +17,42 @@
 #include <assimp/postprocess.h>
 
 #include "Mesh.h"
+#include "MeshCache.h"
+#include "MeshOptimizer.h"
+#include "TextureStreamer.h"
+#include "TextureCache.h"
 #include  "Shader.h"
+#include "RenderStats.h"
 
 using namespace std;
 
 GLint TextureFromFile(const char *path, string directory);
+GLuint LoadTextureFile(const string &filename);
+
+// CPU half of a model: its meshes, mapped from the mesh cache or imported with Assimp. Model::Prepare() fills it
+// without touching GL, so it can run on any thread; Model(ModelData &) then does the GL half on the thread that
+// owns the context. Textures aren't part of it, the TextureStreamer decodes them on its own.
+class ModelData
+{
+public:
+	string path, directory;
+	bool loaded;				// False when Assimp couldn't read the file
+	bool fromCache;
+	MeshCache cache;			// Mapped when fromCache
+	vector<MeshData> meshes;	// Filled when imported
+	float acmrBefore;			// Post-transform cache misses per triangle as imported and as optimized (see MeshOptimizer)
+	float acmrAfter;
+	double milliseconds;		// Time spent in Prepare
+
+	ModelData() : loaded(false), fromCache(false), acmrBefore(0.0f), acmrAfter(0.0f), milliseconds(0.0)
+	{
+	}
+
+private:
+	// Owns the mapping
+	ModelData(const ModelData &);
+	ModelData &operator=(const ModelData &);
+};
 
 class Model
 {
@@ -29,11 +61,62 @@ public:
 	// Constructor, expects a filepath to a 3D model.
 	Model(GLchar *path)
 	{
-		this->loadModel(path);
+		ModelData data;
+		Prepare(path, data);
+		this->upload(data);
+	}
+
+	// Creates the model from a prepared ModelData (see ModelLoader). Needs the GL context.
+	explicit Model(ModelData &data)
+	{
+		this->upload(data);
+	}
+
+	// CPU half of loading a model: reads the mesh cache or imports the file with Assimp, optimizes the meshes and
+	// writes the cache for the next run. Touches no GL, any thread may call it.
+	static void Prepare(const string &path, ModelData &data)
+	{
+		std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+
+		data.path = path;
+		// Retrieve the directory path of the filepath
+		data.directory = path.substr(0, path.find_last_of('/'));
+
+		// A current binary cache skips Assimp entirely, otherwise import and write one for the next run
+		if (data.cache.Open(path))
+		{
+			data.fromCache = true;
+			data.acmrBefore = data.cache.GetAcmrBefore();
+			data.acmrAfter = data.cache.GetAcmrAfter();
+		}
+		else
+		{
+			// Read file via ASSIMP
+			Assimp::Importer importer;
+			const aiScene *scene = importer.ReadFile(path, aiProcess_Triangulate | aiProcess_FlipUVs);
+
+			// Check for errors
+			if (!scene || scene->mFlags == AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode) // if is Not Zero
+			{
+				cout << "ERROR::ASSIMP:: " << importer.GetErrorString() << endl;
+				return;
+			}
+
+			// Process ASSIMP's root node recursively
+			processNode(scene->mRootNode, scene, data.meshes);
+
+			// Welded and reordered for the vertex cache, overdraw and vertex fetch; the cache keeps the result
+			MeshOptimizer::Optimize(data.meshes, data.acmrBefore, data.acmrAfter);
+
+			MeshCache::Write(path, data.meshes, data.acmrBefore, data.acmrAfter);
+		}
+
+		data.loaded = true;
+		data.milliseconds = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
 	}
 
 	// Draws the model, and thus all its meshes
-	void Draw(Shader shader)
+	void Draw(Shader &shader)
 	{
 		for (GLuint i = 0; i < this->meshes.size(); i++)
 		{
@@ -41,35 +124,134 @@ public:
 		}
 	}
 
+	// Draws count copies of the model in one instanced call per mesh; transforms[i] is the model matrix of copy i.
+	// The matrices go to the geometry arena's instance stream, which is reset every frame.
+	void DrawInstanced(Shader &shader, const glm::mat4 *transforms, GLsizei count)
+	{
+		if (count <= 0)
+		{
+			return;
+		}
+
+		GLuint baseInstance = GetGeometryArena().PushInstances(transforms, count);
+
+		for (GLuint i = 0; i < this->meshes.size(); i++)
+		{
+			this->meshes[i].DrawInstanced(shader, count, baseInstance);
+		}
+	}
+
+	void DrawInstanced(Shader &shader, const vector<glm::mat4> &transforms)
+	{
+		this->DrawInstanced(shader, transforms.data(), (GLsizei)transforms.size());
+	}
+
+	vector<Mesh> &GetMeshes()
+	{
+		return this->meshes;
+	}
+
+	// Model space bounds of all the meshes
+	const AABB &GetBounds() const
+	{
+		return this->bounds;
+	}
+
+	const BoundingSphere &GetBoundingSphere() const
+	{
+		return this->sphere;
+	}
+
 private:
 	/*  Model Data  */
 	vector<Mesh> meshes;
 	string directory;
-	vector<Texture> textures_loaded;	// Stores all the textures loaded so far, optimization to make sure textures aren't loaded more than once.
+	vector<TextureHandle> textures_loaded;	// One reference per texture the meshes use, so the shared cache keeps them alive as long as the model.
+	AABB bounds;
+	BoundingSphere sphere;
 
 										/*  Functions   */
-										// Loads a model with supported ASSIMP extensions from file and stores the resulting meshes in the meshes vector.
-	void loadModel(string path)
+										// GL half of loading: creates the meshes from the prepared data and requests their textures.
+	void upload(ModelData &data)
 	{
-		// Read file via ASSIMP
-		Assimp::Importer importer;
-		const aiScene *scene = importer.ReadFile(path, aiProcess_Triangulate | aiProcess_FlipUVs);
+		std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+
+		this->directory = data.directory;
 
-		// Check for errors
-		if (!scene || scene->mFlags == AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode) // if is Not Zero
+		if (!data.loaded)
 		{
-			cout << "ERROR::ASSIMP:: " << importer.GetErrorString() << endl;
 			return;
 		}
-		// Retrieve the directory path of the filepath
-		this->directory = path.substr(0, path.find_last_of('/'));
 
-		// Process ASSIMP's root node recursively
-		this->processNode(scene->mRootNode, scene);
+		if (data.fromCache)
+		{
+			this->loadFromCache(data);
+			data.cache.Close();
+			GetMeshCacheStats().hits++;
+		}
+		else
+		{
+			this->meshes.reserve(data.meshes.size());
+
+			for (GLuint i = 0; i < data.meshes.size(); i++)
+			{
+				const MeshData &mesh = data.meshes[i];
+				vector<Texture> textures;
+
+				for (GLuint t = 0; t < mesh.textures.size(); t++)
+				{
+					textures.push_back(this->loadTexture(mesh.textures[t].path, mesh.textures[t].type));
+				}
+
+				this->meshes.push_back(Mesh(mesh.vertices, mesh.indices, textures, mesh.bounds, mesh.sphere));
+			}
+
+			GetMeshCacheStats().misses++;
+		}
+
+		GetMeshCacheStats().milliseconds += data.milliseconds + std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+
+		// The model sphere is centered on the model box and encloses every mesh sphere
+		for (GLuint i = 0; i < this->meshes.size(); i++)
+		{
+			this->bounds.Expand(this->meshes[i].GetBounds());
+		}
+
+		this->sphere = BoundingSphere(this->bounds.GetCenter(), 0.0f);
+
+		for (GLuint i = 0; i < this->meshes.size(); i++)
+		{
+			const BoundingSphere &meshSphere = this->meshes[i].GetBoundingSphere();
+			this->sphere.radius = glm::max(this->sphere.radius, glm::length(meshSphere.center - this->sphere.center) + meshSphere.radius);
+		}
+	}
+
+	// Builds the meshes from a mapped cache: the blobs are uploaded from the mapping, only the textures are loaded
+	void loadFromCache(ModelData &data)
+	{
+		const MeshCache &cache = data.cache;
+		this->meshes.reserve(cache.GetMeshCount());
+
+		for (GLuint i = 0; i < cache.GetMeshCount(); i++)
+		{
+			const MeshCacheMesh &entry = cache.GetMesh(i);
+			vector<Texture> textures;
+
+			for (GLuint t = 0; t < entry.textureCount; t++)
+			{
+				textures.push_back(this->loadTexture(cache.GetTexturePath(entry, t), cache.GetTextureType(entry, t)));
+			}
+
+			AABB bounds(glm::vec3(entry.boundsMin[0], entry.boundsMin[1], entry.boundsMin[2]), glm::vec3(entry.boundsMax[0], entry.boundsMax[1], entry.boundsMax[2]));
+			BoundingSphere sphere(glm::vec3(entry.sphere[0], entry.sphere[1], entry.sphere[2]), entry.sphere[3]);
+
+			this->meshes.push_back(Mesh(cache.GetVertices(entry), entry.vertexCount, cache.GetPositions(entry), cache.GetIndices(entry), entry.indexCount,
+				textures, bounds, sphere));
+		}
 	}
 
 	// Processes a node in a recursive fashion. Processes each individual mesh located at the node and repeats this process on its children nodes (if any).
-	void processNode(aiNode* node, const aiScene* scene)
+	static void processNode(aiNode* node, const aiScene* scene, vector<MeshData> &meshes)
 	{
 		// Process each mesh located at the current node
 		for (GLuint i = 0; i < node->mNumMeshes; i++)
@@ -78,22 +260,24 @@ private:
 			// The scene contains all the data, node is just to keep stuff organized (like relations between nodes).
 			aiMesh* mesh = scene->mMeshes[node->mMeshes[i]];
 
-			this->meshes.push_back(this->processMesh(mesh, scene));
+			meshes.push_back(processMesh(mesh, scene));
 		}
 
 		// After we've processed all of the meshes (if any) we then recursively process each of the children nodes
 		for (GLuint i = 0; i < node->mNumChildren; i++)
 		{
-			this->processNode(node->mChildren[i], scene);
+			processNode(node->mChildren[i], scene, meshes);
 		}
 	}
 
-	Mesh processMesh(aiMesh *mesh, const aiScene *scene)
+	static MeshData processMesh(aiMesh *mesh, const aiScene *scene)
 	{
 		// Data to fill
-		vector<Vertex> vertices;
-		vector<GLuint> indices;
-		vector<Texture> textures;
+		MeshData data;
+		vector<Vertex> &vertices = data.vertices;
+		vector<GLuint> &indices = data.indices;
+		vector<TextureReference> &textures = data.textures;
+		AABB &bounds = data.bounds;
 
 		// Walk through each of the mesh's vertices
 		for (GLuint i = 0; i < mesh->mNumVertices; i++)
@@ -106,6 +290,7 @@ private:
 			vector.y = mesh->mVertices[i].y;
 			vector.z = mesh->mVertices[i].z;
 			vertex.Position = vector;
+			bounds.Expand(vector);
 
 			// Normals
 			vector.x = mesh->mNormals[i].x;
@@ -131,6 +316,15 @@ private:
 			vertices.push_back(vertex);
 		}
 
+		// Bounding sphere around the box center, with the radius of the farthest vertex (tighter than the box's corner)
+		BoundingSphere &sphere = data.sphere;
+		sphere = BoundingSphere(bounds.IsEmpty() ? glm::vec3(0.0f) : bounds.GetCenter(), 0.0f);
+
+		for (GLuint i = 0; i < vertices.size(); i++)
+		{
+			sphere.radius = glm::max(sphere.radius, glm::length(vertices[i].Position - sphere.center));
+		}
+
 		// Now wak through each of the mesh's faces (a face is a mesh its triangle) and retrieve the corresponding vertex indices.
 		for (GLuint i = 0; i < mesh->mNumFaces; i++)
 		{
@@ -154,64 +348,73 @@ private:
 			// Normal: texture_normalN
 
 			// 1. Diffuse maps
-			vector<Texture> diffuseMaps = this->loadMaterialTextures(material, aiTextureType_DIFFUSE, "texture_diffuse");
+			vector<TextureReference> diffuseMaps = loadMaterialTextures(material, aiTextureType_DIFFUSE, "texture_diffuse");
 			textures.insert(textures.end(), diffuseMaps.begin(), diffuseMaps.end());
 
 			// 2. Specular maps
-			vector<Texture> specularMaps = this->loadMaterialTextures(material, aiTextureType_SPECULAR, "texture_specular");
+			vector<TextureReference> specularMaps = loadMaterialTextures(material, aiTextureType_SPECULAR, "texture_specular");
 			textures.insert(textures.end(), specularMaps.begin(), specularMaps.end());
 		}
 
-		// Return a mesh object created from the extracted mesh data
-		return Mesh(vertices, indices, textures);
+		// The mesh object is created from the extracted data later, on the GL thread
+		return data;
 	}
 
-	// Checks all material textures of a given type and loads the textures if they're not loaded yet.
-	// The required info is returned as a Texture struct.
-	vector<Texture> loadMaterialTextures(aiMaterial *mat, aiTextureType type, string typeName)
+	// Collects all material textures of a given type. They are loaded later, see loadTexture.
+	static vector<TextureReference> loadMaterialTextures(aiMaterial *mat, aiTextureType type, string typeName)
 	{
-		vector<Texture> textures;
+		vector<TextureReference> textures;
 
 		for (GLuint i = 0; i < mat->GetTextureCount(type); i++)
 		{
 			aiString str;
 			mat->GetTexture(type, i, &str);
 
-			// Check if texture was loaded before and if so, continue to next iteration: skip loading a new texture
-			GLboolean skip = false;
+			TextureReference texture;
+			texture.type = typeName;
+			texture.path = str.C_Str();
+			textures.push_back(texture);
+		}
 
-			for (GLuint j = 0; j < textures_loaded.size(); j++)
-			{
-				if (textures_loaded[j].path == str)
-				{
-					textures.push_back(textures_loaded[j]);
-					skip = true; // A texture with the same filepath has already been loaded, continue to next one. (optimization)
+		return textures;
+	}
 
-					break;
-				}
-			}
+	// Texture of the model's directory. Any model that already loaded the same file (same path or same bytes) shares
+	// its texture through the cache; otherwise it streams in the background and shows a placeholder until then.
+	Texture loadTexture(const string &path, const string &typeName)
+	{
+		aiString str;
+		str.Set(path);
 
-			if (!skip)
-			{   // If texture hasn't been loaded already, load it
-				Texture texture;
-				texture.id = TextureFromFile(str.C_Str(), this->directory);
-				texture.type = typeName;
-				texture.path = str;
-				textures.push_back(texture);
+		Texture texture;
+		texture.id = GetTextureCache().Acquire(this->directory + '/' + path, requestTexture);
+		texture.type = typeName;
+		texture.path = str;
 
-				this->textures_loaded.push_back(texture);  // Store it as texture loaded for entire model, to ensure we won't unnecesery load duplicate textures.
-			}
-		}
+		this->textures_loaded.push_back(TextureHandle(texture.id));
 
-		return textures;
+		return texture;
+	}
+
+	static GLuint requestTexture(const string &path)
+	{
+		return GetTextureStreamer().Request(path);
 	}
 };
 
+// Goes through the texture cache: the caller gets a reference of its own, to give back with GetTextureCache().Release()
 GLint TextureFromFile(const char *path, string directory)
 {
-	//Generate texture ID and load texture data
 	string filename = string(path);
 	filename = directory + '/' + filename;
+
+	return GetTextureCache().Acquire(filename, LoadTextureFile);
+}
+
+// Synchronous load on a cache miss
+GLuint LoadTextureFile(const string &filename)
+{
+	//Generate texture ID and load texture data
 	GLuint textureID;
 	glGenTextures(1, &textureID);
 
@@ -220,8 +423,9 @@ GLint TextureFromFile(const char *path, string directory)
 	unsigned char *image = SOIL_load_image(filename.c_str(), &width, &height, 0, SOIL_LOAD_RGB);
 
 	// Assign texture to ID
-	glBindTexture(GL_TEXTURE_2D, textureID);
+	GetGLState().BindTexture(0, textureID);
 	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, image);
+	CountUpload((size_t)width * height * 3);
 	glGenerateMipmap(GL_TEXTURE_2D);
 
 	// Parameters
@@ -229,7 +433,7 @@ GLint TextureFromFile(const char *path, string directory)
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	glBindTexture(GL_TEXTURE_2D, 0);
+	GetGLState().BindTexture(0, 0);
 	SOIL_free_image_data(image);
 
 	return textureID;
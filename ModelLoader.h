@@ -0,0 +1,60 @@
+#pragma once
+
+// Std. Includes
+#include <string>
+#include <vector>
+#include <future>
+#include <memory>
+#include <iostream>
+
+// GL Includes
+#include <GL/glew.h>
+
+#include "Model.h"
+#include "ThreadPool.h"
+
+// Loads a list of models with the CPU half of every one (mesh cache or Assimp, see Model::Prepare) running on the
+// thread pool, while the calling thread uploads each model as soon as its turn comes. Models are uploaded in the
+// order given, so the geometry arena ends up with the same layout on every run no matter which worker finishes
+// first; uploading model i overlaps with the workers still preparing the rest.
+// Each model's ACMR before and after MeshOptimizer is printed as it comes in.
+class ModelLoader
+{
+public:
+	// Call from the thread that owns the GL context. The result holds the models in the order of paths.
+	static vector<Model> Load(const vector<string> &paths)
+	{
+		ThreadPool &pool = GetThreadPool();
+		vector<std::unique_ptr<ModelData> > prepared;
+		vector<std::future<void> > pending;
+
+		for (GLuint i = 0; i < paths.size(); i++)
+		{
+			ModelData *data = new ModelData();
+			prepared.push_back(std::unique_ptr<ModelData>(data));
+
+			string path = paths[i];
+			pending.push_back(pool.Submit([path, data]() { Model::Prepare(path, *data); }));
+		}
+
+		vector<Model> models;
+		models.reserve(paths.size());
+
+		for (GLuint i = 0; i < paths.size(); i++)
+		{
+			pending[i].get();
+			models.push_back(Model(*prepared[i]));
+
+			if (prepared[i]->loaded)
+			{
+				std::cout << "Model " << paths[i] << ": ACMR " << prepared[i]->acmrBefore << " -> " << prepared[i]->acmrAfter
+					<< (prepared[i]->fromCache ? " (cached)" : "") << std::endl;
+			}
+
+			// Unmaps the cache right away
+			prepared[i].reset();
+		}
+
+		return models;
+	}
+};
\ No newline at end of file
@@ -0,0 +1,334 @@
+#pragma once
+
+// Std. Includes
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+
+// GL Includes
+#include <GL/glew.h>
+
+// Set to 0 to compile every marker down to nothing
+#ifndef PROFILER_ENABLED
+#define PROFILER_ENABLED 1
+#endif
+
+// Finished scopes kept for the trace (power of two); older ones are overwritten
+const GLuint PROFILER_RING_SIZE = 1 << 16;
+// Frames of GPU queries in flight; results are read PROFILER_GPU_FRAMES - 1 frames late so the CPU never waits
+const GLuint PROFILER_GPU_FRAMES = 3;
+// GPU scopes recorded per frame, the rest only get CPU times
+const GLuint PROFILER_MAX_GPU_SCOPES = 64;
+const GLuint PROFILER_MAX_DEPTH = 16;
+
+enum ProfileTrack
+{
+	PROFILE_TRACK_CPU = 1,
+	PROFILE_TRACK_GPU = 2
+};
+
+// One finished scope. Times are nanoseconds since the profiler started, GPU ones already moved onto the CPU clock.
+struct ProfileEvent
+{
+	const char *name;		// Must outlive the profiler, string literals are the intent
+	uint64_t start;
+	uint64_t duration;
+	uint32_t frame;
+	uint8_t track;
+	uint8_t depth;
+};
+
+// Nested CPU/GPU markers for the main loop. Begin(name)/End() pairs (or a ProfileScope) time a block with
+// high_resolution_clock and, between BeginFrame and EndFrame, with a pair of GL_TIMESTAMP queries. Timestamps
+// rather than GL_TIME_ELAPSED because elapsed queries can't nest, and GpuTimer already uses them around the passes.
+// GPU queries are double/triple buffered per frame and only read once available; a frame whose slot is still
+// busy skips its GPU times instead of stalling.
+// Finished scopes go into a ring buffer with a single writer (the thread that owns the GL context) that publishes
+// each event by bumping an atomic head, so a reader never needs a lock. WriteChromeTrace() dumps what the ring holds
+// in chrome://tracing JSON.
+class Profiler
+{
+public:
+	Profiler() : head(0), frame(0), depth(0), gpuOffset(0), gpuSlot(0), gpuSkip(true)
+	{
+		this->epoch = std::chrono::high_resolution_clock::now();
+
+		for (GLuint i = 0; i < PROFILER_GPU_FRAMES; i++)
+		{
+			this->gpuFrames[i].queries[0] = 0;
+			this->gpuFrames[i].count = 0;
+			this->gpuFrames[i].lastQuery = 0;
+			this->gpuFrames[i].pending = false;
+		}
+	}
+
+	// Needs a current GL context. Collects whatever GPU results arrived and opens a new set of queries.
+	void BeginFrame()
+	{
+#if PROFILER_ENABLED
+		if (this->gpuFrames[0].queries[0] == 0)
+		{
+			for (GLuint i = 0; i < PROFILER_GPU_FRAMES; i++)
+			{
+				glGenQueries(PROFILER_MAX_GPU_SCOPES * 2, this->gpuFrames[i].queries);
+			}
+
+			this->calibrate();
+		}
+
+		for (GLuint i = 0; i < PROFILER_GPU_FRAMES; i++)
+		{
+			this->collect(i);
+		}
+
+		this->frame++;
+		this->gpuSlot = this->frame % PROFILER_GPU_FRAMES;
+		this->gpuSkip = this->gpuFrames[this->gpuSlot].pending;
+
+		if (!this->gpuSkip)
+		{
+			this->gpuFrames[this->gpuSlot].count = 0;
+			this->gpuFrames[this->gpuSlot].lastQuery = 0;
+			this->gpuFrames[this->gpuSlot].frame = this->frame;
+		}
+#endif
+	}
+
+	void EndFrame()
+	{
+#if PROFILER_ENABLED
+		GpuFrame &slot = this->gpuFrames[this->gpuSlot];
+
+		if (!this->gpuSkip && slot.count > 0)
+		{
+			slot.pending = true;
+		}
+
+		// Nothing more goes into this slot until it has been read back
+		this->gpuSkip = true;
+#endif
+	}
+
+	void Begin(const char *name)
+	{
+#if PROFILER_ENABLED
+		if (this->depth >= PROFILER_MAX_DEPTH)
+		{
+			this->depth++;
+			return;
+		}
+
+		OpenScope &scope = this->stack[this->depth];
+		scope.name = name;
+		scope.gpuIndex = -1;
+
+		GpuFrame &slot = this->gpuFrames[this->gpuSlot];
+
+		if (!this->gpuSkip && slot.count < PROFILER_MAX_GPU_SCOPES)
+		{
+			scope.gpuIndex = (GLint)slot.count;
+			slot.names[slot.count] = name;
+			slot.depths[slot.count] = (uint8_t)this->depth;
+			glQueryCounter(slot.queries[slot.count * 2], GL_TIMESTAMP);
+			slot.lastQuery = slot.count * 2;
+			slot.count++;
+		}
+
+		this->depth++;
+		scope.start = this->now();
+#endif
+	}
+
+	void End()
+	{
+#if PROFILER_ENABLED
+		uint64_t end = this->now();
+
+		if (this->depth == 0)
+		{
+			return;
+		}
+
+		this->depth--;
+
+		if (this->depth >= PROFILER_MAX_DEPTH)
+		{
+			return;
+		}
+
+		const OpenScope &scope = this->stack[this->depth];
+
+		if (scope.gpuIndex >= 0)
+		{
+			GpuFrame &slot = this->gpuFrames[this->gpuSlot];
+			glQueryCounter(slot.queries[scope.gpuIndex * 2 + 1], GL_TIMESTAMP);
+			slot.lastQuery = (GLuint)scope.gpuIndex * 2 + 1;
+		}
+
+		ProfileEvent event;
+		event.name = scope.name;
+		event.start = scope.start;
+		event.duration = end - scope.start;
+		event.frame = this->frame;
+		event.track = PROFILE_TRACK_CPU;
+		event.depth = (uint8_t)this->depth;
+		this->push(event);
+#endif
+	}
+
+	// Writes the events still in the ring as a chrome://tracing (or Perfetto) file. Returns false if it can't be written.
+	bool WriteChromeTrace(const char *path) const
+	{
+		std::ofstream file(path, std::ios::trunc);
+
+		if (!file)
+		{
+			std::cout << "ERROR::PROFILER::WRITE_FAILED " << path << std::endl;
+			return false;
+		}
+
+		uint64_t last = this->head.load(std::memory_order_acquire);
+		uint64_t first = last > PROFILER_RING_SIZE ? last - PROFILER_RING_SIZE : 0;
+
+		file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[" << std::endl;
+		file << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << PROFILE_TRACK_CPU << ",\"args\":{\"name\":\"CPU\"}}," << std::endl;
+		file << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << PROFILE_TRACK_GPU << ",\"args\":{\"name\":\"GPU\"}}";
+
+		file.setf(std::ios::fixed);
+		file.precision(3);
+
+		for (uint64_t i = first; i < last; i++)
+		{
+			const ProfileEvent &event = this->events[i & (PROFILER_RING_SIZE - 1)];
+
+			file << "," << std::endl << "{\"name\":\"" << event.name << "\",\"cat\":\"" << (event.track == PROFILE_TRACK_GPU ? "gpu" : "cpu")
+				<< "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << (int)event.track << ",\"ts\":" << (double)event.start / 1000.0
+				<< ",\"dur\":" << (double)event.duration / 1000.0 << ",\"args\":{\"frame\":" << event.frame << ",\"depth\":" << (int)event.depth << "}}";
+		}
+
+		file << std::endl << "]}" << std::endl;
+
+		std::cout << "Profiler: " << last - first << " events written to " << path << std::endl;
+
+		return true;
+	}
+
+private:
+	struct OpenScope
+	{
+		const char *name;
+		uint64_t start;
+		GLint gpuIndex;		// Query pair in the current GPU frame, -1 when the scope has no GPU time
+	};
+
+	// Query pairs (begin, end) of one frame
+	struct GpuFrame
+	{
+		GLuint queries[PROFILER_MAX_GPU_SCOPES * 2];
+		const char *names[PROFILER_MAX_GPU_SCOPES];
+		uint8_t depths[PROFILER_MAX_GPU_SCOPES];
+		GLuint count;
+		GLuint lastQuery;	// Index of the last glQueryCounter issued; with nesting, outer scopes end after the last one to begin
+		uint32_t frame;
+		bool pending;
+	};
+
+	ProfileEvent events[PROFILER_RING_SIZE];
+	std::atomic<uint64_t> head;
+
+	std::chrono::high_resolution_clock::time_point epoch;
+	uint32_t frame;
+	GLuint depth;
+	OpenScope stack[PROFILER_MAX_DEPTH];
+
+	GpuFrame gpuFrames[PROFILER_GPU_FRAMES];
+	int64_t gpuOffset;		// CPU time minus GPU time, in ns
+	GLuint gpuSlot;
+	bool gpuSkip;
+
+	uint64_t now() const
+	{
+		return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::high_resolution_clock::now() - this->epoch).count();
+	}
+
+	// Only the owning thread writes; the slot is filled before head moves past it
+	void push(const ProfileEvent &event)
+	{
+		uint64_t index = this->head.load(std::memory_order_relaxed);
+		this->events[index & (PROFILER_RING_SIZE - 1)] = event;
+		this->head.store(index + 1, std::memory_order_release);
+	}
+
+	// Lines the GPU clock up with ours once, GPU events are then placed on the CPU timeline
+	void calibrate()
+	{
+		GLint64 gpuTime = 0;
+		glGetInteger64v(GL_TIMESTAMP, &gpuTime);
+		this->gpuOffset = (int64_t)this->now() - (int64_t)gpuTime;
+	}
+
+	// Timestamps complete in order: once the frame's last issued query is available all of them are
+	void collect(GLuint index)
+	{
+		GpuFrame &slot = this->gpuFrames[index];
+
+		if (!slot.pending)
+		{
+			return;
+		}
+
+		GLint available = 0;
+		glGetQueryObjectiv(slot.queries[slot.lastQuery], GL_QUERY_RESULT_AVAILABLE, &available);
+
+		if (!available)
+		{
+			return;
+		}
+
+		for (GLuint i = 0; i < slot.count; i++)
+		{
+			GLuint64 start = 0, end = 0;
+			glGetQueryObjectui64v(slot.queries[i * 2], GL_QUERY_RESULT, &start);
+			glGetQueryObjectui64v(slot.queries[i * 2 + 1], GL_QUERY_RESULT, &end);
+
+			ProfileEvent event;
+			event.name = slot.names[i];
+			event.start = (uint64_t)((int64_t)start + this->gpuOffset);
+			event.duration = end > start ? end - start : 0;
+			event.frame = slot.frame;
+			event.track = PROFILE_TRACK_GPU;
+			event.depth = slot.depths[i];
+			this->push(event);
+		}
+
+		slot.pending = false;
+	}
+};
+
+inline Profiler &GetProfiler()
+{
+	static Profiler profiler;
+
+	return profiler;
+}
+
+// Begin/End for a C++ block
+class ProfileScope
+{
+public:
+	explicit ProfileScope(const char *name)
+	{
+		GetProfiler().Begin(name);
+	}
+
+	~ProfileScope()
+	{
+		GetProfiler().End();
+	}
+};
+
+#define PROFILE_CONCAT_INNER(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_INNER(a, b)
+#define PROFILE_SCOPE(name) ProfileScope PROFILE_CONCAT(profileScope, __LINE__)(name)
\ No newline at end of file
@@ -0,0 +1,224 @@
+#pragma once
+
+// Std. Includes
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <cstdint>
+
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#endif
+
+// GL Includes
+#include <GL/glew.h>
+
+#include "Fnv1a.h"
+
+// Folder, relative to the working directory, where linked programs are kept between runs
+#define PROGRAM_CACHE_DIRECTORY "ShaderCache"
+
+// Bumped when the file layout changes, old files then simply stop matching
+const uint32_t PROGRAM_CACHE_VERSION = 1;
+
+// Per-run counters
+struct ProgramCacheStats
+{
+	GLuint hits;			// Programs loaded from a binary
+	GLuint misses;			// Programs compiled from source (no file, stale file or driver rejected it)
+	double milliseconds;	// Time spent building programs either way
+};
+
+// On-disk cache of linked programs (glGetProgramBinary / glProgramBinary, GL 4.1 or ARB_get_program_binary).
+// A program is identified by a 64 bit FNV-1a hash of its final sources (defines included) together with
+// GL_VENDOR, GL_RENDERER and GL_VERSION, so a driver update or a different GPU never loads a foreign binary.
+// Each entry is one file, PROGRAM_CACHE_DIRECTORY/<hash>.bin: a small header, the binary format and the blob.
+// The driver may still refuse a binary it wrote itself; Load() then reports a miss and the caller compiles.
+class ProgramCache
+{
+public:
+	ProgramCache() : checkedSupport(false), supported(false)
+	{
+		this->stats.hits = 0;
+		this->stats.misses = 0;
+		this->stats.milliseconds = 0.0;
+	}
+
+	// Needs a current GL context, the first call reads the driver strings
+	bool IsSupported()
+	{
+		if (!this->checkedSupport)
+		{
+			this->checkedSupport = true;
+
+			GLint formats = 0;
+
+			if (GLEW_VERSION_4_1 || GLEW_ARB_get_program_binary)
+			{
+				glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+			}
+
+			this->supported = formats > 0;
+
+			if (this->supported)
+			{
+				this->driver = driverString(GL_VENDOR) + "|" + driverString(GL_RENDERER) + "|" + driverString(GL_VERSION);
+
+#ifdef _WIN32
+				_mkdir(PROGRAM_CACHE_DIRECTORY);
+#else
+				mkdir(PROGRAM_CACHE_DIRECTORY, 0755);
+#endif
+			}
+		}
+
+		return this->supported;
+	}
+
+	// Key of a program built from these sources on this driver
+	uint64_t MakeKey(const std::string &vertexCode, const std::string &fragmentCode)
+	{
+		this->IsSupported();
+
+		uint64_t hash = FNV1A_OFFSET_BASIS;
+		hash = Fnv1a(hash, this->driver);
+		hash = Fnv1a(hash, vertexCode);
+		// Keeps "ab" + "c" and "a" + "bc" apart
+		hash = Fnv1a(hash, "", 1);
+		hash = Fnv1a(hash, fragmentCode);
+
+		return hash;
+	}
+
+	// Loads the binary stored under key into program, which must be a fresh glCreateProgram(). Returns false when
+	// there is no usable binary; the program is then still unlinked and ready to be built from source.
+	bool Load(uint64_t key, GLuint program)
+	{
+		if (!this->IsSupported())
+		{
+			return false;
+		}
+
+		std::ifstream file(filePath(key).c_str(), std::ios::binary);
+
+		if (!file)
+		{
+			return false;
+		}
+
+		uint32_t version = 0, length = 0;
+		uint64_t storedKey = 0;
+		GLenum format = 0;
+		file.read((char *)&version, sizeof(version));
+		file.read((char *)&storedKey, sizeof(storedKey));
+		file.read((char *)&format, sizeof(format));
+		file.read((char *)&length, sizeof(length));
+
+		if (!file || version != PROGRAM_CACHE_VERSION || storedKey != key || length == 0)
+		{
+			return false;
+		}
+
+		std::vector<char> binary(length);
+		file.read(&binary[0], length);
+
+		if (!file)
+		{
+			return false;
+		}
+
+		glProgramBinary(program, format, &binary[0], (GLsizei)length);
+
+		GLint success = 0;
+		glGetProgramiv(program, GL_LINK_STATUS, &success);
+
+		return success != 0;
+	}
+
+	// Writes the binary of a linked program. Call glProgramParameteri(GL_PROGRAM_BINARY_RETRIEVABLE_HINT) before linking it.
+	void Store(uint64_t key, GLuint program)
+	{
+		if (!this->IsSupported())
+		{
+			return;
+		}
+
+		GLint length = 0;
+		glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+
+		if (length <= 0)
+		{
+			return;
+		}
+
+		std::vector<char> binary(length);
+		GLenum format = 0;
+		glGetProgramBinary(program, length, NULL, &format, &binary[0]);
+
+		std::ofstream file(filePath(key).c_str(), std::ios::binary | std::ios::trunc);
+
+		if (!file)
+		{
+			std::cout << "ERROR::PROGRAM_CACHE::WRITE_FAILED " << filePath(key) << std::endl;
+			return;
+		}
+
+		uint32_t version = PROGRAM_CACHE_VERSION, size = (uint32_t)length;
+		file.write((const char *)&version, sizeof(version));
+		file.write((const char *)&key, sizeof(key));
+		file.write((const char *)&format, sizeof(format));
+		file.write((const char *)&size, sizeof(size));
+		file.write(&binary[0], length);
+	}
+
+	// Called by Shader once per program
+	void Record(bool hit, double milliseconds)
+	{
+		if (hit)
+		{
+			this->stats.hits++;
+		}
+		else
+		{
+			this->stats.misses++;
+		}
+
+		this->stats.milliseconds += milliseconds;
+	}
+
+	const ProgramCacheStats &GetStats() const
+	{
+		return this->stats;
+	}
+
+private:
+	bool checkedSupport, supported;
+	std::string driver;
+	ProgramCacheStats stats;
+
+	static std::string driverString(GLenum name)
+	{
+		const GLubyte *value = glGetString(name);
+
+		return value != NULL ? std::string((const char *)value) : std::string();
+	}
+
+	static std::string filePath(uint64_t key)
+	{
+		std::stringstream ss;
+		ss << PROGRAM_CACHE_DIRECTORY << "/" << std::hex << key << ".bin";
+
+		return ss.str();
+	}
+};
+
+inline ProgramCache &GetProgramCache()
+{
+	static ProgramCache cache;
+
+	return cache;
+}
\ No newline at end of file
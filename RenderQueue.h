@@ -0,0 +1,524 @@
+#pragma once
+
+// Std. Includes
+#include <vector>
+#include <cstdint>
+#include <cstring>
+
+// GL Includes
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include "Shader.h"
+#include "ShaderVariants.h"
+#include "Model.h"
+#include "GeometryArena.h"
+#include "RenderStats.h"
+
+// One mesh draw waiting in the queue
+struct RenderPacket
+{
+	Mesh *mesh;
+	Shader *shader;
+	GLint matrixIndex;		// Index into the queue's model matrices, -1 for instanced packets
+	GLsizei instanceCount;	// 0 for a regular draw, otherwise the number of instances
+	GLuint baseInstance;	// First matrix of the packet in the arena's instance stream
+};
+
+// Per-frame counters of the last FlushDepth() + Flush()
+struct RenderQueueStats
+{
+	GLuint packets;
+	GLuint drawCalls;			// Driver draw calls, a multi-draw counts once
+	GLuint depthDrawCalls;		// Draw calls of the depth pre-pass, 0 when it didn't run
+	GLuint triangles;			// Triangles drawn by Flush, every instance counted
+	GLuint programBinds, programBindsElided;
+	GLuint materialBinds, materialBindsElided;
+	GLuint vaoBinds, vaoBindsElided;
+	GLuint textureBinds, textureBindsElided;
+};
+
+// Collects the frame's draws as packets with a 64 bit sort key, radix sorts them and then submits them
+// so that program, material, VAO and texture bindings only change when they have to.
+//
+// Key layout, most significant bit first:
+//   opaque:      [63] 0 | [62..55] program | [54..39] material | [38..24] VAO | [23..0] depth, front to back
+//   transparent: [63] 1 | [62..39] depth, back to front | [38..31] program | [30..15] material | [14..0] VAO
+// Opaque geometry is grouped by state and ordered front to back inside each group for early-z; transparent
+// geometry is ordered strictly back to front so blending stays correct.
+//
+// Models submitted with a ShaderVariants set get, per mesh, the variant with the frame's light features
+// (SetShaderFeatures) plus the ones its material needs, so code for lights that are off or textures that
+// aren't there is never run.
+//
+// When a multi-draw shader is set (and the driver has GL 4.3 + shader draw parameters) every packet is drawn
+// with one of its variants instead: consecutive packets sharing a material become one glMultiDrawElementsIndirect,
+// and the shader finds each draw's matrices through gl_DrawIDARB (see Shader/lighting_mdi.vs).
+class RenderQueue
+{
+public:
+	RenderQueue() : farPlane(100.0f), sorted(false), shaderFeatures(SHADER_LIGHT_FEATURES), multiDrawShader(NULL)
+	{
+		memset(&this->stats, 0, sizeof(this->stats));
+	}
+
+	// Enables the indirect path with the given variants, or disables it with NULL.
+	// Ignored when the driver can't run it.
+	void SetMultiDrawShader(ShaderVariants *shader)
+	{
+		this->multiDrawShader = (shader != NULL && GetGeometryArena().SupportsMultiDrawIndirect()) ? shader : NULL;
+	}
+
+	bool UsesMultiDraw() const
+	{
+		return this->multiDrawShader != NULL;
+	}
+
+	// Light features of the variants picked for packets submitted from now on (see ActiveLightFeatures)
+	void SetShaderFeatures(GLuint features)
+	{
+		this->shaderFeatures = features & SHADER_LIGHT_FEATURES;
+	}
+
+	// Starts a new frame. Depth is measured from the camera position and normalized against farPlane.
+	void Begin(const glm::vec3 &cameraPosition, GLfloat farPlane)
+	{
+		this->cameraPosition = cameraPosition;
+		this->farPlane = farPlane;
+		this->keys.clear();
+		this->packets.clear();
+		this->matrices.clear();
+		this->normalMatrices.clear();
+		this->sorted = false;
+		memset(&this->stats, 0, sizeof(this->stats));
+	}
+
+	// Queues every mesh of the model with a single model matrix
+	void Submit(Model &model, Shader &shader, const glm::mat4 &transform, bool transparent = false)
+	{
+		this->submit(model, &shader, NULL, transform, transparent);
+	}
+
+	// Same, with each mesh drawn by the cheapest variant that covers it
+	void Submit(Model &model, ShaderVariants &variants, const glm::mat4 &transform, bool transparent = false)
+	{
+		this->submit(model, NULL, &variants, transform, transparent);
+	}
+
+	// Queues every mesh of the model once, drawn as count instances. The matrices go to the arena's instance stream.
+	void SubmitInstanced(Model &model, Shader &shader, const glm::mat4 *transforms, GLsizei count, bool transparent = false)
+	{
+		this->submitInstanced(model, &shader, NULL, transforms, count, transparent);
+	}
+
+	void SubmitInstanced(Model &model, ShaderVariants &variants, const glm::mat4 *transforms, GLsizei count, bool transparent = false)
+	{
+		this->submitInstanced(model, NULL, &variants, transforms, count, transparent);
+	}
+
+	// Sorts the queued packets and issues them
+	void Flush()
+	{
+		this->stats.packets = (GLuint)this->packets.size();
+
+		for (GLuint i = 0; i < this->packets.size(); i++)
+		{
+			const RenderPacket &packet = this->packets[i];
+			this->stats.triangles += packet.mesh->GetIndexCount() / 3 * (packet.instanceCount > 0 ? (GLuint)packet.instanceCount : 1);
+		}
+
+		if (!this->sorted)
+		{
+			this->sort();
+		}
+
+		GeometryArena &arena = GetGeometryArena();
+		arena.SyncInstances();
+
+		BindState state;
+
+		if (this->UsesMultiDraw())
+		{
+			this->flushMultiDraw(state);
+		}
+		else
+		{
+			for (GLuint i = 0; i < this->order.size(); i++)
+			{
+				const RenderPacket &packet = this->packets[this->order[i]];
+				Mesh &mesh = *packet.mesh;
+
+				this->bind(packet, state);
+
+				if (packet.instanceCount > 0)
+				{
+					arena.DrawElementsInstanced(mesh.GetIndexCount(), mesh.GetFirstIndex(), mesh.GetBaseVertex(), packet.instanceCount, packet.baseInstance);
+				}
+				else
+				{
+					glUniformMatrix4fv(state.modelLoc, 1, GL_FALSE, glm::value_ptr(this->matrices[packet.matrixIndex]));
+					glUniformMatrix3fv(state.normalMatrixLoc, 1, GL_FALSE, glm::value_ptr(this->normalMatrices[packet.matrixIndex]));
+					CountUniform(2);
+					arena.DrawElements(mesh.GetIndexCount(), mesh.GetFirstIndex(), mesh.GetBaseVertex());
+				}
+
+				this->stats.drawCalls++;
+			}
+		}
+
+		// Everything stays bound: GLState keeps track of it for whoever draws next
+	}
+
+	// Depth-only pass over the opaque packets, in the same order, using the arena's position-only stream. Call it
+	// with color writes off before Flush(): Flush then draws exactly the same depths and can test with GL_EQUAL,
+	// so the lighting shader runs once per visible pixel. Transparent packets are left to Flush.
+	void FlushDepth(Shader &depthShader, Shader &depthInstancedShader)
+	{
+		if (!this->sorted)
+		{
+			this->sort();
+		}
+
+		GeometryArena &arena = GetGeometryArena();
+		arena.SyncInstances();
+		GetGLState().BindVertexArray(arena.GetDepthVAO());
+
+		GLint modelLoc = depthShader.getModelLocation();
+
+		for (GLuint i = 0; i < this->order.size(); i++)
+		{
+			// Bit 63 of the key marks transparent packets
+			if (this->keys[this->order[i]] >> 63)
+			{
+				continue;
+			}
+
+			const RenderPacket &packet = this->packets[this->order[i]];
+			Mesh &mesh = *packet.mesh;
+
+			if (packet.instanceCount > 0)
+			{
+				depthInstancedShader.Use();
+				arena.DrawElementsInstanced(mesh.GetIndexCount(), mesh.GetFirstIndex(), mesh.GetBaseVertex(), packet.instanceCount, packet.baseInstance);
+			}
+			else
+			{
+				depthShader.Use();
+				glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(this->matrices[packet.matrixIndex]));
+				CountUniform();
+				arena.DrawElements(mesh.GetIndexCount(), mesh.GetFirstIndex(), mesh.GetBaseVertex());
+			}
+
+			this->stats.depthDrawCalls++;
+		}
+	}
+
+	const RenderQueueStats &GetStats() const
+	{
+		return this->stats;
+	}
+
+private:
+	// What the queue has bound so far during a Flush, for the stats (and to skip whole materials at once).
+	// The binds themselves go through GLState, so state left by earlier code is still reused.
+	struct BindState
+	{
+		GLuint currentProgram;
+		GLuint currentVAO;
+		GLuint currentMaterial;
+		bool materialValid;
+		GLint modelLoc;
+		GLint normalMatrixLoc;
+		GLint drawOffsetLoc;	// Indirect path only
+
+		BindState() : currentProgram(0), currentVAO(0), currentMaterial(0), materialValid(false), modelLoc(-1), normalMatrixLoc(-1), drawOffsetLoc(-1)
+		{
+		}
+	};
+
+	glm::vec3 cameraPosition;
+	GLfloat farPlane;
+	bool sorted;	// order is up to date with the packets
+
+	vector<uint64_t> keys;
+	vector<RenderPacket> packets;
+	vector<glm::mat4> matrices;
+	vector<glm::mat3> normalMatrices;	// One per entry of matrices
+
+	// Sorted packet indices, plus scratch space for the radix passes (kept between frames to avoid allocations)
+	vector<uint32_t> order;
+	vector<uint32_t> scratchOrder;
+	vector<uint64_t> scratchKeys;
+	vector<uint64_t> sortedKeys;
+
+	GLuint shaderFeatures;
+
+	// Indirect path
+	ShaderVariants *multiDrawShader;
+	vector<DrawElementsIndirectCommand> commands;
+	vector<GLuint> firstTransforms;
+
+	RenderQueueStats stats;
+
+	// Either shader or variants is set
+	void submit(Model &model, Shader *shader, ShaderVariants *variants, const glm::mat4 &transform, bool transparent)
+	{
+		GLint matrixIndex = (GLint)this->matrices.size();
+		this->matrices.push_back(transform);
+		this->normalMatrices.push_back(ComputeNormalMatrix(transform));
+
+		// The indirect path reads every matrix from the instance stream, even single ones
+		GLuint baseInstance = this->UsesMultiDraw() ? GetGeometryArena().PushInstances(&transform, 1) : 0;
+
+		GLfloat depth = glm::length(glm::vec3(transform[3]) - this->cameraPosition);
+		vector<Mesh> &meshes = model.GetMeshes();
+
+		for (GLuint i = 0; i < meshes.size(); i++)
+		{
+			this->push(&meshes[i], shader, variants, matrixIndex, 0, baseInstance, depth, transparent);
+		}
+	}
+
+	// Either shader or variants is set
+	void submitInstanced(Model &model, Shader *shader, ShaderVariants *variants, const glm::mat4 *transforms, GLsizei count, bool transparent)
+	{
+		if (count <= 0)
+		{
+			return;
+		}
+
+		GLuint baseInstance = GetGeometryArena().PushInstances(transforms, count);
+
+		// Sort by the instance closest to the camera (or farthest, for transparent geometry)
+		GLfloat depth = glm::length(glm::vec3(transforms[0][3]) - this->cameraPosition);
+
+		for (GLsizei i = 1; i < count; i++)
+		{
+			GLfloat d = glm::length(glm::vec3(transforms[i][3]) - this->cameraPosition);
+			depth = transparent ? glm::max(depth, d) : glm::min(depth, d);
+		}
+
+		vector<Mesh> &meshes = model.GetMeshes();
+
+		for (GLuint i = 0; i < meshes.size(); i++)
+		{
+			this->push(&meshes[i], shader, variants, -1, count, baseInstance, depth, transparent);
+		}
+	}
+
+	void push(Mesh *mesh, Shader *shader, ShaderVariants *variants, GLint matrixIndex, GLsizei instanceCount, GLuint baseInstance, GLfloat depth, bool transparent)
+	{
+		// In indirect mode every packet is drawn by the multi-draw program, so sort on that one
+		if (this->multiDrawShader != NULL)
+		{
+			variants = this->multiDrawShader;
+		}
+
+		if (variants != NULL)
+		{
+			GLuint features = this->shaderFeatures | mesh->GetMaterial().GetFeatures() | (transparent ? SHADER_ALPHA_DISCARD : 0);
+			shader = &variants->Get(features);
+		}
+
+		this->sorted = false;
+
+		RenderPacket packet;
+		packet.mesh = mesh;
+		packet.shader = shader;
+		packet.matrixIndex = matrixIndex;
+		packet.instanceCount = instanceCount;
+		packet.baseInstance = baseInstance;
+
+		this->packets.push_back(packet);
+		this->keys.push_back(this->makeKey(shader->Program, mesh->GetMaterialSortKey(), mesh->GetVAO(), depth, transparent));
+	}
+
+	// Binds the program, material, textures and VAO of a packet, skipping whatever is already bound
+	void bind(const RenderPacket &packet, BindState &state)
+	{
+		Mesh &mesh = *packet.mesh;
+		Shader &shader = *packet.shader;
+
+		if (shader.Program != state.currentProgram)
+		{
+			shader.Use();
+			state.currentProgram = shader.Program;
+			state.modelLoc = shader.getModelLocation();
+			state.normalMatrixLoc = shader.getNormalMatrixLocation();
+			state.drawOffsetLoc = this->UsesMultiDraw() ? shader.GetUniformLocation("drawOffset") : -1;
+			// Material uniforms belong to the program, they have to be set again
+			state.materialValid = false;
+			this->stats.programBinds++;
+		}
+		else
+		{
+			this->stats.programBindsElided++;
+		}
+
+		MaterialBinding &material = mesh.GetMaterial();
+
+		if (!state.materialValid || material.GetId() != state.currentMaterial)
+		{
+			material.Apply(shader);
+			state.currentMaterial = material.GetId();
+			state.materialValid = true;
+			this->stats.materialBinds++;
+
+			GLuint binds = material.BindTextures();
+			this->stats.textureBinds += binds;
+			this->stats.textureBindsElided += material.GetTextureCount() - binds;
+		}
+		else
+		{
+			this->stats.materialBindsElided++;
+			this->stats.textureBindsElided += material.GetTextureCount();
+		}
+
+		if (mesh.GetVAO() != state.currentVAO)
+		{
+			GetGLState().BindVertexArray(mesh.GetVAO());
+			state.currentVAO = mesh.GetVAO();
+			this->stats.vaoBinds++;
+		}
+		else
+		{
+			this->stats.vaoBindsElided++;
+		}
+	}
+
+	// Turns the sorted packets into indirect commands, one per packet, and issues one multi-draw for every
+	// run of packets that share a material and variant (everything else is already shared)
+	void flushMultiDraw(BindState &state)
+	{
+		GeometryArena &arena = GetGeometryArena();
+
+		this->commands.resize(this->order.size());
+		this->firstTransforms.resize(this->order.size());
+
+		for (GLuint i = 0; i < this->order.size(); i++)
+		{
+			const RenderPacket &packet = this->packets[this->order[i]];
+			DrawElementsIndirectCommand &command = this->commands[i];
+
+			command.count = (GLuint)packet.mesh->GetIndexCount();
+			command.instanceCount = packet.instanceCount > 0 ? (GLuint)packet.instanceCount : 1;
+			command.firstIndex = packet.mesh->GetFirstIndex();
+			command.baseVertex = packet.mesh->GetBaseVertex();
+			command.baseInstance = 0;
+			this->firstTransforms[i] = packet.baseInstance;
+		}
+
+		arena.SetIndirectCommands(this->commands, this->firstTransforms);
+
+		GLuint runStart = 0;
+
+		while (runStart < this->order.size())
+		{
+			const RenderPacket &first = this->packets[this->order[runStart]];
+			// The material's id, not its sort key: every packet of the run samples first's textures
+			GLuint material = first.mesh->GetMaterial().GetId();
+			GLuint runEnd = runStart + 1;
+
+			while (runEnd < this->order.size() && this->packets[this->order[runEnd]].mesh->GetMaterial().GetId() == material
+				&& this->packets[this->order[runEnd]].shader == first.shader)
+			{
+				runEnd++;
+			}
+
+			this->bind(first, state);
+			// gl_DrawIDARB restarts at 0 on every multi-draw
+			glUniform1ui(state.drawOffsetLoc, runStart);
+			CountUniform();
+			arena.MultiDraw(runStart, (GLsizei)(runEnd - runStart));
+
+			for (GLuint c = runStart; c < runEnd; c++)
+			{
+				CountVertices((GLsizei)this->commands[c].count, (GLsizei)this->commands[c].instanceCount);
+			}
+			this->stats.drawCalls++;
+
+			// The rest of the run shares the first packet's state
+			GLuint elided = runEnd - runStart - 1;
+			this->stats.programBindsElided += elided;
+			this->stats.materialBindsElided += elided;
+			this->stats.vaoBindsElided += elided;
+
+			runStart = runEnd;
+		}
+	}
+
+	uint64_t makeKey(GLuint program, GLuint material, GLuint vao, GLfloat depth, bool transparent) const
+	{
+		GLfloat normalized = glm::clamp(depth / this->farPlane, 0.0f, 1.0f);
+		uint64_t program8 = program & 0xFF;
+		uint64_t material16 = material & 0xFFFF;
+		uint64_t vao15 = vao & 0x7FFF;
+
+		if (!transparent)
+		{
+			uint64_t depth24 = (uint64_t)(normalized * 0xFFFFFF);
+
+			return (program8 << 55) | (material16 << 39) | (vao15 << 24) | depth24;
+		}
+
+		// Farther first: invert the depth
+		uint64_t depth24 = 0xFFFFFF - (uint64_t)(normalized * 0xFFFFFF);
+
+		return (1ull << 63) | (depth24 << 39) | (program8 << 31) | (material16 << 15) | vao15;
+	}
+
+	// LSD radix sort of the packet indices by key, 8 bits per pass. Passes where every key has the same
+	// byte are skipped, which is most of them for a small scene.
+	void sort()
+	{
+		size_t count = this->keys.size();
+		this->sorted = true;
+
+		this->order.resize(count);
+		this->scratchOrder.resize(count);
+		this->sortedKeys.assign(this->keys.begin(), this->keys.end());
+		this->scratchKeys.resize(count);
+
+		for (size_t i = 0; i < count; i++)
+		{
+			this->order[i] = (uint32_t)i;
+		}
+
+		for (GLuint shift = 0; shift < 64; shift += 8)
+		{
+			size_t histogram[256];
+			memset(histogram, 0, sizeof(histogram));
+
+			for (size_t i = 0; i < count; i++)
+			{
+				histogram[(this->sortedKeys[i] >> shift) & 0xFF]++;
+			}
+
+			// All keys share this byte: the pass would not change the order
+			if (count == 0 || histogram[(this->sortedKeys[0] >> shift) & 0xFF] == count)
+			{
+				continue;
+			}
+
+			size_t offset = 0;
+
+			for (GLuint digit = 0; digit < 256; digit++)
+			{
+				size_t bucket = histogram[digit];
+				histogram[digit] = offset;
+				offset += bucket;
+			}
+
+			for (size_t i = 0; i < count; i++)
+			{
+				size_t destination = histogram[(this->sortedKeys[i] >> shift) & 0xFF]++;
+				this->scratchKeys[destination] = this->sortedKeys[i];
+				this->scratchOrder[destination] = this->order[i];
+			}
+
+			this->sortedKeys.swap(this->scratchKeys);
+			this->order.swap(this->scratchOrder);
+		}
+	}
+};
\ No newline at end of file
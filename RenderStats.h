@@ -0,0 +1,144 @@
+#pragma once
+
+// Std. Includes
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+// GL Includes
+#include <GL/glew.h>
+
+// What one frame asked of GL. Counted where the calls are made (GeometryArena draws, GLState binds, Shader
+// setters, buffer and texture uploads), so Model::Draw, Mesh::Draw, the render queue and the lamp loop are all
+// covered without counting twice.
+struct RenderStats
+{
+	GLuint drawCalls;			// A multi-draw counts once
+	uint64_t triangles;
+	uint64_t vertices;			// Vertices fed to the vertex shader: indices times instances
+	GLuint programBinds;		// Binds that reached the driver, GLState drops the redundant ones
+	GLuint vaoBinds;
+	GLuint textureBinds;
+	GLuint uniformUploads;		// glUniform* calls
+	uint64_t bytesUploaded;		// Buffer and texture data sent to GL
+};
+
+// Counters of the frame in progress plus the last finished frame. EndFrame() closes a frame, and appends it to
+// the CSV file when one is open so a run can be compared against an earlier one.
+class RenderStatsTracker
+{
+public:
+	RenderStatsTracker() : frame(0)
+	{
+		memset(&this->current, 0, sizeof(this->current));
+		memset(&this->last, 0, sizeof(this->last));
+	}
+
+	RenderStats &Current()
+	{
+		return this->current;
+	}
+
+	// Totals of the last complete frame; stays valid until the next EndFrame
+	const RenderStats &GetLastFrame() const
+	{
+		return this->last;
+	}
+
+	uint32_t GetFrame() const
+	{
+		return this->frame;
+	}
+
+	void EndFrame()
+	{
+		this->last = this->current;
+		memset(&this->current, 0, sizeof(this->current));
+		this->frame++;
+
+		if (this->csv.is_open())
+		{
+			this->csv << this->frame << "," << this->last.drawCalls << "," << this->last.triangles << "," << this->last.vertices << ","
+				<< this->last.programBinds << "," << this->last.vaoBinds << "," << this->last.textureBinds << ","
+				<< this->last.uniformUploads << "," << this->last.bytesUploaded << "\n";
+		}
+	}
+
+	// Starts writing one row per frame to path, replacing the file
+	bool OpenCsv(const char *path)
+	{
+		this->CloseCsv();
+		this->csv.open(path, std::ios::trunc);
+
+		if (!this->csv)
+		{
+			std::cout << "ERROR::RENDER_STATS::WRITE_FAILED " << path << std::endl;
+			return false;
+		}
+
+		this->csv << "frame,draw_calls,triangles,vertices,program_binds,vao_binds,texture_binds,uniform_uploads,bytes_uploaded\n";
+
+		return true;
+	}
+
+	void CloseCsv()
+	{
+		if (this->csv.is_open())
+		{
+			this->csv.close();
+		}
+	}
+
+	bool IsWritingCsv() const
+	{
+		return this->csv.is_open();
+	}
+
+private:
+	RenderStats current, last;
+	uint32_t frame;
+	std::ofstream csv;
+};
+
+inline RenderStatsTracker &GetRenderStatsTracker()
+{
+	static RenderStatsTracker tracker;
+
+	return tracker;
+}
+
+inline RenderStats &GetRenderStats()
+{
+	return GetRenderStatsTracker().Current();
+}
+
+// Vertices and triangles of a draw (or of one command of a multi-draw) without counting a call
+inline void CountVertices(GLsizei vertexCount, GLsizei instanceCount)
+{
+	RenderStats &stats = GetRenderStats();
+	stats.vertices += (uint64_t)vertexCount * instanceCount;
+	stats.triangles += (uint64_t)(vertexCount / 3) * instanceCount;
+}
+
+// A call without its vertices, e.g. a multi-draw whose commands are counted with CountVertices
+inline void CountDrawCall()
+{
+	GetRenderStats().drawCalls++;
+}
+
+inline void CountDraw(GLsizei vertexCount, GLsizei instanceCount = 1)
+{
+	CountDrawCall();
+	CountVertices(vertexCount, instanceCount);
+}
+
+inline void CountUniform(GLuint count = 1)
+{
+	GetRenderStats().uniformUploads += count;
+}
+
+inline void CountUpload(size_t bytes)
+{
+	GetRenderStats().bytesUploaded += bytes;
+}
\ No newline at end of file
@@ -5,16 +5,33 @@
 #include <fstream>
 #include <sstream>
 #include <iostream>
+#include <vector>
+#include <unordered_map>
+#include <chrono>
+#include <functional>
+#include <algorithm>
 
 #include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include "GLState.h"
+#include "RenderStats.h"
+#include "ProgramCache.h"
 
 class Shader
 {
 public:
 	GLuint Program;
 	GLuint uniformColor;
-	// Constructor generates the shader on the fly
-	Shader(const GLchar *vertexPath, const GLchar *fragmentPath)
+	GLint uniformModel;
+	GLint uniformNormalMatrix;
+	// Constructor generates the shader on the fly. defines ("#define NAME\n" lines) go into both stages right after #version.
+	// A deferred shader is only handed to the driver here; compile and link results are collected the first time
+	// the program is needed (see IsReady), so several programs can compile in parallel.
+	Shader(const GLchar *vertexPath, const GLchar *fragmentPath, const std::string &defines = std::string(), bool deferred = false)
+		: Program(0), uniformColor(0), uniformModel(-1), uniformNormalMatrix(-1), vertex(0), fragment(0), pending(false), linked(false),
+		cached(false), cacheKey(0), buildMilliseconds(0.0), generation(0)
 	{
 		// 1. Retrieve the vertex/fragment source code from filePath
 		std::string vertexCode;
@@ -44,63 +61,401 @@ public:
 		{
 			std::cout << "ERROR::SHADER::FILE_NOT_SUCCESFULLY_READ" << std::endl;
 		}
-		const GLchar *vShaderCode = vertexCode.c_str();
-		const GLchar *fShaderCode = fragmentCode.c_str();
-		// 2. Compile shaders
-		GLuint vertex, fragment;
-		GLint success;
-		GLchar infoLog[512];
-		// Vertex Shader
-		vertex = glCreateShader(GL_VERTEX_SHADER);
-		glShaderSource(vertex, 1, &vShaderCode, NULL);
-		glCompileShader(vertex);
-		// Print compile errors if any
-		glGetShaderiv(vertex, GL_COMPILE_STATUS, &success);
-		if (!success)
-		{
-			glGetShaderInfoLog(vertex, 512, NULL, infoLog);
-			std::cout << "ERROR::SHADER::VERTEX::COMPILATION_FAILED\n" << infoLog << std::endl;
-		}
-		// Fragment Shader
-		fragment = glCreateShader(GL_FRAGMENT_SHADER);
-		glShaderSource(fragment, 1, &fShaderCode, NULL);
-		glCompileShader(fragment);
-		// Print compile errors if any
-		glGetShaderiv(fragment, GL_COMPILE_STATUS, &success);
-		if (!success)
-		{
-			glGetShaderInfoLog(fragment, 512, NULL, infoLog);
-			std::cout << "ERROR::SHADER::FRAGMENT::COMPILATION_FAILED\n" << infoLog << std::endl;
-		}
-		// Shader Program
-		this->Program = glCreateProgram();
-		glAttachShader(this->Program, vertex);
-		glAttachShader(this->Program, fragment);
-		glLinkProgram(this->Program);
-		// Print linking errors if any
-		glGetProgramiv(this->Program, GL_LINK_STATUS, &success);
-		if (!success)
+		vertexCode = injectDefines(vertexCode, defines);
+		fragmentCode = injectDefines(fragmentCode, defines);
+		this->submit(vertexCode, fragmentCode);
+
+		if (!deferred)
 		{
-			glGetProgramInfoLog(this->Program, 512, NULL, infoLog);
-			std::cout << "ERROR::SHADER::PROGRAM::LINKING_FAILED\n" << infoLog << std::endl;
+			this->finish();
+		}
+	}
+
+	// False while the driver is still compiling a deferred program. Never blocks; without
+	// KHR_parallel_shader_compile the driver can't be asked, and a pending program always reports ready.
+	bool IsReady() const
+	{
+		if (!this->pending || !SupportsParallelCompile())
+		{
+			return true;
+		}
+
+		GLint done = 0;
+		glGetProgramiv(this->Program, GL_COMPLETION_STATUS_KHR, &done);
+
+		return done != 0;
+	}
+
+	// True once the program has been built and linked successfully (finishing a deferred build if needed)
+	bool IsLinked()
+	{
+		this->ensureBuilt();
+
+		return this->linked;
+	}
+
+	// Runs after every successful build, and again when a hot reload swaps in a new program: that is the place
+	// for per-program setup (uniform block bindings, sampler units).
+	void SetLinkCallback(const std::function<void(Shader &)> &callback)
+	{
+		this->linkCallback = callback;
+
+		if (!this->pending && this->linked && callback)
+		{
+			callback(*this);
+		}
+	}
+
+	// Takes over other's program and uniform table, handing it this one's. Used by ShaderLibrary to swap in a
+	// reloaded program; the link callback runs for the new program.
+	void ReplaceProgram(Shader &other)
+	{
+		this->ensureBuilt();
+		other.ensureBuilt();
+
+		std::swap(this->Program, other.Program);
+		std::swap(this->uniformColor, other.uniformColor);
+		std::swap(this->uniformModel, other.uniformModel);
+		std::swap(this->uniformNormalMatrix, other.uniformNormalMatrix);
+		std::swap(this->uniforms, other.uniforms);
+		std::swap(this->linked, other.linked);
+		std::swap(this->generation, other.generation);
+
+		if (this->linked && this->linkCallback)
+		{
+			this->linkCallback(*this);
+		}
+	}
+
+	// Deletes the program, and the stage objects of a build that was never finished, without waiting for the driver
+	void Discard()
+	{
+		if (this->pending)
+		{
+			glDeleteShader(this->vertex);
+			glDeleteShader(this->fragment);
+			this->pending = false;
+		}
+
+		glDeleteProgram(this->Program);
+		this->Program = 0;
+		this->linked = false;
+	}
+
+	// True while the build hasn't been collected yet
+	bool IsPending() const
+	{
+		return this->pending;
+	}
+
+	// Asks the driver for as many compiler threads as it likes. Needs a current GL context.
+	static bool SupportsParallelCompile()
+	{
+		static int supported = -1;
+
+		if (supported < 0)
+		{
+			supported = 0;
+
+			if (GLEW_KHR_parallel_shader_compile)
+			{
+				glMaxShaderCompilerThreadsKHR(0xFFFFFFFF);
+				supported = 1;
+			}
+			else if (GLEW_ARB_parallel_shader_compile)
+			{
+				glMaxShaderCompilerThreadsARB(0xFFFFFFFF);
+				supported = 1;
+			}
 		}
-		//le damos la localidad de color
-		uniformColor = glGetUniformLocation(this->Program, "color");
-		// Delete the shaders as they're linked into our program now and no longer necessery
-		glDeleteShader(vertex);
-		glDeleteShader(fragment);
 
+		return supported != 0;
 	}
+
 	// Uses the current shader
 	void Use()
 	{
-		glUseProgram(this->Program);
+		this->ensureBuilt();
+		GetGLState().UseProgram(this->Program);
 	}
 
 	GLuint getColorLocation()
 	{
+		this->ensureBuilt();
 		return uniformColor;
 	}
+
+	GLint getModelLocation() const
+	{
+		this->ensureBuilt();
+		return uniformModel;
+	}
+
+	GLint getNormalMatrixLocation() const
+	{
+		this->ensureBuilt();
+		return uniformNormalMatrix;
+	}
+
+	// Unique for every program this process builds. A deleted program's name can be reused by a later link, so
+	// anything cached per program should be keyed on (Program, generation).
+	GLuint GetGeneration() const
+	{
+		return this->generation;
+	}
+
+	// Returns the location of an active uniform, or -1 if the program doesn't use it.
+	// This only hits the table built after linking, never the driver, but it still hashes the name:
+	// resolve handles once outside the render loop and keep the GLint around.
+	GLint GetUniformLocation(const std::string &name) const
+	{
+		this->ensureBuilt();
+
+		std::unordered_map<std::string, GLint>::const_iterator it = this->uniforms.find(name);
+
+		return it != this->uniforms.end() ? it->second : -1;
+	}
+
+	// Attaches a uniform block of this program to a buffer binding point (no-op if the block isn't used)
+	void BindUniformBlock(const GLchar *blockName, GLuint bindingPoint)
+	{
+		this->ensureBuilt();
+
+		GLuint blockIndex = glGetUniformBlockIndex(this->Program, blockName);
+
+		if (blockIndex != GL_INVALID_INDEX)
+		{
+			glUniformBlockBinding(this->Program, blockIndex, bindingPoint);
+		}
+	}
+
+	// Typed setters for the current program. A location of -1 is silently ignored, like glUniform*
+	void SetInt(GLint location, GLint value) const
+	{
+		glUniform1i(location, value);
+		CountUniform();
+	}
+
+	void SetFloat(GLint location, GLfloat value) const
+	{
+		glUniform1f(location, value);
+		CountUniform();
+	}
+
+	void SetVec3(GLint location, GLfloat x, GLfloat y, GLfloat z) const
+	{
+		glUniform3f(location, x, y, z);
+		CountUniform();
+	}
+
+	void SetVec3(GLint location, const glm::vec3 &value) const
+	{
+		glUniform3f(location, value.x, value.y, value.z);
+		CountUniform();
+	}
+
+	void SetMat4(GLint location, const glm::mat4 &value) const
+	{
+		glUniformMatrix4fv(location, 1, GL_FALSE, glm::value_ptr(value));
+		CountUniform();
+	}
+
+private:
+	// Active uniform name -> location, filled right after linking
+	std::unordered_map<std::string, GLint> uniforms;
+
+	// Build in flight: the stage objects until finish() collects them
+	GLuint vertex, fragment;
+	bool pending;
+	bool linked;
+	bool cached;
+	uint64_t cacheKey;
+	double buildMilliseconds;
+	GLuint generation;
+	std::function<void(Shader &)> linkCallback;
+
+	static GLuint nextGeneration()
+	{
+		static GLuint counter = 0;
+
+		return ++counter;
+	}
+
+	// Getters are const but may have to wait for a deferred build; the program itself is what they look at
+	void ensureBuilt() const
+	{
+		if (this->pending)
+		{
+			const_cast<Shader *>(this)->finish();
+		}
+	}
+
+	// Loads the cached binary or hands both stages and the link to the driver, without asking for any result
+	void submit(const std::string &vertexCode, const std::string &fragmentCode)
+	{
+		const GLchar *vShaderCode = vertexCode.c_str();
+		const GLchar *fShaderCode = fragmentCode.c_str();
+		std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+		// 2. Reuse the program binary from an earlier run when this driver still accepts it
+		ProgramCache &cache = GetProgramCache();
+		this->cacheKey = cache.MakeKey(vertexCode, fragmentCode);
+		this->Program = glCreateProgram();
+		this->generation = nextGeneration();
+		this->cached = cache.Load(this->cacheKey, this->Program);
+		if (!this->cached)
+		{
+			// 3. Compile shaders (the status checks wait for finish(), querying now would serialize the driver)
+			SupportsParallelCompile();
+			// Vertex Shader
+			this->vertex = glCreateShader(GL_VERTEX_SHADER);
+			glShaderSource(this->vertex, 1, &vShaderCode, NULL);
+			glCompileShader(this->vertex);
+			// Fragment Shader
+			this->fragment = glCreateShader(GL_FRAGMENT_SHADER);
+			glShaderSource(this->fragment, 1, &fShaderCode, NULL);
+			glCompileShader(this->fragment);
+			// Shader Program
+			glAttachShader(this->Program, this->vertex);
+			glAttachShader(this->Program, this->fragment);
+			// Ask the driver to keep the binary around so it can be cached
+			if (cache.IsSupported())
+			{
+				glProgramParameteri(this->Program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+			}
+			glLinkProgram(this->Program);
+		}
+		this->pending = true;
+		this->buildMilliseconds = (double)std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::high_resolution_clock::now() - start).count() / 1000.0;
+	}
+
+	// Collects the results of submit(): error logs, the cache entry and the uniform table
+	void finish()
+	{
+		this->pending = false;
+		std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+		ProgramCache &cache = GetProgramCache();
+		GLint success = 1;
+		GLchar infoLog[512];
+		if (!this->cached)
+		{
+			// Print compile errors if any
+			glGetShaderiv(this->vertex, GL_COMPILE_STATUS, &success);
+			if (!success)
+			{
+				glGetShaderInfoLog(this->vertex, 512, NULL, infoLog);
+				std::cout << "ERROR::SHADER::VERTEX::COMPILATION_FAILED\n" << infoLog << std::endl;
+			}
+			glGetShaderiv(this->fragment, GL_COMPILE_STATUS, &success);
+			if (!success)
+			{
+				glGetShaderInfoLog(this->fragment, 512, NULL, infoLog);
+				std::cout << "ERROR::SHADER::FRAGMENT::COMPILATION_FAILED\n" << infoLog << std::endl;
+			}
+			// Print linking errors if any
+			glGetProgramiv(this->Program, GL_LINK_STATUS, &success);
+			if (!success)
+			{
+				glGetProgramInfoLog(this->Program, 512, NULL, infoLog);
+				std::cout << "ERROR::SHADER::PROGRAM::LINKING_FAILED\n" << infoLog << std::endl;
+			}
+			else
+			{
+				cache.Store(this->cacheKey, this->Program);
+			}
+			// Delete the shaders as they're linked into our program now and no longer necessery
+			glDetachShader(this->Program, this->vertex);
+			glDetachShader(this->Program, this->fragment);
+			glDeleteShader(this->vertex);
+			glDeleteShader(this->fragment);
+			this->vertex = 0;
+			this->fragment = 0;
+		}
+		this->linked = success != 0;
+		this->buildMilliseconds += (double)std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::high_resolution_clock::now() - start).count() / 1000.0;
+		cache.Record(this->cached, this->buildMilliseconds);
+		// Build the uniform table once, every later lookup is served from it
+		this->cacheUniforms();
+		//le damos la localidad de color
+		uniformColor = this->GetUniformLocation("color");
+		// y la de la matriz de modelo (la usa la cola de render en cada paquete)
+		uniformModel = this->GetUniformLocation("model");
+		uniformNormalMatrix = this->GetUniformLocation("normalMatrix");
+		if (this->linked && this->linkCallback)
+		{
+			this->linkCallback(*this);
+		}
+	}
+
+	// #version has to stay the first directive. A #line after the defines keeps the compiler's line numbers
+	// matching the file.
+	static std::string injectDefines(const std::string &code, const std::string &defines)
+	{
+		if (defines.empty())
+		{
+			return code;
+		}
+
+		std::string::size_type version = code.find("#version");
+		std::string::size_type lineEnd = version != std::string::npos ? code.find('\n', version) : std::string::npos;
+
+		if (lineEnd == std::string::npos)
+		{
+			return defines + code;
+		}
+
+		GLuint nextLine = 2;
+
+		for (std::string::size_type i = 0; i < version; i++)
+		{
+			nextLine += code[i] == '\n' ? 1 : 0;
+		}
+
+		return code.substr(0, lineEnd + 1) + defines + "#line " + std::to_string(nextLine) + "\n" + code.substr(lineEnd + 1);
+	}
+
+	// Introspects every active uniform of the linked program
+	void cacheUniforms()
+	{
+		GLint count = 0, maxLength = 0;
+		glGetProgramiv(this->Program, GL_ACTIVE_UNIFORMS, &count);
+		glGetProgramiv(this->Program, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength);
+
+		std::vector<GLchar> name(maxLength > 0 ? maxLength : 1);
+
+		for (GLint i = 0; i < count; i++)
+		{
+			GLsizei length = 0;
+			GLint size = 0;
+			GLenum type;
+			glGetActiveUniform(this->Program, (GLuint)i, (GLsizei)name.size(), &length, &size, &type, &name[0]);
+
+			std::string uniformName(&name[0], length);
+			GLint location = glGetUniformLocation(this->Program, uniformName.c_str());
+
+			// Members of uniform blocks have no location
+			if (location < 0)
+			{
+				continue;
+			}
+
+			this->uniforms[uniformName] = location;
+
+			// Arrays of basic types are reported once as "name[0]": register the bare name and every element
+			std::string::size_type bracket = uniformName.rfind("[0]");
+
+			if (bracket != std::string::npos && bracket + 3 == uniformName.size())
+			{
+				std::string base = uniformName.substr(0, bracket);
+				this->uniforms[base] = location;
+
+				for (GLint element = 1; element < size; element++)
+				{
+					std::string elementName = base + "[" + std::to_string(element) + "]";
+					this->uniforms[elementName] = glGetUniformLocation(this->Program, elementName.c_str());
+				}
+			}
+		}
+	}
 };
 
 #endif
\ No newline at end of file
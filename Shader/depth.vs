@@ -0,0 +1,14 @@
+#version 330 core
+layout (location = 0) in vec3 position;
+
+// Same expression as lighting.vs, so the shaded pass can test with GL_EQUAL
+invariant gl_Position;
+
+uniform mat4 model;
+uniform mat4 view;
+uniform mat4 projection;
+
+void main()
+{
+    gl_Position = projection * view *  model * vec4(position, 1.0f);
+}
\ No newline at end of file
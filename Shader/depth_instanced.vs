@@ -0,0 +1,15 @@
+#version 330 core
+layout (location = 0) in vec3 position;
+// Per-instance model matrix (locations 3 to 6, one column each)
+layout (location = 3) in mat4 instanceModel;
+
+// Same expression as lighting_instanced.vs, so the shaded pass can test with GL_EQUAL
+invariant gl_Position;
+
+uniform mat4 view;
+uniform mat4 projection;
+
+void main()
+{
+    gl_Position = projection * view * instanceModel * vec4(position, 1.0f);
+}
\ No newline at end of file
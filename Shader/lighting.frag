@@ -1,6 +1,7 @@
 #version 330 core
 
-#define NUMBER_OF_POINT_LIGHTS 4
+// Optional parts, switched on by #defines that ShaderVariants.h puts after #version:
+// DIR_LIGHT, SPOT_LIGHT, POINT_LIGHTS, SPECULAR_MAP and ALPHA_DISCARD
 
 struct Material
 {
@@ -9,6 +10,9 @@ struct Material
     float shininess;
 };
 
+// The light structs live in a std140 uniform block mirrored by LightRig.h on the CPU.
+// Scalars are packed behind a vec3 to fill its 16 byte row; keep both sides in sync.
+// PointLight has the same layout as the four texels of each light in pointLightData.
 struct DirLight
 {
     vec3 direction;
@@ -21,30 +25,28 @@ struct DirLight
 struct PointLight
 {
     vec3 position;
-    
     float constant;
-    float linear;
-    float quadratic;
     
     vec3 ambient;
+    float linear;
     vec3 diffuse;
+    float quadratic;
     vec3 specular;
 };
 
 struct SpotLight
 {
     vec3 position;
-    vec3 direction;
     float cutOff;
+    vec3 direction;
     float outerCutOff;
     
-    float constant;
-    float linear;
-    float quadratic;
-    
     vec3 ambient;
+    float constant;
     vec3 diffuse;
+    float linear;
     vec3 specular;
+    float quadratic;
 };
 
 in vec3 FragPos;
@@ -54,16 +56,31 @@ in vec2 TexCoords;
 out vec4 color;
 
 uniform vec3 viewPos;
-uniform DirLight dirLight;
-uniform PointLight pointLights[NUMBER_OF_POINT_LIGHTS];
-uniform SpotLight spotLight;
+
+// Shared by every lit program through a fixed binding point (LIGHTS_BINDING_POINT).
+// The spot light sits right before the cluster parameters so the per-frame data forms one contiguous range.
+layout (std140) uniform Lights
+{
+    DirLight dirLight;
+    SpotLight spotLight;
+    vec4 clusterDepthPlane; // View depth of a world position p is dot( clusterDepthPlane, vec4( p, 1 ) )
+    vec4 clusterScale;      // Tile size in pixels (xy), depth slice scale and bias applied to log( depth ) (zw)
+    uvec4 clusterCounts;    // Clusters along x, y and z
+};
+
+// Point lights and their clustered lists (LightClusters.h), read as buffer textures
+uniform samplerBuffer pointLightData;       // Four texels per light
+uniform usamplerBuffer clusterGrid;         // ( first index, light count ) per cluster
+uniform usamplerBuffer clusterLightIndices; // Light indices, one list per cluster
+
 uniform Material material;
-uniform int transparency;
 
 // Function prototypes
 vec3 CalcDirLight( DirLight light, vec3 normal, vec3 viewDir );
 vec3 CalcPointLight( PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir );
 vec3 CalcSpotLight( SpotLight light, vec3 normal, vec3 fragPos, vec3 viewDir );
+PointLight FetchPointLight( int index );
+vec3 SpecularColor( );
 
 void main( )
 {
@@ -71,21 +88,38 @@ void main( )
     vec3 norm = normalize( Normal );
     vec3 viewDir = normalize( viewPos - FragPos );
     
-    // Directional lighting
-    vec3 result = CalcDirLight( dirLight, norm, viewDir );
+    vec3 result = vec3( 0.0 );
     
-    // Point lights
-    for ( int i = 0; i < NUMBER_OF_POINT_LIGHTS; i++ )
+#ifdef DIR_LIGHT
+    // Directional lighting
+    result += CalcDirLight( dirLight, norm, viewDir );
+#endif
+    
+#ifdef POINT_LIGHTS
+    // Point lights: only the ones binned into this fragment's cluster
+    float viewDepth = max( dot( clusterDepthPlane, vec4( FragPos, 1.0 ) ), 1e-4 );
+    uint slice = uint( max( log( viewDepth ) * clusterScale.z + clusterScale.w, 0.0 ) );
+    uvec3 cell = min( uvec3( uvec2( gl_FragCoord.xy / clusterScale.xy ), slice ), clusterCounts.xyz - 1u );
+    int cluster = int( cell.x + clusterCounts.x * ( cell.y + clusterCounts.y * cell.z ) );
+    uvec2 lights = texelFetch( clusterGrid, cluster ).xy;
+    
+    for ( uint i = 0u; i < lights.y; i++ )
     {
-        result += CalcPointLight( pointLights[i], norm, FragPos, viewDir );
+        int index = int( texelFetch( clusterLightIndices, int( lights.x + i ) ).r );
+        result += CalcPointLight( FetchPointLight( index ), norm, FragPos, viewDir );
     }
+#endif
     
+#ifdef SPOT_LIGHT
     // Spot light
     result += CalcSpotLight( spotLight, norm, FragPos, viewDir );
+#endif
  	
     color = vec4( result,texture(material.diffuse, TexCoords).rgb );
-	  if(color.a < 0.1 && transparency==1)
+#ifdef ALPHA_DISCARD
+	  if(color.a < 0.1)
         discard;
+#endif
 
 }
 
@@ -104,11 +138,42 @@ vec3 CalcDirLight( DirLight light, vec3 normal, vec3 viewDir )
     // Combine results
     vec3 ambient = light.ambient * vec3( texture( material.diffuse, TexCoords ) );
     vec3 diffuse = light.diffuse * diff * vec3( texture( material.diffuse, TexCoords ) );
-    vec3 specular = light.specular * spec * vec3( texture( material.specular, TexCoords ) );
+    vec3 specular = light.specular * spec * SpecularColor( );
     
     return ( ambient + diffuse + specular );
 }
 
+// Specular color of the material. Without a specular map the diffuse texture stands in (material.specular
+// used to be left on unit 0, which holds the diffuse texture).
+vec3 SpecularColor( )
+{
+#ifdef SPECULAR_MAP
+    return vec3( texture( material.specular, TexCoords ) );
+#else
+    return vec3( texture( material.diffuse, TexCoords ) );
+#endif
+}
+
+// Reads a point light from the buffer texture.
+PointLight FetchPointLight( int index )
+{
+    vec4 row0 = texelFetch( pointLightData, index * 4 );
+    vec4 row1 = texelFetch( pointLightData, index * 4 + 1 );
+    vec4 row2 = texelFetch( pointLightData, index * 4 + 2 );
+    vec4 row3 = texelFetch( pointLightData, index * 4 + 3 );
+    
+    PointLight light;
+    light.position = row0.xyz;
+    light.constant = row0.w;
+    light.ambient = row1.xyz;
+    light.linear = row1.w;
+    light.diffuse = row2.xyz;
+    light.quadratic = row2.w;
+    light.specular = row3.xyz;
+    
+    return light;
+}
+
 // Calculates the color when using a point light.
 vec3 CalcPointLight( PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir )
 {
@@ -128,7 +193,7 @@ vec3 CalcPointLight( PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir )
     // Combine results
     vec3 ambient = light.ambient * vec3( texture( material.diffuse, TexCoords ) );
     vec3 diffuse = light.diffuse * diff * vec3( texture( material.diffuse, TexCoords ) );
-    vec3 specular = light.specular * spec * vec3( texture( material.specular, TexCoords ) );
+    vec3 specular = light.specular * spec * SpecularColor( );
     
     ambient *= attenuation;
     diffuse *= attenuation;
@@ -161,7 +226,7 @@ vec3 CalcSpotLight( SpotLight light, vec3 normal, vec3 fragPos, vec3 viewDir )
     // Combine results
     vec3 ambient = light.ambient * vec3( texture( material.diffuse, TexCoords ) );
     vec3 diffuse = light.diffuse * diff * vec3( texture( material.diffuse, TexCoords ) );
-    vec3 specular = light.specular * spec * vec3( texture( material.specular, TexCoords ) );
+    vec3 specular = light.specular * spec * SpecularColor( );
     
     ambient *= attenuation * intensity;
     diffuse *= attenuation * intensity;
@@ -7,7 +7,12 @@ out vec3 Normal;
 out vec3 FragPos;
 out vec2 TexCoords;
 
+// Must match Shader/depth.vs bit for bit, the shaded pass tests with GL_EQUAL after the depth pre-pass
+invariant gl_Position;
+
 uniform mat4 model;
+// transpose(inverse(mat3(model))), computed once per object on the CPU
+uniform mat3 normalMatrix;
 uniform mat4 view;
 uniform mat4 projection;
 
@@ -15,6 +20,6 @@ void main()
 {
     gl_Position = projection * view *  model * vec4(position, 1.0f);
     FragPos = vec3(model * vec4(position, 1.0f));
-    Normal = mat3(transpose(inverse(model))) * normal;
+    Normal = normalMatrix * normal;
     TexCoords = texCoords;
 }
\ No newline at end of file
@@ -0,0 +1,26 @@
+#version 330 core
+layout (location = 0) in vec3 position;
+layout (location = 1) in vec3 normal;
+layout (location = 2) in vec2 texCoords;
+// Per-instance model matrix (locations 3 to 6, one column each)
+layout (location = 3) in mat4 instanceModel;
+// Per-instance normal matrix computed on the CPU (locations 7 to 9)
+layout (location = 7) in mat3 instanceNormal;
+
+out vec3 Normal;
+out vec3 FragPos;
+out vec2 TexCoords;
+
+// Must match Shader/depth_instanced.vs bit for bit, the shaded pass tests with GL_EQUAL after the depth pre-pass
+invariant gl_Position;
+
+uniform mat4 view;
+uniform mat4 projection;
+
+void main()
+{
+    gl_Position = projection * view * instanceModel * vec4(position, 1.0f);
+    FragPos = vec3(instanceModel * vec4(position, 1.0f));
+    Normal = instanceNormal * normal;
+    TexCoords = texCoords;
+}
\ No newline at end of file
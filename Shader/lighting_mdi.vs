@@ -0,0 +1,46 @@
+#version 430 core
+#extension GL_ARB_shader_draw_parameters : require
+layout (location = 0) in vec3 position;
+layout (location = 1) in vec3 normal;
+layout (location = 2) in vec2 texCoords;
+
+out vec3 Normal;
+out vec3 FragPos;
+out vec2 TexCoords;
+
+// Must match the depth pre-pass shaders bit for bit, the shaded pass tests with GL_EQUAL
+invariant gl_Position;
+
+// Every instance of the frame (the arena's instance stream), see InstanceData
+struct Instance
+{
+    mat4 model;
+    vec4 normal[3];
+};
+
+layout (std430, binding = 0) buffer Transforms
+{
+    Instance transforms[];
+};
+
+// First matrix of each indirect command
+layout (std430, binding = 1) buffer DrawData
+{
+    uint firstTransform[];
+};
+
+// Index of the first command of the current multi-draw, gl_DrawIDARB restarts at 0 on each one
+uniform uint drawOffset;
+
+uniform mat4 view;
+uniform mat4 projection;
+
+void main()
+{
+    Instance instance = transforms[firstTransform[drawOffset + uint(gl_DrawIDARB)] + uint(gl_InstanceID)];
+    mat4 model = instance.model;
+    gl_Position = projection * view * model * vec4(position, 1.0f);
+    FragPos = vec3(model * vec4(position, 1.0f));
+    Normal = mat3(instance.normal[0].xyz, instance.normal[1].xyz, instance.normal[2].xyz) * normal;
+    TexCoords = texCoords;
+}
\ No newline at end of file
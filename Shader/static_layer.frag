@@ -0,0 +1,15 @@
+#version 330 core
+out vec4 color;
+
+// Snapshot of the static layer, same size as the framebuffer
+uniform sampler2D layerColor;
+uniform sampler2D layerDepth;
+
+void main()
+{
+    // One texel per pixel: fetch, no filtering
+    ivec2 texel = ivec2(gl_FragCoord.xy);
+    color = texelFetch(layerColor, texel, 0);
+    // The dynamic objects are depth tested against the static ones as if they had been drawn together
+    gl_FragDepth = texelFetch(layerDepth, texel, 0).r;
+}
\ No newline at end of file
@@ -0,0 +1,201 @@
+#pragma once
+
+// Std. Includes
+#include <string>
+#include <vector>
+#include <map>
+#include <chrono>
+#include <ctime>
+#include <iostream>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+// GL Includes
+#include <GL/glew.h>
+
+#include "Shader.h"
+#include "GLState.h"
+
+// How often the source files are checked for edits
+const double SHADER_LIBRARY_POLL_SECONDS = 0.5;
+
+// Owner of every program of the scene. Load() only submits the build (see Shader's deferred constructor), so
+// all programs compile side by side when the driver supports KHR_parallel_shader_compile, and a program is
+// waited on the first time it is used. Shaders live until the library is destroyed and never move.
+// Update(), once per frame, watches the source files: an edited pair is resubmitted in the background and the
+// new program replaces the old one only once it is ready and linked. A build that fails keeps the old one live.
+class ShaderLibrary
+{
+public:
+	ShaderLibrary() : lastPoll(std::chrono::steady_clock::now())
+	{
+	}
+
+	~ShaderLibrary()
+	{
+		for (GLuint i = 0; i < this->entries.size(); i++)
+		{
+			delete this->entries[i].reload;
+			delete this->entries[i].shader;
+		}
+	}
+
+	// The program built from these files and defines. Loading the same combination twice returns the same Shader.
+	Shader &Load(const GLchar *vertexPath, const GLchar *fragmentPath, const std::string &defines = std::string())
+	{
+		for (GLuint i = 0; i < this->entries.size(); i++)
+		{
+			Entry &entry = this->entries[i];
+
+			if (entry.vertexPath == vertexPath && entry.fragmentPath == fragmentPath && entry.defines == defines)
+			{
+				return *entry.shader;
+			}
+		}
+
+		Entry entry;
+		entry.vertexPath = vertexPath;
+		entry.fragmentPath = fragmentPath;
+		entry.defines = defines;
+		entry.shader = new Shader(vertexPath, fragmentPath, defines, true);
+		entry.reload = NULL;
+		this->entries.push_back(entry);
+
+		this->watch(entry.vertexPath);
+		this->watch(entry.fragmentPath);
+
+		return *entry.shader;
+	}
+
+	// Starts rebuilding the programs whose files changed and swaps in the ones that finished. Never waits on the
+	// driver unless it lacks KHR_parallel_shader_compile. Returns how many programs were replaced.
+	GLuint Update()
+	{
+		std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+
+		if (std::chrono::duration_cast<std::chrono::milliseconds>(now - this->lastPoll).count() >= SHADER_LIBRARY_POLL_SECONDS * 1000.0)
+		{
+			this->lastPoll = now;
+			this->poll();
+		}
+
+		GLuint swapped = 0;
+
+		for (GLuint i = 0; i < this->entries.size(); i++)
+		{
+			Entry &entry = this->entries[i];
+
+			if (entry.reload == NULL || !entry.reload->IsReady())
+			{
+				continue;
+			}
+
+			Shader *reload = entry.reload;
+			entry.reload = NULL;
+
+			if (!reload->IsLinked())
+			{
+				std::cout << "ERROR::SHADER_LIBRARY::RELOAD_FAILED " << entry.vertexPath << " + " << entry.fragmentPath << ", keeping the previous program" << std::endl;
+				reload->Discard();
+				delete reload;
+				continue;
+			}
+
+			// The shadow mustn't keep a name that is about to be deleted, GL may hand it out again
+			if (GetGLState().GetProgram() == entry.shader->Program)
+			{
+				GetGLState().UseProgram(0);
+			}
+
+			entry.shader->ReplaceProgram(*reload);
+			reload->Discard();
+			delete reload;
+			swapped++;
+
+			std::cout << "Reloaded " << entry.vertexPath << " + " << entry.fragmentPath << std::endl;
+		}
+
+		return swapped;
+	}
+
+	GLuint GetProgramCount() const
+	{
+		return (GLuint)this->entries.size();
+	}
+
+private:
+	struct Entry
+	{
+		std::string vertexPath, fragmentPath, defines;
+		Shader *shader;
+		Shader *reload;		// Rebuild in flight, NULL when there is none
+	};
+
+	std::vector<Entry> entries;
+	std::map<std::string, time_t> modified;	// Last seen modification time of every watched file
+	std::chrono::steady_clock::time_point lastPoll;
+
+	void watch(const std::string &path)
+	{
+		if (this->modified.find(path) == this->modified.end())
+		{
+			this->modified[path] = modificationTime(path);
+		}
+	}
+
+	void poll()
+	{
+		for (std::map<std::string, time_t>::iterator it = this->modified.begin(); it != this->modified.end(); ++it)
+		{
+			time_t time = modificationTime(it->first);
+
+			if (time == 0 || time == it->second)
+			{
+				continue;
+			}
+
+			it->second = time;
+
+			for (GLuint i = 0; i < this->entries.size(); i++)
+			{
+				Entry &entry = this->entries[i];
+
+				if (entry.vertexPath != it->first && entry.fragmentPath != it->first)
+				{
+					continue;
+				}
+
+				// A newer edit supersedes a rebuild that hasn't finished yet
+				if (entry.reload != NULL)
+				{
+					entry.reload->Discard();
+					delete entry.reload;
+				}
+
+				entry.reload = new Shader(entry.vertexPath.c_str(), entry.fragmentPath.c_str(), entry.defines, true);
+			}
+		}
+	}
+
+	// 0 when the file can't be read (e.g. an editor replacing it right now), which is simply skipped
+	static time_t modificationTime(const std::string &path)
+	{
+#ifdef _WIN32
+		struct _stat info;
+
+		if (_stat(path.c_str(), &info) != 0)
+		{
+			return 0;
+		}
+#else
+		struct stat info;
+
+		if (stat(path.c_str(), &info) != 0)
+		{
+			return 0;
+		}
+#endif
+
+		return info.st_mtime;
+	}
+};
\ No newline at end of file
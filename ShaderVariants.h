@@ -0,0 +1,190 @@
+#pragma once
+
+// Std. Includes
+#include <string>
+#include <functional>
+
+// GL Includes
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include "Shader.h"
+#include "ShaderLibrary.h"
+#include "LightRig.h"
+
+// Optional parts of Shader/lighting.frag. Each bit becomes a #define of the same name (without the prefix)
+// when a variant is compiled; a variant without a bit has that code compiled out.
+enum ShaderFeature
+{
+	SHADER_DIR_LIGHT = 1 << 0,		// Directional light
+	SHADER_SPOT_LIGHT = 1 << 1,		// Camera spot light
+	SHADER_POINT_LIGHTS = 1 << 2,	// Clustered point light loop
+	SHADER_SPECULAR_MAP = 1 << 3,	// Material has its own specular texture, otherwise the diffuse one stands in
+	SHADER_ALPHA_DISCARD = 1 << 4	// Fragments with alpha below 0.1 are discarded
+};
+
+const GLuint SHADER_FEATURE_COUNT = 5;
+const GLuint SHADER_VARIANT_COUNT = 1 << SHADER_FEATURE_COUNT;
+const GLuint SHADER_ALL_FEATURES = SHADER_VARIANT_COUNT - 1;
+
+// Features that come from the lights rather than from the material
+const GLuint SHADER_LIGHT_FEATURES = SHADER_DIR_LIGHT | SHADER_SPOT_LIGHT | SHADER_POINT_LIGHTS;
+
+// Light features the rig actually needs: a light whose colors are all zero adds nothing and is left out
+inline GLuint ActiveLightFeatures(const LightRig &rig)
+{
+	const LightBlock &block = rig.GetBlock();
+	GLuint features = 0;
+
+	if (block.dirLight.ambient != glm::vec3(0.0f) || block.dirLight.diffuse != glm::vec3(0.0f) || block.dirLight.specular != glm::vec3(0.0f))
+	{
+		features |= SHADER_DIR_LIGHT;
+	}
+
+	if (block.spotLight.ambient != glm::vec3(0.0f) || block.spotLight.diffuse != glm::vec3(0.0f) || block.spotLight.specular != glm::vec3(0.0f))
+	{
+		features |= SHADER_SPOT_LIGHT;
+	}
+
+	if (rig.GetPointLightCount() > 0)
+	{
+		features |= SHADER_POINT_LIGHTS;
+	}
+
+	return features;
+}
+
+// Every feature combination of one vertex/fragment pair. A variant is submitted to the library the first time
+// it is asked for (or ahead of time through Submit) and owned by it from then on. The per-frame camera uniforms
+// are set on every built variant by SetFrameUniforms, and on variants built or reloaded later as soon as they link.
+class ShaderVariants
+{
+public:
+	ShaderVariants(ShaderLibrary &library, const GLchar *vertexPath, const GLchar *fragmentPath) : library(library), vertexPath(vertexPath),
+		fragmentPath(fragmentPath), compiledCount(0), view(1.0f), projection(1.0f), viewPosition(0.0f)
+	{
+		for (GLuint i = 0; i < SHADER_VARIANT_COUNT; i++)
+		{
+			this->variants[i] = NULL;
+			this->built[i] = false;
+		}
+	}
+
+	// Runs on every new variant right after linking, and again after a reload (uniform block bindings, sampler units...).
+	// Set it before the first variant is requested.
+	void SetSetup(const std::function<void(Shader &)> &setup)
+	{
+		this->setup = setup;
+	}
+
+	// The variant with exactly these features, submitted now if this is its first use
+	Shader &Get(GLuint features)
+	{
+		features &= SHADER_ALL_FEATURES;
+
+		if (this->variants[features] == NULL)
+		{
+			this->compile(features);
+		}
+
+		return *this->variants[features];
+	}
+
+	// Hands a variant to the driver ahead of its first draw without waiting for it
+	void Submit(GLuint features)
+	{
+		this->Get(features);
+	}
+
+	// view, projection and viewPos for every variant, compiled or not yet
+	void SetFrameUniforms(const glm::mat4 &view, const glm::mat4 &projection, const glm::vec3 &viewPosition)
+	{
+		this->view = view;
+		this->projection = projection;
+		this->viewPosition = viewPosition;
+
+		for (GLuint i = 0; i < SHADER_VARIANT_COUNT; i++)
+		{
+			// A build still in flight gets them from its link callback
+			if (this->variants[i] != NULL && !this->variants[i]->IsPending())
+			{
+				this->applyFrameUniforms(i);
+			}
+		}
+	}
+
+	// Variants that have linked at least once; a build still in flight or one that failed doesn't count
+	GLuint GetCompiledCount() const
+	{
+		return this->compiledCount;
+	}
+
+	// "#define NAME\n" for every feature bit, in the order of ShaderFeature
+	static std::string MakeDefines(GLuint features)
+	{
+		static const char *NAMES[SHADER_FEATURE_COUNT] = { "DIR_LIGHT", "SPOT_LIGHT", "POINT_LIGHTS", "SPECULAR_MAP", "ALPHA_DISCARD" };
+		std::string defines;
+
+		for (GLuint i = 0; i < SHADER_FEATURE_COUNT; i++)
+		{
+			if (features & (1 << i))
+			{
+				defines += std::string("#define ") + NAMES[i] + "\n";
+			}
+		}
+
+		return defines;
+	}
+
+private:
+	ShaderLibrary &library;
+	std::string vertexPath, fragmentPath;
+	Shader *variants[SHADER_VARIANT_COUNT];
+	bool built[SHADER_VARIANT_COUNT];	// Linked once, so reloads aren't counted again
+	GLuint compiledCount;
+	std::function<void(Shader &)> setup;
+
+	// Locations of the frame uniforms, per variant
+	GLint viewLocations[SHADER_VARIANT_COUNT];
+	GLint projectionLocations[SHADER_VARIANT_COUNT];
+	GLint viewPositionLocations[SHADER_VARIANT_COUNT];
+
+	glm::mat4 view, projection;
+	glm::vec3 viewPosition;
+
+	void compile(GLuint features)
+	{
+		Shader &shader = this->library.Load(this->vertexPath.c_str(), this->fragmentPath.c_str(), MakeDefines(features));
+		this->variants[features] = &shader;
+
+		// Locations change with every new program, so they are looked up again on each link
+		shader.SetLinkCallback([this, features](Shader &linked)
+		{
+			if (!this->built[features])
+			{
+				this->built[features] = true;
+				this->compiledCount++;
+			}
+
+			this->viewLocations[features] = linked.GetUniformLocation("view");
+			this->projectionLocations[features] = linked.GetUniformLocation("projection");
+			this->viewPositionLocations[features] = linked.GetUniformLocation("viewPos");
+
+			if (this->setup)
+			{
+				this->setup(linked);
+			}
+
+			this->applyFrameUniforms(features);
+		});
+	}
+
+	void applyFrameUniforms(GLuint features)
+	{
+		Shader &shader = *this->variants[features];
+		shader.Use();
+		shader.SetMat4(this->viewLocations[features], this->view);
+		shader.SetMat4(this->projectionLocations[features], this->projection);
+		shader.SetVec3(this->viewPositionLocations[features], this->viewPosition);
+	}
+};
\ No newline at end of file
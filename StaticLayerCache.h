@@ -0,0 +1,154 @@
+#pragma once
+
+// Std. Includes
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+
+// GL Includes
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include "Shader.h"
+#include "GLState.h"
+#include "RenderStats.h"
+
+// Units the composite pass samples the snapshot from
+const GLuint STATIC_LAYER_COLOR_UNIT = 0;
+const GLuint STATIC_LAYER_DEPTH_UNIT = 1;
+
+// Snapshot of the geometry that doesn't move (board and pieces), color and depth, for one camera pose.
+// Usage per frame:
+//   if (!cache.IsValid(view, projection, lightsVersion)) { cache.Begin(); draw the static set; cache.End(view, projection, lightsVersion, target); }
+//   cache.Composite(shader);   // into target, then draw the dynamic objects normally
+// Composite writes the snapshot's color and depth (gl_FragDepth), so the dynamic objects are depth tested against
+// the static ones exactly as if everything had been drawn together. Any change to the view, the projection or the
+// lights (LightRig::GetVersion) makes the snapshot stale; Invalidate() covers everything else (shader reloads...).
+class StaticLayerCache
+{
+public:
+	StaticLayerCache() : framebuffer(0), colorTexture(0), depthTexture(0), emptyVAO(0), width(0), height(0), valid(false), lightsVersion(0),
+		rebuilds(0), colorLocation(-1), depthLocation(-1), locationsProgram(0), locationsGeneration(0)
+	{
+	}
+
+	bool Init(GLsizei width, GLsizei height)
+	{
+		this->width = width;
+		this->height = height;
+
+		glGenTextures(1, &this->colorTexture);
+		GetGLState().BindTexture(STATIC_LAYER_COLOR_UNIT, this->colorTexture);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+		setNearest();
+
+		glGenTextures(1, &this->depthTexture);
+		GetGLState().BindTexture(STATIC_LAYER_DEPTH_UNIT, this->depthTexture);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, width, height, 0, GL_DEPTH_COMPONENT, GL_UNSIGNED_INT, NULL);
+		setNearest();
+
+		glGenFramebuffers(1, &this->framebuffer);
+		glBindFramebuffer(GL_FRAMEBUFFER, this->framebuffer);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, this->colorTexture, 0);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, this->depthTexture, 0);
+
+		bool complete = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+		if (!complete)
+		{
+			std::cout << "ERROR::STATIC_LAYER::FRAMEBUFFER_INCOMPLETE" << std::endl;
+			return false;
+		}
+
+		// The composite triangle comes from gl_VertexID, but core profile still wants a VAO bound
+		glGenVertexArrays(1, &this->emptyVAO);
+
+		return true;
+	}
+
+	bool IsValid(const glm::mat4 &view, const glm::mat4 &projection, uint64_t lightsVersion) const
+	{
+		return this->valid && this->lightsVersion == lightsVersion && memcmp(&this->view, &view, sizeof(view)) == 0
+			&& memcmp(&this->projection, &projection, sizeof(projection)) == 0;
+	}
+
+	void Invalidate()
+	{
+		this->valid = false;
+	}
+
+	// Binds the snapshot framebuffer and clears it; the static set is drawn next
+	void Begin()
+	{
+		glBindFramebuffer(GL_FRAMEBUFFER, this->framebuffer);
+		GetGLState().DepthMask(true);
+		GetGLState().ColorMask(true);
+		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+	}
+
+	// Records the pose the snapshot belongs to and goes back to target (0 for the window)
+	void End(const glm::mat4 &view, const glm::mat4 &projection, uint64_t lightsVersion, GLuint target)
+	{
+		this->view = view;
+		this->projection = projection;
+		this->lightsVersion = lightsVersion;
+		this->valid = true;
+		this->rebuilds++;
+
+		glBindFramebuffer(GL_FRAMEBUFFER, target);
+	}
+
+	// Writes the snapshot's color and depth over the whole bound framebuffer
+	void Composite(Shader &shader)
+	{
+		shader.Use();
+
+		if (this->locationsProgram != shader.Program || this->locationsGeneration != shader.GetGeneration())
+		{
+			// Looked up again after a reload, even one that reused the program name
+			this->colorLocation = shader.GetUniformLocation("layerColor");
+			this->depthLocation = shader.GetUniformLocation("layerDepth");
+			this->locationsProgram = shader.Program;
+			this->locationsGeneration = shader.GetGeneration();
+		}
+
+		shader.SetInt(this->colorLocation, STATIC_LAYER_COLOR_UNIT);
+		shader.SetInt(this->depthLocation, STATIC_LAYER_DEPTH_UNIT);
+		GetGLState().BindTexture(STATIC_LAYER_COLOR_UNIT, this->colorTexture);
+		GetGLState().BindTexture(STATIC_LAYER_DEPTH_UNIT, this->depthTexture);
+
+		GetGLState().DepthFunc(GL_ALWAYS);
+		GetGLState().DepthMask(true);
+		GetGLState().BindVertexArray(this->emptyVAO);
+		glDrawArrays(GL_TRIANGLES, 0, 3);
+		CountDraw(3);
+		GetGLState().DepthFunc(GL_LESS);
+	}
+
+	// Times the snapshot was redrawn since start
+	GLuint GetRebuildCount() const
+	{
+		return this->rebuilds;
+	}
+
+private:
+	GLuint framebuffer, colorTexture, depthTexture, emptyVAO;
+	GLsizei width, height;
+
+	bool valid;
+	glm::mat4 view, projection;
+	uint64_t lightsVersion;
+	GLuint rebuilds;
+
+	GLint colorLocation, depthLocation;
+	GLuint locationsProgram, locationsGeneration;
+
+	static void setNearest()
+	{
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	}
+};
\ No newline at end of file
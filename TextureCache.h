@@ -0,0 +1,301 @@
+#pragma once
+
+// Std. Includes
+#include <string>
+#include <vector>
+#include <iostream>
+#include <algorithm>
+#include <unordered_map>
+#include <cctype>
+#include <cstdint>
+
+// GL Includes
+#include <GL/glew.h>
+
+#include "Fnv1a.h"
+#include "GLState.h"
+
+// Per-run counters
+struct TextureCacheStats
+{
+	GLuint misses;			// Files loaded
+	GLuint hits;			// Requests answered with a texture already loaded, by path or by content
+	GLuint contentHits;		// Of those, a different path to a file with the same bytes
+	uint64_t bytesSaved;	// Texture memory (mipmaps included) the hits would have uploaded again
+	GLuint textures;		// Live textures
+};
+
+// Every texture loaded from a file, shared by the whole process. A request is first looked up by canonical path
+// (separators unified, "." and ".." resolved, case folded on Windows); an unknown path has its file hashed
+// (64 bit FNV-1a, like the mesh and program caches) and is looked up by content, so a copy of a skin in another
+// model's folder is still a hit and becomes an alias of the first path. Only when both miss is the file loaded.
+// Acquire() and AddRef() take a reference, Release() gives it back; the texture is deleted with the last one, so
+// references must be released while the context is current. TextureHandle does it automatically.
+class TextureCache
+{
+public:
+	// Creates the texture for a file, e.g. TextureStreamer::Request. Called on a miss only.
+	typedef GLuint(*Loader)(const std::string &path);
+
+	TextureCache() : releasedBytesSaved(0)
+	{
+		this->stats.misses = 0;
+		this->stats.hits = 0;
+		this->stats.contentHits = 0;
+		this->stats.bytesSaved = 0;
+		this->stats.textures = 0;
+	}
+
+	// Needs the GL context. Returns the texture for path, loading it with load when neither the path nor its
+	// content is known yet, and takes a reference to it.
+	GLuint Acquire(const std::string &path, Loader load)
+	{
+		std::string key = canonical(path);
+		std::unordered_map<std::string, GLuint>::iterator byPath = this->paths.find(key);
+
+		if (byPath != this->paths.end())
+		{
+			this->hit(this->entries[byPath->second]);
+
+			return byPath->second;
+		}
+
+		uint64_t hash = 0, size = 0;
+		bool hashed = Fnv1aFile(path, hash, size);
+
+		if (hashed)
+		{
+			std::unordered_map<uint64_t, GLuint>::iterator byContent = this->contents.find(hash);
+
+			if (byContent != this->contents.end() && this->entries[byContent->second].fileSize == size)
+			{
+				Entry &entry = this->entries[byContent->second];
+				entry.paths.push_back(key);
+				this->paths[key] = byContent->second;
+				this->stats.contentHits++;
+				this->hit(entry);
+
+				return byContent->second;
+			}
+		}
+
+		GLuint texture = load(path);
+
+		Entry entry;
+		entry.paths.push_back(key);
+		entry.hash = hash;
+		entry.hashed = hashed;
+		entry.fileSize = size;
+		entry.references = 1;
+		entry.hits = 0;
+
+		this->entries[texture] = entry;
+		this->paths[key] = texture;
+
+		if (hashed)
+		{
+			this->contents[hash] = texture;
+		}
+
+		this->stats.misses++;
+
+		return texture;
+	}
+
+	// Another reference to a texture the cache handed out. Textures it doesn't know are ignored.
+	void AddRef(GLuint texture)
+	{
+		std::unordered_map<GLuint, Entry>::iterator found = this->entries.find(texture);
+
+		if (found != this->entries.end())
+		{
+			found->second.references++;
+		}
+	}
+
+	// Needs the GL context. The last reference deletes the texture and forgets its paths and content.
+	void Release(GLuint texture)
+	{
+		std::unordered_map<GLuint, Entry>::iterator found = this->entries.find(texture);
+
+		if (found == this->entries.end() || --found->second.references > 0)
+		{
+			return;
+		}
+
+		Entry &entry = found->second;
+		this->releasedBytesSaved += entry.hits * residentBytes(texture);
+
+		for (GLuint i = 0; i < entry.paths.size(); i++)
+		{
+			this->paths.erase(entry.paths[i]);
+		}
+
+		if (entry.hashed)
+		{
+			this->contents.erase(entry.hash);
+		}
+
+		this->entries.erase(found);
+		GetGLState().DeleteTexture(texture);
+	}
+
+	// Needs the GL context: bytesSaved is measured on the textures themselves, so it only counts what has already
+	// become resident (a texture still streaming in is a 1x1 placeholder).
+	const TextureCacheStats &GetStats()
+	{
+		this->stats.bytesSaved = this->releasedBytesSaved;
+
+		for (std::unordered_map<GLuint, Entry>::const_iterator i = this->entries.begin(); i != this->entries.end(); ++i)
+		{
+			this->stats.bytesSaved += i->second.hits * residentBytes(i->first);
+		}
+
+		this->stats.textures = (GLuint)this->entries.size();
+
+		return this->stats;
+	}
+
+private:
+	struct Entry
+	{
+		std::vector<std::string> paths;	// Canonical paths leading here
+		uint64_t hash;					// FNV-1a of the file, valid when hashed
+		uint64_t fileSize;
+		bool hashed;					// False when the file couldn't be read; then only its path finds it
+		GLuint references;
+		GLuint hits;
+	};
+
+	std::unordered_map<std::string, GLuint> paths;
+	std::unordered_map<uint64_t, GLuint> contents;
+	std::unordered_map<GLuint, Entry> entries;
+	TextureCacheStats stats;
+	uint64_t releasedBytesSaved;	// Saved by textures already deleted
+
+	void hit(Entry &entry)
+	{
+		entry.references++;
+		entry.hits++;
+		this->stats.hits++;
+	}
+
+	static std::string canonical(const std::string &path)
+	{
+		std::vector<std::string> parts;
+		std::string part;
+
+		for (std::string::size_type i = 0; i <= path.size(); i++)
+		{
+			char c = i < path.size() ? path[i] : '/';
+
+			if (c != '/' && c != '\\')
+			{
+#ifdef _WIN32
+				part += (char)tolower((unsigned char)c);
+#else
+				part += c;
+#endif
+				continue;
+			}
+
+			if (part == ".." && !parts.empty() && parts.back() != "..")
+			{
+				parts.pop_back();
+			}
+			else if (!part.empty() && part != ".")
+			{
+				parts.push_back(part);
+			}
+
+			part.clear();
+		}
+
+		std::string result = !path.empty() && (path[0] == '/' || path[0] == '\\') ? "/" : "";
+
+		for (GLuint i = 0; i < parts.size(); i++)
+		{
+			result += (i > 0 ? "/" : "") + parts[i];
+		}
+
+		return result;
+	}
+
+	// Size of an RGB texture and its mipmap chain, from what GL holds now
+	static uint64_t residentBytes(GLuint texture)
+	{
+		GLint width = 0, height = 0;
+		GetGLState().BindTexture(0, texture);
+		glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &width);
+		glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT, &height);
+		GetGLState().BindTexture(0, 0);
+
+		uint64_t bytes = 0;
+
+		while (width > 0 && height > 0)
+		{
+			bytes += (uint64_t)width * height * 3;
+
+			if (width == 1 && height == 1)
+			{
+				break;
+			}
+
+			width = std::max(1, width / 2);
+			height = std::max(1, height / 2);
+		}
+
+		return bytes;
+	}
+
+	TextureCache(const TextureCache &);
+	TextureCache &operator=(const TextureCache &);
+};
+
+inline TextureCache &GetTextureCache()
+{
+	static TextureCache cache;
+
+	return cache;
+}
+
+// One reference to a cached texture, given back when the handle goes away. Copies share the texture.
+class TextureHandle
+{
+public:
+	TextureHandle() : texture(0)
+	{
+	}
+
+	// Adopts a reference the caller already holds, e.g. the one Acquire() returned
+	explicit TextureHandle(GLuint texture) : texture(texture)
+	{
+	}
+
+	TextureHandle(const TextureHandle &other) : texture(other.texture)
+	{
+		GetTextureCache().AddRef(this->texture);
+	}
+
+	TextureHandle &operator=(const TextureHandle &other)
+	{
+		GetTextureCache().AddRef(other.texture);
+		GetTextureCache().Release(this->texture);
+		this->texture = other.texture;
+
+		return *this;
+	}
+
+	~TextureHandle()
+	{
+		GetTextureCache().Release(this->texture);
+	}
+
+	GLuint Get() const
+	{
+		return this->texture;
+	}
+
+private:
+	GLuint texture;
+};
\ No newline at end of file
@@ -0,0 +1,385 @@
+#pragma once
+
+// Std. Includes
+#include <string>
+#include <deque>
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <cstring>
+#include <iostream>
+
+// GL Includes
+#include <GL/glew.h>
+#include "SOIL2/SOIL2.h"
+
+#include "GLState.h"
+#include "RenderStats.h"
+#include "ThreadPool.h"
+
+// Size of the persistently mapped staging ring. An image that doesn't fit whole is uploaded straight from memory.
+const GLsizeiptr TEXTURE_STREAMER_RING_BYTES = 32 * 1024 * 1024;
+// Regions of the ring start on this boundary
+const GLsizeiptr TEXTURE_STREAMER_ALIGNMENT = 16;
+// Pixels sent to GL per Update(), so a burst of finished images spreads over a few frames instead of one long one
+const GLsizeiptr TEXTURE_STREAMER_FRAME_BUDGET = 16 * 1024 * 1024;
+
+// Loads textures in the background. Request() returns a texture name right away, holding a 1x1 grey placeholder;
+// a pool thread decodes the file and copies the pixels into a ring of persistently mapped pixel buffers
+// (GL 4.4 / ARB_buffer_storage). Update(), once per frame on the GL thread, issues glTexSubImage2D from the
+// ring for the images that are ready, builds their mipmaps and puts a fence behind each copy; a region of the
+// ring is only handed out again once its fence has passed, so decoding the next images overlaps the GPU copies.
+// The name never changes, so materials built with the placeholder pick up the real image by themselves.
+// When the ring is full, or without buffer storage, the pixels wait in memory and go through the ring later
+// (or straight from memory).
+class TextureStreamer
+{
+public:
+	TextureStreamer() : buffer(0), mapped(NULL), head(0), nextRegion(0), outstanding(0), decoding(0)
+	{
+		// The pool must outlive the streamer, its threads call back into it
+		GetThreadPool();
+	}
+
+	~TextureStreamer()
+	{
+		// Decodes still running write into this object
+		while (this->decoding.load() > 0)
+		{
+			std::this_thread::yield();
+		}
+	}
+
+	// Needs the GL context. path is the file to load, relative to the working directory.
+	GLuint Request(const std::string &path)
+	{
+		this->init();
+
+		GLuint texture;
+		glGenTextures(1, &texture);
+
+		// Placeholder until the image is resident: one grey texel, a complete texture for any min filter
+		const unsigned char grey[3] = { 128, 128, 128 };
+		GetGLState().BindTexture(0, texture);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, 1, 1, 0, GL_RGB, GL_UNSIGNED_BYTE, grey);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		GetGLState().BindTexture(0, 0);
+
+		this->outstanding++;
+		this->decoding++;
+
+		GetThreadPool().Submit([this, path, texture]() { this->decode(path, texture); });
+
+		return texture;
+	}
+
+	// Uploads the images that finished decoding, within TEXTURE_STREAMER_FRAME_BUDGET. Returns how many textures
+	// became resident, so whatever was drawn with their placeholders can be drawn again.
+	GLuint Update()
+	{
+		return this->upload(TEXTURE_STREAMER_FRAME_BUDGET);
+	}
+
+	// Blocks until every requested texture is resident (e.g. before a benchmark)
+	void Finish()
+	{
+		while (this->outstanding > 0)
+		{
+			if (this->upload(0) == 0)
+			{
+				std::this_thread::yield();
+			}
+		}
+	}
+
+	// Nothing requested is still waiting on a decode or an upload
+	bool IsIdle() const
+	{
+		return this->outstanding == 0;
+	}
+
+	GLuint GetPendingCount() const
+	{
+		return this->outstanding;
+	}
+
+	bool IsPersistent() const
+	{
+		return this->mapped != NULL;
+	}
+
+private:
+	// A decoded image on its way to its texture
+	struct Job
+	{
+		std::string path;
+		GLuint texture;
+		int width, height;
+		unsigned char *pixels;		// From SOIL, NULL once staged in the ring
+		GLint region;				// Index of its region in the ring, -1 while it isn't staged
+	};
+
+	// A span of the ring, in allocation order. The fence is 0 until the copy out of it has been issued.
+	struct Region
+	{
+		GLsizeiptr offset, size;
+		GLsync fence;
+		GLuint id;
+	};
+
+	GLuint buffer;
+	unsigned char *mapped;			// Persistent, coherent mapping of buffer; NULL without buffer storage
+	GLsizeiptr head;				// Next free byte of the ring
+
+	std::mutex mutex;				// Guards regions, nextRegion, head and ready
+	std::deque<Region> regions;
+	GLuint nextRegion;
+	std::vector<Job> ready;			// Decoded, waiting for the GL thread
+	std::deque<Job> queued;			// GL thread only: taken from ready but over the budget
+
+	// Touched by the GL thread only
+	GLuint outstanding;
+	std::atomic<GLuint> decoding;
+
+	void init()
+	{
+		if (this->buffer != 0 || !(GLEW_VERSION_4_4 || GLEW_ARB_buffer_storage))
+		{
+			return;
+		}
+
+		const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+
+		glGenBuffers(1, &this->buffer);
+		GetGLState().BindBuffer(GL_PIXEL_UNPACK_BUFFER, this->buffer);
+		glBufferStorage(GL_PIXEL_UNPACK_BUFFER, TEXTURE_STREAMER_RING_BYTES, NULL, flags);
+		this->mapped = (unsigned char *)glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, TEXTURE_STREAMER_RING_BYTES, flags);
+		// A bound unpack buffer turns every later glTexImage2D pointer into an offset
+		GetGLState().BindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+		if (this->mapped == NULL)
+		{
+			std::cout << "ERROR::TEXTURE_STREAMER::MAP_FAILED, uploading from memory" << std::endl;
+		}
+	}
+
+	// Pool thread
+	void decode(const std::string &path, GLuint texture)
+	{
+		Job job;
+		job.path = path;
+		job.texture = texture;
+		job.width = 0;
+		job.height = 0;
+		job.pixels = SOIL_load_image(path.c_str(), &job.width, &job.height, 0, SOIL_LOAD_RGB);
+		job.region = -1;
+
+		// Straight into the ring when there is room; otherwise the GL thread stages it once regions retire
+		this->stage(job);
+
+		{
+			std::lock_guard<std::mutex> lock(this->mutex);
+			this->ready.push_back(job);
+		}
+
+		this->decoding--;
+	}
+
+	// Copies the pixels into a free region of the ring. Any thread; the memcpy happens outside the lock.
+	bool stage(Job &job)
+	{
+		if (this->mapped == NULL || job.pixels == NULL)
+		{
+			return false;
+		}
+
+		GLsizeiptr size = (GLsizeiptr)job.width * job.height * 3;
+		GLsizeiptr offset = 0;
+
+		{
+			std::lock_guard<std::mutex> lock(this->mutex);
+
+			if (!this->allocate(size, offset))
+			{
+				return false;
+			}
+
+			Region region = { offset, size, 0, this->nextRegion++ };
+			this->regions.push_back(region);
+			job.region = (GLint)region.id;
+		}
+
+		memcpy(this->mapped + offset, job.pixels, (size_t)size);
+		SOIL_free_image_data(job.pixels);
+		job.pixels = NULL;
+
+		return true;
+	}
+
+	// Ring allocation, mutex held. In-use bytes run from the oldest region to head, possibly wrapping once.
+	bool allocate(GLsizeiptr size, GLsizeiptr &offset)
+	{
+		size = (size + TEXTURE_STREAMER_ALIGNMENT - 1) & ~(TEXTURE_STREAMER_ALIGNMENT - 1);
+
+		if (size > TEXTURE_STREAMER_RING_BYTES)
+		{
+			return false;
+		}
+
+		if (this->regions.empty())
+		{
+			this->head = 0;
+		}
+
+		GLsizeiptr tail = this->regions.empty() ? 0 : this->regions.front().offset;
+
+		if (this->regions.empty() || this->head > tail)
+		{
+			// Free space is [head, end) and [0, tail)
+			if (this->head + size <= TEXTURE_STREAMER_RING_BYTES)
+			{
+				offset = this->head;
+			}
+			else if (size < tail)
+			{
+				offset = 0;
+			}
+			else
+			{
+				return false;
+			}
+		}
+		else if (this->head + size < tail)
+		{
+			// Already wrapped: free space is [head, tail)
+			offset = this->head;
+		}
+		else
+		{
+			return false;
+		}
+
+		this->head = offset + size;
+
+		return true;
+	}
+
+	// Frees the regions, oldest first, whose copies the GPU has finished. GL thread, mutex held.
+	void retire()
+	{
+		while (!this->regions.empty() && this->regions.front().fence != 0)
+		{
+			GLenum status = glClientWaitSync(this->regions.front().fence, 0, 0);
+
+			if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+			{
+				break;
+			}
+
+			glDeleteSync(this->regions.front().fence);
+			this->regions.pop_front();
+		}
+	}
+
+	GLuint upload(GLsizeiptr budget)
+	{
+		{
+			std::lock_guard<std::mutex> lock(this->mutex);
+			this->retire();
+			this->queued.insert(this->queued.end(), this->ready.begin(), this->ready.end());
+			this->ready.clear();
+		}
+
+		GLuint resident = 0;
+		GLsizeiptr sent = 0;
+
+		while (!this->queued.empty() && (budget == 0 || sent < budget))
+		{
+			Job &job = this->queued.front();
+
+			if (job.pixels == NULL && job.region < 0)
+			{
+				std::cout << "ERROR::TEXTURE_STREAMER::DECODE_FAILED " << job.path << std::endl;
+			}
+			else
+			{
+				// Decoded while the ring was full: try again now that regions may have retired
+				if (job.region < 0)
+				{
+					this->stage(job);
+				}
+
+				this->send(job);
+				sent += (GLsizeiptr)job.width * job.height * 3;
+				resident++;
+			}
+
+			this->outstanding--;
+			this->queued.pop_front();
+		}
+
+		return resident;
+	}
+
+	// Gives the texture its real storage, copies the pixels from the ring (or memory) and builds the mipmaps
+	void send(Job &job)
+	{
+		GetGLState().BindTexture(0, job.texture);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+		if (job.region >= 0)
+		{
+			std::lock_guard<std::mutex> lock(this->mutex);
+			Region *region = this->findRegion((GLuint)job.region);
+
+			glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, job.width, job.height, 0, GL_RGB, GL_UNSIGNED_BYTE, NULL);
+			GetGLState().BindBuffer(GL_PIXEL_UNPACK_BUFFER, this->buffer);
+			glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, job.width, job.height, GL_RGB, GL_UNSIGNED_BYTE, (GLvoid *)region->offset);
+			GetGLState().BindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+			// The region is reused once the GPU has read it
+			region->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		}
+		else
+		{
+			glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, job.width, job.height, 0, GL_RGB, GL_UNSIGNED_BYTE, job.pixels);
+			SOIL_free_image_data(job.pixels);
+			job.pixels = NULL;
+		}
+
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+		CountUpload((size_t)job.width * job.height * 3);
+		glGenerateMipmap(GL_TEXTURE_2D);
+		GetGLState().BindTexture(0, 0);
+	}
+
+	// Mutex held
+	Region *findRegion(GLuint id)
+	{
+		for (GLuint i = 0; i < this->regions.size(); i++)
+		{
+			if (this->regions[i].id == id)
+			{
+				return &this->regions[i];
+			}
+		}
+
+		return NULL;
+	}
+
+	TextureStreamer(const TextureStreamer &);
+	TextureStreamer &operator=(const TextureStreamer &);
+};
+
+inline TextureStreamer &GetTextureStreamer()
+{
+	static TextureStreamer streamer;
+
+	return streamer;
+}
\ No newline at end of file
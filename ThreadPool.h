@@ -0,0 +1,118 @@
+#pragma once
+
+// Std. Includes
+#include <vector>
+#include <queue>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+#include <algorithm>
+#include <type_traits>
+
+// GL Includes
+#include <GL/glew.h>
+
+// Fixed set of worker threads taking tasks in the order they were submitted. Tasks must not call GL: only the
+// thread that owns the context may, so the usual split is decoding/parsing here and uploading on the main thread.
+// Submit() returns a future with the task's result; an exception thrown by the task comes out of future.get().
+class ThreadPool
+{
+public:
+	// 0 threads: one per core, minus the main thread
+	explicit ThreadPool(GLuint threads = 0) : stopping(false)
+	{
+		if (threads == 0)
+		{
+			GLuint cores = std::thread::hardware_concurrency();
+			threads = std::max(1u, cores > 1 ? cores - 1 : 1u);
+		}
+
+		for (GLuint i = 0; i < threads; i++)
+		{
+			this->workers.push_back(std::thread(&ThreadPool::work, this));
+		}
+	}
+
+	// Runs what is still queued, then joins
+	~ThreadPool()
+	{
+		{
+			std::lock_guard<std::mutex> lock(this->mutex);
+			this->stopping = true;
+		}
+
+		this->wake.notify_all();
+
+		for (GLuint i = 0; i < this->workers.size(); i++)
+		{
+			this->workers[i].join();
+		}
+	}
+
+	template <class Task>
+	std::future<typename std::result_of<Task()>::type> Submit(Task task)
+	{
+		typedef typename std::result_of<Task()>::type Result;
+
+		// packaged_task can only be moved, std::function wants something it can copy
+		std::shared_ptr<std::packaged_task<Result()> > packaged = std::make_shared<std::packaged_task<Result()> >(task);
+		std::future<Result> result = packaged->get_future();
+
+		{
+			std::lock_guard<std::mutex> lock(this->mutex);
+			this->tasks.push([packaged]() { (*packaged)(); });
+		}
+
+		this->wake.notify_one();
+
+		return result;
+	}
+
+	GLuint GetThreadCount() const
+	{
+		return (GLuint)this->workers.size();
+	}
+
+private:
+	std::vector<std::thread> workers;
+	std::queue<std::function<void()> > tasks;
+	std::mutex mutex;
+	std::condition_variable wake;
+	bool stopping;
+
+	void work()
+	{
+		for (;;)
+		{
+			std::function<void()> task;
+
+			{
+				std::unique_lock<std::mutex> lock(this->mutex);
+				this->wake.wait(lock, [this]() { return this->stopping || !this->tasks.empty(); });
+
+				if (this->tasks.empty())
+				{
+					return;
+				}
+
+				task = std::move(this->tasks.front());
+				this->tasks.pop();
+			}
+
+			task();
+		}
+	}
+
+	ThreadPool(const ThreadPool &);
+	ThreadPool &operator=(const ThreadPool &);
+};
+
+inline ThreadPool &GetThreadPool()
+{
+	static ThreadPool pool;
+
+	return pool;
+}
\ No newline at end of file
@@ -0,0 +1,36 @@
+#pragma once
+
+// Std. Includes
+#include <cmath>
+
+// GL Includes
+#include <glm/glm.hpp>
+
+// Relative tolerance of the rigid-transform test; model matrices built from translate/rotate/scale with a
+// single scale factor stay well inside it
+const float NORMAL_MATRIX_EPSILON = 1e-4f;
+
+// Matrix that takes model space normals to world space, computed once per object instead of per vertex.
+// Rotations with a uniform (or no) scale keep the upper 3x3 orthogonal, and its inverse transpose is then the
+// same matrix up to a scale factor; lighting.frag normalizes the normal anyway, so that case skips the inverse.
+// Everything else (non-uniform scale, shear) pays a 3x3 inverse.
+inline glm::mat3 ComputeNormalMatrix(const glm::mat4 &model)
+{
+	glm::mat3 linear(model);
+
+	float lengthX = glm::dot(linear[0], linear[0]);
+	float lengthY = glm::dot(linear[1], linear[1]);
+	float lengthZ = glm::dot(linear[2], linear[2]);
+	float tolerance = NORMAL_MATRIX_EPSILON * lengthX;
+
+	bool uniformScale = std::fabs(lengthX - lengthY) <= tolerance && std::fabs(lengthX - lengthZ) <= tolerance;
+	bool orthogonal = std::fabs(glm::dot(linear[0], linear[1])) <= tolerance && std::fabs(glm::dot(linear[0], linear[2])) <= tolerance
+		&& std::fabs(glm::dot(linear[1], linear[2])) <= tolerance;
+
+	if (uniformScale && orthogonal)
+	{
+		return linear;
+	}
+
+	return glm::transpose(glm::inverse(linear));
+}
\ No newline at end of file
@@ -22,33 +22,120 @@
 #include "Shader.h" // Clase para cargar y compilar shaders
 #include "Camera.h" // Clase para controlar la cmara
 #include "Model.h"  // Clase para cargar y dibujar modelos OBJ
+#include "ModelLoader.h" // Carga de varios modelos a la vez: lectura en el pool de hilos, subida a GL en este hilo
+#include "TextureStreamer.h" // Texturas decodificadas en el pool y subidas por PBOs mapeados; gris mientras no llegan
+#include "TextureCache.h" // Una sola textura por archivo (ruta o contenido) para todos los modelos
+#include "LightRig.h" // Buffer uniforme compartido con todas las luces
+#include "LightClusters.h" // Reparto de las luces puntuales en clusters de la vista
+#include "ShaderLibrary.h" // Duea de todos los programas: compilacin en paralelo y recarga al editar Shader/
+#include "ShaderVariants.h" // Variantes de lighting.frag segn las luces activas y el material
+#include "RenderQueue.h" // Cola de render ordenada por estado
+#include "DrawBenchmark.h" // Medicin del costo por llamada de Mesh::Draw
+#include "GpuTimer.h" // Tiempo de GPU de cada pase (GL_TIME_ELAPSED)
+#include "RenderStats.h" // Contadores de GL por frame (llamadas, tringulos, binds, subidas), opcionalmente a CSV
+#include "Profiler.h" // Marcas de tiempo CPU/GPU por fase, exportables a chrome://tracing
+#include "StaticLayerCache.h" // Foto del tablero y las piezas por pose de cmara
+#include "FramePacer.h" // Lmite de fps, intervalo de swap e histograma de tiempos de frame
+#include "Headless.h" // Modo sin ventana para medir el renderer (contexto oculto o EGL + FBO)
 
 // Prototipos de funciones
 void KeyCallback(GLFWwindow* window, int key, int scancode, int action, int mode); // Entrada de teclado
 void MouseCallback(GLFWwindow* window, double xPos, double yPos); // Movimiento del ratn
+void WindowRefreshCallback(GLFWwindow* window); // La ventana necesita volver a dibujarse (expuesta, restaurada...)
+void FramebufferSizeCallback(GLFWwindow* window, int width, int height); // Cambio de tamao
 void DoMovement(); // Mover la cmara segn entrada
 
-//Funcin auxiliar para colocar las luces puntuales
-void SetPointLight(int index, glm::vec3 position, glm::vec3 ambient, glm::vec3 diffuse, glm::vec3 specular,
-	float constant, float linear, float quadratic, GLuint shaderProgram) {
-	std::string base = "pointLights[" + std::to_string(index) + "]";
-	glUniform3f(glGetUniformLocation(shaderProgram, (base + ".position").c_str()), position.x, position.y, position.z);
-	glUniform3f(glGetUniformLocation(shaderProgram, (base + ".ambient").c_str()), ambient.r, ambient.g, ambient.b);
-	glUniform3f(glGetUniformLocation(shaderProgram, (base + ".diffuse").c_str()), diffuse.r, diffuse.g, diffuse.b);
-	glUniform3f(glGetUniformLocation(shaderProgram, (base + ".specular").c_str()), specular.r, specular.g, specular.b);
-	glUniform1f(glGetUniformLocation(shaderProgram, (base + ".constant").c_str()), constant);
-	glUniform1f(glGetUniformLocation(shaderProgram, (base + ".linear").c_str()), linear);
-	glUniform1f(glGetUniformLocation(shaderProgram, (base + ".quadratic").c_str()), quadratic);
-}
-
-//Funcin auxiliar para dibujar los modelos de manera ms efectiva
-void DrawModel(Model& modelo, glm::vec3 posicion, float rotY, glm::vec3 escala, GLuint modelLoc, Shader& shader) {
+// Matriz de modelo de una pieza: traslacin, giro en Y y escala
+glm::mat4 PieceTransform(glm::vec3 posicion, float rotY, glm::vec3 escala) {
 	glm::mat4 model = glm::mat4(1.0f);
 	model = glm::translate(model, posicion);
 	model = glm::rotate(model, glm::radians(rotY), glm::vec3(0.0f, 1.0f, 0.0f));
 	model = glm::scale(model, escala);
-	glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-	modelo.Draw(shader);
+	return model;
+}
+
+//Funcin auxiliar para dibujar los modelos de manera ms efectiva (se manda a la cola de render si su esfera envolvente est dentro del frustum)
+bool DrawModel(RenderQueue& cola, FrustumCuller& culler, Model& modelo, const glm::mat4& transform, ShaderVariants& shader) {
+	if (!culler.IsVisible(modelo.GetBoundingSphere().Transform(transform))) {
+		return false;
+	}
+
+	cola.Submit(modelo, shader, transform);
+	return true;
+}
+
+void DrawModel(RenderQueue& cola, FrustumCuller& culler, Model& modelo, glm::vec3 posicion, float rotY, glm::vec3 escala, ShaderVariants& shader) {
+	DrawModel(cola, culler, modelo, PieceTransform(posicion, rotY, escala), shader);
+}
+
+// Todas las copias de un mismo modelo en el tablero, se dibujan con una sola llamada instanciada por malla
+struct PieceGroup {
+	Model* modelo;
+	std::vector<glm::mat4> transforms;
+	std::vector<BoundingSphere> esferas;		// Esfera envolvente de cada copia en el mundo (las piezas no se mueven)
+	std::vector<unsigned char> visibles;		// Resultado del culling del frame actual
+	std::vector<glm::mat4> transformsVisibles;	// Copias que pasaron el culling
+};
+
+// Descarta en bloque las copias fuera del frustum y manda las dems a la cola en una sola llamada instanciada
+void DrawPieces(RenderQueue& cola, FrustumCuller& culler, PieceGroup& grupo, ShaderVariants& shader) {
+	GLuint total = (GLuint)grupo.transforms.size();
+	grupo.visibles.resize(total);
+
+	GLuint visibles = culler.CullSpheres(grupo.esferas.data(), total, grupo.visibles.data());
+
+	if (visibles == total) {
+		cola.SubmitInstanced(*grupo.modelo, shader, grupo.transforms.data(), (GLsizei)total);
+		return;
+	}
+
+	grupo.transformsVisibles.clear();
+	for (GLuint i = 0; i < total; i++) {
+		if (grupo.visibles[i]) {
+			grupo.transformsVisibles.push_back(grupo.transforms[i]);
+		}
+	}
+
+	cola.SubmitInstanced(*grupo.modelo, shader, grupo.transformsVisibles.data(), (GLsizei)visibles);
+}
+
+// Agrega una pieza al grupo de su modelo (o crea el grupo si es la primera)
+void AddPiece(std::vector<PieceGroup>& grupos, Model& modelo, glm::vec3 posicion, float rotY, glm::vec3 escala) {
+	glm::mat4 transform = PieceTransform(posicion, rotY, escala);
+
+	for (PieceGroup& grupo : grupos) {
+		if (grupo.modelo == &modelo) {
+			grupo.transforms.push_back(transform);
+			grupo.esferas.push_back(modelo.GetBoundingSphere().Transform(transform));
+			return;
+		}
+	}
+
+	PieceGroup grupo;
+	grupo.modelo = &modelo;
+	grupo.transforms.push_back(transform);
+	grupo.esferas.push_back(modelo.GetBoundingSphere().Transform(transform));
+	grupos.push_back(grupo);
+}
+
+// Luces decorativas sobre el tablero (antorchas del lado Minecraft, plantas del lado PvZ), en una cuadrcula.
+// Su alcance se ajusta a la separacin, as cada punto del tablero recibe pocas luces sin importar cuntas haya.
+void ColocarLucesExtra(LightRig& luces, int primera, int cantidad) {
+	if (cantidad <= 0) {
+		return;
+	}
+
+	int columnas = (int)std::ceil(std::sqrt((float)cantidad));
+	float separacion = 64.0f / columnas;
+	float alcance = 1.5f * separacion;
+
+	for (int i = 0; i < cantidad; i++) {
+		glm::vec3 posicion(-32.0f + separacion * (i % columnas + 0.5f), -1.0f, -32.0f + separacion * (i / columnas + 0.5f));
+		glm::vec3 color = posicion.z < 0.0f ? glm::vec3(1.0f, 0.55f, 0.15f) : glm::vec3(0.35f, 1.0f, 0.3f);
+
+		// Atenuacin cuadrtica que cae a 1/256 justo en el alcance
+		luces.SetPointLight(primera + i, PointLightData(posicion, glm::vec3(0.0f), color, color * 0.5f, 1.0f, 0.0f, 255.0f / (alcance * alcance)));
+	}
 }
 
 // Dimensiones de la ventana
@@ -62,6 +149,18 @@ GLfloat lastY = HEIGHT / 2.0;
 bool keys[1024];
 bool firstMouse = true;
 bool usePerspective = true; // true = perspectiva, false = ortogonal
+bool printQueueStats = false; // F1: imprime los contadores de la cola de render
+bool runDrawBenchmark = false; // F2: compara ns/draw del Mesh::Draw anterior contra el actual
+bool validateGLState = false; // F3: compara el estado que guarda GLState contra glGet*
+bool useDepthPrepass = false; // F4: pre-pase de profundidad antes del pase con iluminacin
+int nivelLuces = 0; // F5: cambia la cantidad de luces puntuales decorativas (ver lucesExtra)
+bool dumpProfile = false; // F6: escribe las ltimas marcas del profiler en TRACE_FILE
+bool toggleStatsCsv = false; // F7: empieza/termina de escribir los contadores de cada frame en STATS_CSV_FILE
+bool useStaticLayer = true; // F9: el tablero y las piezas se dibujan una vez por pose de cmara y luego solo se copian
+bool renderOnDemand = true; // F8: solo dibuja cuando algo cambi; sin cambios el bucle duerme en glfwWaitEventsTimeout
+bool cycleSwapMode = false; // F10: cambia entre sin vsync, vsync y vsync adaptativo
+bool cycleFrameCap = false; // F11: cambia el lmite de fps entre los de limitesFps
+bool frameDirty = true; // Algo cambi desde el ltimo frame dibujado (entrada, cmara, animacin, eventos de la ventana)
 
 // Atributos de la iluminacin
 glm::vec3 lightPos(0.0f, 0.0f, 0.0f);   // Posicin de la lmpara principal
@@ -78,6 +177,10 @@ glm::vec3 pointLightPositions[] = {
 	glm::vec3(-32.0f, 10.0f, 32.0f),
 	glm::vec3(-32.0f, 10.0f, -32.0f)
 };
+const int LUCES_LAMPARA = 4;
+
+// Luces decorativas por nivel de F5: con las 4 lmparas quedan 4, 16, 64 y 256 luces puntuales
+const int lucesExtra[] = { 0, 12, 60, 252 };
 
 // Cubo creado con ayuda de vrtices
 float vertices[] = {
@@ -130,88 +233,226 @@ glm::vec3 Light1 = glm::vec3(0);
 GLfloat deltaTime = 0.0f;	// Time between current frame and last frame
 GLfloat lastFrame = 0.0f;  	// Time of last frame
 
-int main()
+// Archivo para chrome://tracing, se escribe con F6 y al salir
+const char* TRACE_FILE = "frame_trace.json";
+// CSV de contadores por frame para F7; --stats-csv ARCHIVO lo escribe desde el primer frame (til con --headless)
+const char* STATS_CSV_FILE = "render_stats.csv";
+// Lmites de fps que recorre F11 (0 = sin lmite, solo el vsync marca el ritmo)
+const double limitesFps[] = { 0.0, 30.0, 60.0, 144.0 };
+// Frames del arranque (compilacin de variantes, primeras subidas) que no cuentan en el histograma del ritmo
+const GLuint PACER_WARMUP_FRAMES = 10;
+
+int main(int argc, char* argv[])
 {
-	// Init GLFW
-	glfwInit();
-	// Set all the required options for GLFW
-	/*glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
-	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
-	glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
-	glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
-	glfwWindowHint(GLFW_RESIZABLE, GL_FALSE);*/
-
-	// Create a GLFWwindow object that we can use for GLFW's functions
-	GLFWwindow* window = glfwCreateWindow(WIDTH, HEIGHT, "Fuentes de luz", nullptr, nullptr);
-
-	if (nullptr == window)
+	// --headless [ANCHOxALTO] [FRAMES]: sin ventana, dibuja en un FBO un nmero fijo de frames y sale con un reporte de tiempos
+	HeadlessOptions headless = ParseHeadlessOptions(argc, argv);
+	HeadlessContext contextoHeadless;
+	GLFWwindow* window = nullptr;
+
+	if (headless.enabled)
 	{
-		std::cout << "Failed to create GLFW window" << std::endl;
-		glfwTerminate();
+		if (!contextoHeadless.Create())
+		{
+			return EXIT_FAILURE;
+		}
 
-		return EXIT_FAILURE;
+		SCREEN_WIDTH = headless.width;
+		SCREEN_HEIGHT = headless.height;
+
+		if (GLEW_OK != contextoHeadless.InitGLEW())
+		{
+			std::cout << "Failed to initialize GLEW" << std::endl;
+			return EXIT_FAILURE;
+		}
 	}
+	else
+	{
+		// Init GLFW
+		glfwInit();
+		// Set all the required options for GLFW
+		/*glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+		glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+		glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+		glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+		glfwWindowHint(GLFW_RESIZABLE, GL_FALSE);*/
+
+		// Create a GLFWwindow object that we can use for GLFW's functions
+		window = glfwCreateWindow(WIDTH, HEIGHT, "Fuentes de luz", nullptr, nullptr);
+
+		if (nullptr == window)
+		{
+			std::cout << "Failed to create GLFW window" << std::endl;
+			glfwTerminate();
 
-	glfwMakeContextCurrent(window);
+			return EXIT_FAILURE;
+		}
 
-	glfwGetFramebufferSize(window, &SCREEN_WIDTH, &SCREEN_HEIGHT);
+		glfwMakeContextCurrent(window);
 
-	// Set the required callback functions
-	glfwSetKeyCallback(window, KeyCallback);
-	glfwSetCursorPosCallback(window, MouseCallback);
+		glfwGetFramebufferSize(window, &SCREEN_WIDTH, &SCREEN_HEIGHT);
 
-	// GLFW Options
-	//glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
+		// Set the required callback functions
+		glfwSetKeyCallback(window, KeyCallback);
+		glfwSetCursorPosCallback(window, MouseCallback);
+		glfwSetWindowRefreshCallback(window, WindowRefreshCallback);
+		glfwSetFramebufferSizeCallback(window, FramebufferSizeCallback);
 
-	// Set this to true so GLEW knows to use a modern approach to retrieving function pointers and extensions
-	glewExperimental = GL_TRUE;
-	// Initialize GLEW to setup the OpenGL Function pointers
-	if (GLEW_OK != glewInit())
-	{
-		std::cout << "Failed to initialize GLEW" << std::endl;
+		// GLFW Options
+		//glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
+
+		// Set this to true so GLEW knows to use a modern approach to retrieving function pointers and extensions
+		glewExperimental = GL_TRUE;
+		// Initialize GLEW to setup the OpenGL Function pointers
+		if (GLEW_OK != glewInit())
+		{
+			std::cout << "Failed to initialize GLEW" << std::endl;
+			return EXIT_FAILURE;
+		}
+	}
+
+	for (int i = 1; i + 1 < argc; i++) {
+		if (strcmp(argv[i], "--stats-csv") == 0) {
+			GetRenderStatsTracker().OpenCsv(argv[i + 1]);
+		}
+	}
+
+	// --fps N, --vsync off|on|adaptive: ritmo de los frames. Sin ventana solo hay lmite si se pide --fps, as el benchmark mide sin tope
+	FramePacerOptions opcionesRitmo = ParseFramePacerOptions(argc, argv);
+	FramePacer ritmo;
+	if (headless.enabled) {
+		ritmo.SetTargetFps(opcionesRitmo.fpsGiven ? opcionesRitmo.targetFps : 0.0);
+	}
+	else {
+		ritmo.SetTargetFps(opcionesRitmo.targetFps);
+		ritmo.SetSwapMode(opcionesRitmo.swapMode);
+	}
+
+	// Sin ventana todo se dibuja en este FBO, del tamao pedido
+	OffscreenTarget destinoHeadless;
+	if (headless.enabled && !destinoHeadless.Init(SCREEN_WIDTH, SCREEN_HEIGHT)) {
+		contextoHeadless.Destroy();
 		return EXIT_FAILURE;
 	}
 
+	// Framebuffer donde termina cada frame: la ventana o el FBO del modo sin ventana
+	GLuint destinoFinal = headless.enabled ? destinoHeadless.GetFramebuffer() : 0;
+
+	// Capa esttica: tablero y piezas, se vuelve a dibujar solo si cambia la cmara, la proyeccin o alguna luz
+	// Sin ventana la cmara y las luces no cambian: con la capa cada frame medido sera solo la copia y Steve,
+	// as que se apaga salvo que se pida con --static-layer
+	bool capaEnHeadless = false;
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--static-layer") == 0) {
+			capaEnHeadless = true;
+		}
+	}
+	if (headless.enabled && !capaEnHeadless) {
+		useStaticLayer = false;
+	}
+
+	StaticLayerCache capaEstatica;
+	if (useStaticLayer && !capaEstatica.Init(SCREEN_WIDTH, SCREEN_HEIGHT)) {
+		useStaticLayer = false;
+	}
+	glBindFramebuffer(GL_FRAMEBUFFER, destinoFinal);
+
 	// Define the viewport dimensions
 	glViewport(0, 0, SCREEN_WIDTH, SCREEN_HEIGHT);
 
-	Shader lightingShader("Shader/lighting.vs", "Shader/lighting.frag");
-	Shader lampShader("Shader/lamp.vs", "Shader/lamp.frag");
+	// Todos los programas se mandan al driver aqu y se esperan hasta su primer uso; si se edita un archivo de Shader/ se recompila sin detener el frame
+	ShaderLibrary shaders;
+
+	// Los shaders con iluminacin se compilan por variante (luces activas, mapa especular, descarte por alfa)
+	ShaderVariants lightingShader(shaders, "Shader/lighting.vs", "Shader/lighting.frag");
+	Shader& lampShader = shaders.Load("Shader/lamp.vs", "Shader/lamp.frag");
+	ShaderVariants lightingInstancedShader(shaders, "Shader/lighting_instanced.vs", "Shader/lighting.frag");
+
+	// Pre-pase de profundidad: solo posiciones, sin color
+	Shader& depthShader = shaders.Load("Shader/depth.vs", "Shader/depth.frag");
+	Shader& depthInstancedShader = shaders.Load("Shader/depth_instanced.vs", "Shader/depth.frag");
+
+	// Copia la capa esttica (color y profundidad) al framebuffer antes de dibujar lo que se mueve
+	Shader& staticLayerShader = shaders.Load("Shader/static_layer.vs", "Shader/static_layer.frag");
+
+	// Ruta de dibujo indirecto (GL 4.3 + shader draw parameters): una llamada por material para toda la escena
+	ShaderVariants* lightingMultiDrawShader = NULL;
+	if (GetGeometryArena().SupportsMultiDrawIndirect()) {
+		lightingMultiDrawShader = new ShaderVariants(shaders, "Shader/lighting_mdi.vs", "Shader/lighting.frag");
+	}
 
 	// ########## CARGA DE MODELOS ##########
-	Model Tablero((char*)"Models/tablero.obj");
+	// La lectura (cach o Assimp) y la decodificacin de texturas corren en el pool de hilos; la subida a GL se hace aqu, en este orden
+	std::chrono::high_resolution_clock::time_point inicioModelos = std::chrono::high_resolution_clock::now();
+	std::vector<Model> modelos = ModelLoader::Load({
+		"Models/tablero.obj",
+
+		// EQUIPO: Minecraft
+		"Models/zombie.obj",
+		//"Models/steve.obj",
+		"Models/steve2.obj",
+		"Models/brazosteve.obj",
+		"Models/manzana.obj",
+
+		"Models/alex.obj",
+		"Models/Esqueleto.obj",
+		"Models/slime.obj",
+		"Models/creeper.obj",
+
+		// EQUIPO: Plants vs Zombies
+		"Models/peonpeashooter.obj",
+		"Models/Reina.obj",
+		"Models/Rey.obj",
+		"Models/alfilcactus.obj",
+		"Models/caballocarni.obj",
+		"Models/torrenuez.obj",
+
+		// Modelos de prueba
+		"Models/RedDog.obj",
+		"Models/44-lavadora.obj"
+	});
+	double msModelos = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - inicioModelos).count();
+
+	Model& Tablero = modelos[0];
 
 	// EQUIPO: Minecraft
-	Model Zombie((char*)"Models/zombie.obj");
-	//Model Steve((char*)"Models/steve.obj");
-	Model Steve((char*)"Models/steve2.obj");
-	Model BrazoSteve((char*)"Models/brazosteve.obj");
-	Model ManzanaSteve((char*)"Models/manzana.obj");
+	Model& Zombie = modelos[1];
+	Model& Steve = modelos[2];
+	Model& BrazoSteve = modelos[3];
+	Model& ManzanaSteve = modelos[4];
 
-	Model Alex((char*)"Models/alex.obj");
-	Model Esqueleto((char*)"Models/Esqueleto.obj");
-	Model Slime((char*)"Models/slime.obj");
-	Model Creeper((char*)"Models/creeper.obj");
+	Model& Alex = modelos[5];
+	Model& Esqueleto = modelos[6];
+	Model& Slime = modelos[7];
+	Model& Creeper = modelos[8];
 
 	// EQUIPO: Plants vs Zombies
-	Model Lanzaguisantes((char*)"Models/peonpeashooter.obj");
-	Model Girasol((char*)"Models/Reina.obj");
-	Model Fred((char*)"Models/Rey.obj");
-	Model Cactus((char*)"Models/alfilcactus.obj");
-	Model Carnivora((char*)"Models/caballocarni.obj");
-	Model Nuez((char*)"Models/torrenuez.obj");
+	Model& Lanzaguisantes = modelos[9];
+	Model& Girasol = modelos[10];
+	Model& Fred = modelos[11];
+	Model& Cactus = modelos[12];
+	Model& Carnivora = modelos[13];
+	Model& Nuez = modelos[14];
 
 	// Modelos de prueba
-	Model Dog((char*)"Models/RedDog.obj");
-	Model Lavadora((char*)"Models/44-lavadora.obj");
+	Model& Dog = modelos[15];
+	Model& Lavadora = modelos[16];
+
+	// Los modelos con cach binaria al da no pasan por Assimp (ver MeshCache.h). El tiempo de CPU suma todos los hilos
+	const MeshCacheStats& mallas = GetMeshCacheStats();
+	std::cout << "Modelos: " << modelos.size() << " en " << msModelos << " ms (" << mallas.milliseconds << " ms de CPU en " << GetThreadPool().GetThreadCount()
+		<< " hilos) | " << mallas.hits << " desde cach, " << mallas.misses << " importados con Assimp" << std::endl;
+	const TextureCacheStats& texturas = GetTextureCache().GetStats();
+	std::cout << "Texturas: " << texturas.misses << " archivos cargados | " << texturas.hits << " reutilizadas (" << texturas.contentHits
+		<< " por contenido con otra ruta)" << std::endl;
 
 	// First, set the container's VAO (and VBO)
 	GLuint VBO, VAO;
 	glGenVertexArrays(1, &VAO);
 	glGenBuffers(1, &VBO);
-	glBindVertexArray(VAO);
-	glBindBuffer(GL_ARRAY_BUFFER, VBO);
+	GetGLState().BindVertexArray(VAO);
+	GetGLState().BindBuffer(GL_ARRAY_BUFFER, VBO);
 	glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
+	CountUpload(sizeof(vertices));
 
 	// Position attribute
 	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(GLfloat), (GLvoid*)0);
@@ -221,86 +462,302 @@ int main()
 	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void*)(3 * sizeof(float)));
 	glEnableVertexAttribArray(1);
 
-	// Set texture units
-	lightingShader.Use();
-	glUniform1i(glGetUniformLocation(lightingShader.Program, "Material.difuse"), 0);
-	glUniform1i(glGetUniformLocation(lightingShader.Program, "Material.specular"), 1);
+	// Luces: un solo UBO (std140) compartido por todos los shaders en LIGHTS_BINDING_POINT
+	LightRig lightRig;
+	lightRig.Init();
+
+	// Directional light
+	lightRig.SetDirLight(DirLightData(glm::vec3(-0.2f, -1.0f, -0.3f), glm::vec3(0.5f, 0.5f, 0.5f), glm::vec3(0.0f), glm::vec3(0.0f)));
+
+	// Las luces puntuales van en un buffer de textura; cada fragmento solo evala las de su cluster
+	LightClusters clusters;
+	clusters.Init();
+
+	// Cada variante nueva se conecta al bloque de luces y a las unidades de los clusters en cuanto se compila
+	auto prepararVariante = [](Shader& variante) {
+		variante.BindUniformBlock("Lights", LIGHTS_BINDING_POINT);
+		LightClusters::BindSamplers(variante);
+	};
+	lightingShader.SetSetup(prepararVariante);
+	lightingInstancedShader.SetSetup(prepararVariante);
+	if (lightingMultiDrawShader != NULL) {
+		lightingMultiDrawShader->SetSetup(prepararVariante);
+	}
+	lightRig.SetPointLightCount(LUCES_LAMPARA);
+	int lucesExtraColocadas = 0;
+
+	// Luces puntuales 2 a 4 (Estticas): se escriben una vez y no se vuelven a subir
+	for (int i = 1; i < LUCES_LAMPARA; ++i) {
+		lightRig.SetPointLight(i, PointLightData(
+			pointLightPositions[i],                       // posicin
+			glm::vec3(0.0f),                              // ambient
+			glm::vec3(0.0f),                              // diffuse
+			glm::vec3(1.0f, 1.0f, 1.0f),                  // specular
+			1.0f, 0.0f, 0.0f                              // attenuation: constant, linear, quadratic
+		));
+	}
+
+	// Variantes que el primer frame seguro necesita (con y sin mapa especular / descarte por alfa): se compilan
+	// mientras se cargan los modelos en vez de una por una al dibujar
+	GLuint lucesIniciales = ActiveLightFeatures(lightRig);
+	for (GLuint extra = 0; extra <= (SHADER_SPECULAR_MAP | SHADER_ALPHA_DISCARD); extra += SHADER_SPECULAR_MAP) {
+		lightingShader.Submit(lucesIniciales | extra);
+		lightingInstancedShader.Submit(lucesIniciales | extra);
+		if (lightingMultiDrawShader != NULL) {
+			lightingMultiDrawShader->Submit(lucesIniciales | extra);
+		}
+	}
+
+	// Localidades de los uniforms, resueltas al enlazar cada programa (el bucle principal ya no construye cadenas).
+	// Se vuelven a resolver si el programa se recarga. Las de las variantes con iluminacin las guarda ShaderVariants.
+	GLint lampModelLoc = -1, lampViewLoc = -1, lampProjLoc = -1;
+	lampShader.SetLinkCallback([&](Shader& programa) {
+		lampModelLoc = programa.GetUniformLocation("model");
+		lampViewLoc = programa.GetUniformLocation("view");
+		lampProjLoc = programa.GetUniformLocation("projection");
+	});
+
+	GLint depthViewLoc = -1, depthProjLoc = -1;
+	depthShader.SetLinkCallback([&](Shader& programa) {
+		depthViewLoc = programa.GetUniformLocation("view");
+		depthProjLoc = programa.GetUniformLocation("projection");
+	});
+	GLint depthInstancedViewLoc = -1, depthInstancedProjLoc = -1;
+	depthInstancedShader.SetLinkCallback([&](Shader& programa) {
+		depthInstancedViewLoc = programa.GetUniformLocation("view");
+		depthInstancedProjLoc = programa.GetUniformLocation("projection");
+	});
+
+	// ========== ACOMODO DE LAS PIEZAS ==========
+	// Las piezas no se mueven: sus matrices se calculan una vez y se agrupan por modelo
+	std::vector<PieceGroup> piezas;
+
+	// ########## EQUIPO: Minecraft ##########
+
+	AddPiece(piezas, Creeper, glm::vec3(-28.0f, 1.0f, -28.0f), 270.0f, glm::vec3(2.5f));					// TORRE 1
+	AddPiece(piezas, Slime, glm::vec3(-20.0f, -2.0f, -28.0f), 270.0f, glm::vec3(1.0f));					// CABALLO 1
+	AddPiece(piezas, Esqueleto, glm::vec3(-12.0f, 1.0f, -28.0f), 270.0f, glm::vec3(2.5f, 3.0f, 2.5f));	// ALFIL 1
+	//AddPiece(piezas, Steve, glm::vec3(-4.0f, -1.6f, -28.0f), 270.0f, glm::vec3(1.0f));					// REY
+	AddPiece(piezas, Alex, glm::vec3(4.0f, -1.6f, -28.0f), 270.0f, glm::vec3(1.0f));						// REINA
+	AddPiece(piezas, Esqueleto, glm::vec3(12.0f, 1.0f, -28.0f), 270.0f, glm::vec3(2.5f, 3.0f, 2.5f));	// ALFIL 2
+	AddPiece(piezas, Slime, glm::vec3(20.0f, -2.0f, -28.0f), 270.0f, glm::vec3(1.0f));					// CABALLO 2
+	AddPiece(piezas, Creeper, glm::vec3(28.0f, 1.0f, -28.0f), 270.0f, glm::vec3(2.5f));					// TORRE 2
+
+	// PEONES Minecraft (Zombie)
+	float peonZ_Mine = -20.0f;
+	float peonY_Mine = -1.6f;
+	glm::vec3 escalaPeonMine = glm::vec3(1.0f);
+	float posicionesX_Mine[] = { -28, -20, -12, -4, 4, 12, 20, 28 };
+
+	for (float x : posicionesX_Mine) {
+		AddPiece(piezas, Zombie, glm::vec3(x, peonY_Mine, peonZ_Mine), 270.0f, escalaPeonMine);
+	}
+
+	// ########## EQUIPO: Plants vs Zombies ##########
+
+	AddPiece(piezas, Nuez, glm::vec3(28.0f, -1.8f, 28.0f), 90.0f, glm::vec3(2.0f));          // TORRE 1
+	AddPiece(piezas, Carnivora, glm::vec3(20.0f, -1.8f, 28.0f), 360.0f, glm::vec3(2.5f));    // CABALLO 1
+	AddPiece(piezas, Cactus, glm::vec3(12.0f, -2.0f, 28.0f), 270.0f, glm::vec3(2.5f));       // ALFIL 1
+	AddPiece(piezas, Girasol, glm::vec3(4.0f, -1.8f, 28.0f), 270.0f, glm::vec3(1.0f));       // REINA
+	AddPiece(piezas, Fred, glm::vec3(-4.0f, -1.8f, 28.0f), 270.0f, glm::vec3(1.0f));         // REY
+	AddPiece(piezas, Cactus, glm::vec3(-12.0f, -2.0f, 28.0f), 270.0f, glm::vec3(2.5f));      // ALFIL 2
+	AddPiece(piezas, Carnivora, glm::vec3(-20.0f, -1.8f, 28.0f), 360.0f, glm::vec3(2.5f));   // CABALLO 2
+	AddPiece(piezas, Nuez, glm::vec3(-28.0f, -1.8f, 28.0f), 45.0f, glm::vec3(2.0f));         // TORRE 2
+
+	// PEONES
+	float peonZ = 20.0f;
+	float peonY = -1.5f;
+	float rotPeon = 270.0f;
+	glm::vec3 escalaPeon = glm::vec3(3.0f);
+	float posicionesX[] = { 28, 20, 12, 4, -4, -12, -20, -28 };
+
+	for (float x : posicionesX) {
+		AddPiece(piezas, Lanzaguisantes, glm::vec3(x, peonY, peonZ), rotPeon, escalaPeon);
+	}
+
+	RenderQueue renderQueue;
+	bool shadersReportados = false;
+
+	// Tiempo de GPU del pase con iluminacin con y sin pre-pase, para compararlos. La capa esttica lleva los suyos,
+	// si no el redibujado y el frame se pisaran el resultado en el mismo temporizador
+	GpuTimer depthTimer, shadedTimer, shadedPrepassTimer;
+	GpuTimer depthLayerTimer, shadedLayerTimer, shadedPrepassLayerTimer;
+	FrustumCuller culler;
+
+	// Esfera envolvente del cubo de las lmparas (cubo unitario centrado en el origen)
+	BoundingSphere esferaLampara(glm::vec3(0.0f), 0.5f * glm::sqrt(3.0f));
+	renderQueue.SetMultiDrawShader(lightingMultiDrawShader);
+
+	// Reporte del modo sin ventana: tiempo de cada frame y de CPU por fase
+	FrameReport reporte;
+	GLuint framesHeadless = 0;
+	if (headless.enabled) {
+		// Todos los frames medidos con las texturas reales, no con las de relleno
+		GetTextureStreamer().Finish();
+		reporte.Start(headless.frames);
+	}
+
+	// ========== CAPA ESTTICA: envo ==========
+	// Lo que no se mueve: tablero y piezas. Se enva a la cola de la capa esttica, o a la del frame si la capa est apagada
+	auto enviarEstaticos = [&]() {
+		//TABLERO
+		GetProfiler().Begin("tablero");
+		glm::mat4 model = glm::mat4(1);
+		model = glm::translate(model, glm::vec3(0.0f, -4.0f, 0.0f));
+		model = glm::scale(model, glm::vec3(0.5f, 1.0f, 0.5f));
+		DrawModel(renderQueue, culler, Tablero, model, lightingShader);
+		GetProfiler().End();
+
+		// --Modelo de prueba para probar el canal alfa
+		//model = glm::mat4(1);
+		//glEnable(GL_BLEND);//Avtiva la funcionalidad para trabajar el canal alfa //--Descomentar
+		//glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+		//glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
+		//glUniform1i(glGetUniformLocation(lightingShader.Program, "transparency"), 1.0); //--Descomentar
+		//Dog.Draw(lightingShader);
+		//glDisable(GL_BLEND);  //Desactiva el canal alfa //--Descomentar
+		//glBindVertexArray(0); //Sepa la bola
+
+		// ########## PIEZAS (instanciadas) ##########
+		// Una llamada por malla para todas las copias de cada modelo
+		GetProfiler().Begin("pieces");
+		for (PieceGroup& grupo : piezas) {
+			DrawPieces(renderQueue, culler, grupo, lightingInstancedShader);
+		}
+		GetProfiler().End();
+	};
+
+	// Dibuja lo que haya en la cola en el framebuffer enlazado y deja la prueba de profundidad como estaba
+	auto dibujarCola = [&](const glm::mat4& view, const glm::mat4& projection, GpuTimer& tiempoProfundidad, GpuTimer& tiempoSinPrepass, GpuTimer& tiempoConPrepass) {
+		// Pre-pase: llena el depth buffer con las mismas mallas, as el pase con iluminacin
+		// (GL_EQUAL, sin escribir profundidad) sombrea una sola vez cada pixel visible
+		if (useDepthPrepass) {
+			PROFILE_SCOPE("depth prepass");
+			depthShader.Use();
+			depthShader.SetMat4(depthViewLoc, view);
+			depthShader.SetMat4(depthProjLoc, projection);
+			depthInstancedShader.Use();
+			depthInstancedShader.SetMat4(depthInstancedViewLoc, view);
+			depthInstancedShader.SetMat4(depthInstancedProjLoc, projection);
+
+			tiempoProfundidad.Begin();
+			GetGLState().ColorMask(false);
+			renderQueue.FlushDepth(depthShader, depthInstancedShader);
+			GetGLState().ColorMask(true);
+			tiempoProfundidad.End();
+
+			GetGLState().DepthFunc(GL_EQUAL);
+			GetGLState().DepthMask(false);
+			reporte.Mark("depth prepass");
+		}
+
+		// Ordena los paquetes por programa/material/VAO/profundidad y los dibuja
+		GpuTimer& pase = useDepthPrepass ? tiempoConPrepass : tiempoSinPrepass;
+		GetProfiler().Begin("shading");
+		pase.Begin();
+		renderQueue.Flush();
+		pase.End();
+		GetProfiler().End();
+		reporte.Mark("shading");
+
+		// Lo siguiente (las lmparas, los objetos que se mueven, el glClear del siguiente frame) necesita la prueba normal y escritura de profundidad
+		GetGLState().DepthFunc(GL_LESS);
+		GetGLState().DepthMask(true);
+	};
 
 	// Bucle principal de la escena
-	while (!glfwWindowShouldClose(window))
+	while (headless.enabled ? framesHeadless < headless.frames : !glfwWindowShouldClose(window))
 	{
-		// Calcula el tiempo entre frames (delta time)
-		GLfloat currentFrame = glfwGetTime();
+		// Bajo demanda: si nada cambi el bucle duerme hasta el siguiente evento. El tiempo de espera es el mismo con el que
+		// ShaderLibrary revisa los archivos, as un shader editado se ve aunque nadie toque nada
+		// Mientras haya texturas en camino tampoco se duerme, cada frame sube las que ya se decodificaron
+		if (!headless.enabled && renderOnDemand && !frameDirty && GetTextureStreamer().IsIdle()) {
+			glfwWaitEventsTimeout(SHADER_LIBRARY_POLL_SECONDS);
+
+			// El tiempo dormido no cuenta como deltaTime del siguiente frame ni como periodo en el histograma del ritmo
+			lastFrame = (GLfloat)glfwGetTime();
+			ritmo.Resync();
+
+			if (shaders.Update() > 0) {
+				capaEstatica.Invalidate();
+				frameDirty = true;
+			}
+
+			if (!frameDirty) {
+				continue;
+			}
+		}
+		frameDirty = false;
+
+		reporte.BeginFrame();
+		GetProfiler().BeginFrame();
+		GetProfiler().Begin("frame");
+
+		// Calcula el tiempo entre frames (delta time). Sin ventana la escena avanza a 60 fps fijos, as cada corrida dibuja lo mismo
+		GLfloat currentFrame = headless.enabled ? framesHeadless / 60.0f : (GLfloat)glfwGetTime();
 		deltaTime = currentFrame - lastFrame;
 		lastFrame = currentFrame;
 
 		// Comprueba si se han activado eventos (tecla presionada, mouse movido, etc.) y llama a las funciones de respuesta correspondientes
-		glfwPollEvents();
-		DoMovement();
+		GetProfiler().Begin("poll/DoMovement");
+		if (!headless.enabled) {
+			glfwPollEvents();
+			DoMovement();
+		}
+		else {
+			destinoHeadless.Bind();
+		}
+		GetProfiler().End();
 
-		// Limpia el colorbuffer
-		glClearColor(0.1f, 0.1f, 0.1f, 1.0f);
-		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+		// Cambia los programas recompilados que ya terminaron; uno que no compila deja el anterior
+		if (shaders.Update() > 0) {
+			capaEstatica.Invalidate();
+		}
 
-		// Opcin de profundidad para OpenGL
-		glEnable(GL_DEPTH_TEST);
+		// Sube las texturas que ya se decodificaron; la capa esttica no se puede quedar con las de relleno
+		if (GetTextureStreamer().Update() > 0) {
+			capaEstatica.Invalidate();
+			frameDirty = true;
+		}
 
-		// Utilice el sombreador correspondiente al configurar uniforms/drawing objects
-		lightingShader.Use();
+		// Las matrices de instancias se vuelven a escribir cada frame
+		GetGeometryArena().BeginFrame();
 
-		glUniform1i(glGetUniformLocation(lightingShader.Program, "diffuse"), 0);
-		//glUniform1i(glGetUniformLocation(lightingShader.Program, "specular"),1);	//Activacin de la luz especular
+		// Antes de limpiar la pantalla, as lo que dibuja la prueba no se ve
+		if (runDrawBenchmark) {
+			std::vector<Model*> modelosPrueba = { &Tablero, &Steve, &Creeper, &Zombie, &Lanzaguisantes };
+			DrawBenchmark::Run(modelosPrueba, lightingShader.Get(ActiveLightFeatures(lightRig)), 1000);
+			runDrawBenchmark = false;
+		}
 
-		GLint viewPosLoc = glGetUniformLocation(lightingShader.Program, "viewPos");
-		glUniform3f(viewPosLoc, camera.GetPosition().x, camera.GetPosition().y, camera.GetPosition().z);
+		// Limpia el colorbuffer
+		glClearColor(0.1f, 0.1f, 0.1f, 1.0f);
+		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-		// Directional light
-		glUniform3f(glGetUniformLocation(lightingShader.Program, "dirLight.direction"), -0.2f, -1.0f, -0.3f);
-		glUniform3f(glGetUniformLocation(lightingShader.Program, "dirLight.ambient"), 0.5f, 0.5f, 0.5f);
-		glUniform3f(glGetUniformLocation(lightingShader.Program, "dirLight.diffuse"), 0.0f, 0.0f, 0.0f);
-		glUniform3f(glGetUniformLocation(lightingShader.Program, "dirLight.specular"), 0.0f, 0.0f, 0.0f);
+		// Opcin de profundidad para OpenGL (solo llega al driver la primera vez)
+		GetGLState().Enable(GL_DEPTH_TEST);
 
-		// Luz puntual (Dinmica)
-		glm::vec3 lightColor;
-		lightColor.x = abs(sin(glfwGetTime() * Light1.x));
-		lightColor.y = abs(sin(glfwGetTime() * Light1.y));
-		lightColor.z = sin(glfwGetTime() * Light1.z);
-
-		glUniform3f(glGetUniformLocation(lightingShader.Program, "pointLights[0].position"), pointLightPositions[0].x, pointLightPositions[0].y, pointLightPositions[0].z);
-		glUniform3f(glGetUniformLocation(lightingShader.Program, "pointLights[0].ambient"), lightColor.x, lightColor.y, lightColor.z);
-		glUniform3f(glGetUniformLocation(lightingShader.Program, "pointLights[0].diffuse"), lightColor.x, lightColor.y, lightColor.z);
-		glUniform3f(glGetUniformLocation(lightingShader.Program, "pointLights[0].specular"), 1.0f, 1.0f, 1.0f);
-		glUniform1f(glGetUniformLocation(lightingShader.Program, "pointLights[0].constant"), 1.0f);
-		glUniform1f(glGetUniformLocation(lightingShader.Program, "pointLights[0].linear"), 0.0f);
-		glUniform1f(glGetUniformLocation(lightingShader.Program, "pointLights[0].quadratic"), 0.0f);
-
-		// Luces puntuales 2 a 4 (Estticas)
-		for (int i = 1; i <= 3; ++i) {
-			SetPointLight(
-				i,
-				pointLightPositions[i],                       // posicin
-				glm::vec3(0.0f),                              // ambient
-				glm::vec3(0.0f),                              // diffuse
-				glm::vec3(1.0f, 1.0f, 1.0f),                  // specular
-				1.0f, 0.0f, 0.0f,                             // attenuation: constant, linear, quadratic
-				lightingShader.Program                        // shader ID
-			);
+		// Luz puntual (Dinmica): mientras est encendida cambia de color cada frame
+		if (active) {
+			frameDirty = true;
 		}
+		glm::vec3 lightColor;
+		lightColor.x = abs(sin(currentFrame * Light1.x));
+		lightColor.y = abs(sin(currentFrame * Light1.y));
+		lightColor.z = sin(currentFrame * Light1.z);
+
+		lightRig.SetPointLight(0, PointLightData(pointLightPositions[0], lightColor, lightColor, glm::vec3(1.0f, 1.0f, 1.0f), 1.0f, 0.0f, 0.0f));
 
 		// SpotLight
-		glUniform3f(glGetUniformLocation(lightingShader.Program, "spotLight.position"), camera.GetPosition().x, camera.GetPosition().y, camera.GetPosition().z);
-		glUniform3f(glGetUniformLocation(lightingShader.Program, "spotLight.direction"), camera.GetFront().x, camera.GetFront().y, camera.GetFront().z);
-		glUniform3f(glGetUniformLocation(lightingShader.Program, "spotLight.ambient"), 0.0f, 0.0f, 0.0f);
-		glUniform3f(glGetUniformLocation(lightingShader.Program, "spotLight.diffuse"), 0.0f, 0.0f, 0.0f);
-		glUniform3f(glGetUniformLocation(lightingShader.Program, "spotLight.specular"), 0.0f, 0.0f, 0.0f);
-		glUniform1f(glGetUniformLocation(lightingShader.Program, "spotLight.constant"), 1.0f);
-		glUniform1f(glGetUniformLocation(lightingShader.Program, "spotLight.linear"), 0.0f);
-		glUniform1f(glGetUniformLocation(lightingShader.Program, "spotLight.quadratic"), 0.0f);
-		glUniform1f(glGetUniformLocation(lightingShader.Program, "spotLight.cutOff"), glm::cos(glm::radians(12.0f)));
-		glUniform1f(glGetUniformLocation(lightingShader.Program, "spotLight.outerCutOff"), glm::cos(glm::radians(12.0f)));
-
-		// Set material properties
-		glUniform1f(glGetUniformLocation(lightingShader.Program, "material.shininess"), 1.0f); //brillo
+		lightRig.SetSpotLight(SpotLightData(camera.GetPosition(), camera.GetFront(), glm::cos(glm::radians(12.0f)), glm::cos(glm::radians(12.0f)),
+			glm::vec3(0.0f), glm::vec3(0.0f), glm::vec3(0.0f), 1.0f, 0.0f, 0.0f));
+
+		// Luces decorativas: solo se reescriben cuando cambia el nivel
+		if (lucesExtraColocadas != lucesExtra[nivelLuces]) {
+			lucesExtraColocadas = lucesExtra[nivelLuces];
+			ColocarLucesExtra(lightRig, LUCES_LAMPARA, lucesExtraColocadas);
+			lightRig.SetPointLightCount(LUCES_LAMPARA + lucesExtraColocadas);
+		}
 
 		// Create camera transformations
 		glm::mat4 view;
@@ -320,120 +777,138 @@ int main()
 			);
 		}
 
-		// Get the uniform locations
-		GLint modelLoc = glGetUniformLocation(lightingShader.Program, "model");
-		GLint viewLoc = glGetUniformLocation(lightingShader.Program, "view");
-		GLint projLoc = glGetUniformLocation(lightingShader.Program, "projection");
-
-		// Pass the matrices to the shader
-		glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
-		glUniformMatrix4fv(projLoc, 1, GL_FALSE, glm::value_ptr(projection));
+		reporte.Mark("update");
+
+		// Frustum del frame (sirve igual para perspectiva y ortogonal)
+		culler.SetFrustum(camera.ExtractFrustum(projection));
+		culler.ResetStats();
+
+		// Reparte las luces puntuales en los clusters de esta vista, luego se sube solo el rango de luces que cambi
+		GetProfiler().Begin("light upload");
+		clusters.Build(lightRig, view, projection, 0.1f, 100.0f, SCREEN_WIDTH, SCREEN_HEIGHT);
+		lightRig.Upload();
+		clusters.Bind(lightRig);
+		GetProfiler().End();
+		reporte.Mark("lights");
+
+		// Pass the matrices to the shader (a todas las variantes, tambin a las que se compilen durante el frame)
+		lightingShader.SetFrameUniforms(view, projection, camera.GetPosition());
+		lightingInstancedShader.SetFrameUniforms(view, projection, camera.GetPosition());
+		if (renderQueue.UsesMultiDraw()) {
+			lightingMultiDrawShader->SetFrameUniforms(view, projection, camera.GetPosition());
+		}
 
 		glm::mat4 model(1);
 
-		//Posicionamiento de la cmara
-		view = camera.GetViewMatrix();
-
-		// ========== CARGA DE MODELOS ==========
-		
-		//TABLERO
-		model = glm::mat4(1);
-		model = glm::translate(model, glm::vec3(0.0f, -4.0f, 0.0f));
-		model = glm::scale(model, glm::vec3(0.5f, 1.0f, 0.5f));
-		glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-		Tablero.Draw(lightingShader);
-
-		// ########## EQUIPO: Minecraft ##########
-
-		DrawModel(Creeper, glm::vec3(-28.0f, 1.0f, -28.0f), 270.0f, glm::vec3(2.5f), modelLoc, lightingShader);					// TORRE 1
-		DrawModel(Slime, glm::vec3(-20.0f, -2.0f, -28.0f), 270.0f, glm::vec3(1.0f), modelLoc, lightingShader);					// CABALLO 1
-		DrawModel(Esqueleto, glm::vec3(-12.0f, 1.0f, -28.0f), 270.0f, glm::vec3(2.5f, 3.0f, 2.5f), modelLoc, lightingShader);	// ALFIL 1
-		//DrawModel(Steve, glm::vec3(-4.0f, -1.6f, -28.0f), 270.0f, glm::vec3(1.0f), modelLoc, lightingShader);					// REY
-		DrawModel(Alex, glm::vec3(4.0f, -1.6f, -28.0f), 270.0f, glm::vec3(1.0f), modelLoc, lightingShader);						// REINA
-		DrawModel(Esqueleto, glm::vec3(12.0f, 1.0f, -28.0f), 270.0f, glm::vec3(2.5f, 3.0f, 2.5f), modelLoc, lightingShader);	// ALFIL 2
-		DrawModel(Slime, glm::vec3(20.0f, -2.0f, -28.0f), 270.0f, glm::vec3(1.0f), modelLoc, lightingShader);					// CABALLO 2
-		DrawModel(Creeper, glm::vec3(28.0f, 1.0f, -28.0f), 270.0f, glm::vec3(2.5f), modelLoc, lightingShader);					// TORRE 2
-
-		// PEONES Minecraft (Zombie)
-		float peonZ_Mine = -20.0f;
-		float peonY_Mine = -1.6f;
-		glm::vec3 escalaPeonMine = glm::vec3(1.0f);
-		float posicionesX_Mine[] = { -28, -20, -12, -4, 4, 12, 20, 28 };
-
-		for (float x : posicionesX_Mine) {
-			DrawModel(Zombie, glm::vec3(x, peonY_Mine, peonZ_Mine), 270.0f, escalaPeonMine, modelLoc, lightingShader);
+		// ========== CAPA ESTTICA ==========
+		// Tablero y piezas no se mueven: con la misma pose de cmara y las mismas luces su imagen no cambia,
+		// as que se dibujan en la capa solo cuando algo de eso cambi y despus cada frame solo se copia
+		// Tringulos del redibujado de la capa, para que el reporte cuente tambin los frames que la rehacen
+		GLuint triangulosCapa = 0;
+		if (useStaticLayer && !capaEstatica.IsValid(view, projection, lightRig.GetVersion())) {
+			GetProfiler().Begin("static layer");
+			capaEstatica.Begin();
+			renderQueue.Begin(camera.GetPosition(), 100.0f);
+			renderQueue.SetShaderFeatures(ActiveLightFeatures(lightRig));
+			enviarEstaticos();
+			dibujarCola(view, projection, depthLayerTimer, shadedLayerTimer, shadedPrepassLayerTimer);
+			triangulosCapa = renderQueue.GetStats().triangles;
+			capaEstatica.End(view, projection, lightRig.GetVersion(), destinoFinal);
+			GetProfiler().End();
 		}
 
-		// ########## EQUIPO: Plants vs Zombies ##########
-
-		DrawModel(Nuez, glm::vec3(28.0f, -1.8f, 28.0f), 90.0f, glm::vec3(2.0f), modelLoc, lightingShader);          // TORRE 1
-		DrawModel(Carnivora, glm::vec3(20.0f, -1.8f, 28.0f), 360.0f, glm::vec3(2.5f), modelLoc, lightingShader);    // CABALLO 1
-		DrawModel(Cactus, glm::vec3(12.0f, -2.0f, 28.0f), 270.0f, glm::vec3(2.5f), modelLoc, lightingShader);       // ALFIL 1
-		DrawModel(Girasol, glm::vec3(4.0f, -1.8f, 28.0f), 270.0f, glm::vec3(1.0f), modelLoc, lightingShader);       // REINA
-		DrawModel(Fred, glm::vec3(-4.0f, -1.8f, 28.0f), 270.0f, glm::vec3(1.0f), modelLoc, lightingShader);         // REY
-		DrawModel(Cactus, glm::vec3(-12.0f, -2.0f, 28.0f), 270.0f, glm::vec3(2.5f), modelLoc, lightingShader);      // ALFIL 2
-		DrawModel(Carnivora, glm::vec3(-20.0f, -1.8f, 28.0f), 360.0f, glm::vec3(2.5f), modelLoc, lightingShader);   // CABALLO 2
-		DrawModel(Nuez, glm::vec3(-28.0f, -1.8f, 28.0f), 45.0f, glm::vec3(2.0f), modelLoc, lightingShader);         // TORRE 2
+		GetProfiler().Begin("submit");
+		renderQueue.Begin(camera.GetPosition(), 100.0f);
 
-		// PEONES
-		float peonZ = 20.0f;
-		float peonY = -1.5f;
-		float rotPeon = 270.0f;
-		glm::vec3 escalaPeon = glm::vec3(3.0f);
-		float posicionesX[] = { 28, 20, 12, 4, -4, -12, -20, -28 };
+		// Las luces apagadas (como la linterna, con color cero) no se compilan en las variantes de este frame
+		renderQueue.SetShaderFeatures(ActiveLightFeatures(lightRig));
 
-		for (float x : posicionesX) {
-			DrawModel(Lanzaguisantes, glm::vec3(x, peonY, peonZ), rotPeon, escalaPeon, modelLoc, lightingShader);
+		if (useStaticLayer) {
+			capaEstatica.Composite(staticLayerShader);
+		}
+		else {
+			enviarEstaticos();
 		}
-
-		// --Modelo de prueba para probar el canal alfa
-		//model = glm::mat4(1);
-		//glEnable(GL_BLEND);//Avtiva la funcionalidad para trabajar el canal alfa //--Descomentar
-		//glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-		//glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-		//glUniform1i(glGetUniformLocation(lightingShader.Program, "transparency"), 1.0); //--Descomentar
-		//Dog.Draw(lightingShader);
-		//glDisable(GL_BLEND);  //Desactiva el canal alfa //--Descomentar
-		//glBindVertexArray(0); //Sepa la bola
-
-
 
 		// ########## EJERCICIO: Modelado jerarquico ##########
+		// Los DrawModel solo llenan la cola: sus marcas miden el culling y el armado de paquetes, el dibujo cae en "shading"
 
+		GetProfiler().Begin("steve hierarchy");
 		glm::mat4 modelSteve = glm::mat4(1.0f);
 		modelSteve = glm::translate(modelSteve, glm::vec3(-4.0f, -1.6f, -28.0f));			// posicin global
 		modelSteve = glm::rotate(modelSteve, glm::radians(rotSteveY + 270.0f), glm::vec3(0.0f, 1.0f, 0.0f));
-		glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(modelSteve));
-		Steve.Draw(lightingShader);
+		DrawModel(renderQueue, culler, Steve, modelSteve, lightingShader);
 
 		glm::mat4 modelBrazo = modelSteve;										// Hereda transformaciones del cuerpo
 		modelBrazo = glm::translate(modelBrazo, glm::vec3(0.0f, 0.0f, 0.0f));	// posicin del brazo con respecto a Steve
 		modelBrazo = glm::rotate(modelBrazo, glm::radians(brazoSteveAngle), glm::vec3(0.0f, 0.0f, 1.0f)); // control manual
-		glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(modelBrazo));
-		BrazoSteve.Draw(lightingShader);
+		DrawModel(renderQueue, culler, BrazoSteve, modelBrazo, lightingShader);
 
 		glm::mat4 modelManzana = modelBrazo;										// Hereda transformaciones del brazo
 		modelManzana = glm::translate(modelManzana, glm::vec3(0.0f, -0.4f, 0.2f)); // posicin relativa a la mano
 		modelManzana = glm::rotate(modelManzana, glm::radians(rotManzanaY), glm::vec3(0.0f, 1.0f, 0.0f));
-		glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(modelManzana));
-		ManzanaSteve.Draw(lightingShader);
+		DrawModel(renderQueue, culler, ManzanaSteve, modelManzana, lightingShader);
+		GetProfiler().End();
+
+		GetProfiler().End();
+
+		reporte.Mark("submit");
 
+		dibujarCola(view, projection, depthTimer, shadedTimer, shadedPrepassTimer);
+
+		// Para este punto ya se construyeron todos los programas del arranque, incluidas las variantes del primer frame
+		if (!shadersReportados) {
+			const ProgramCacheStats& cacheStats = GetProgramCache().GetStats();
+			std::cout << "Shaders: " << cacheStats.hits + cacheStats.misses << " programas en " << cacheStats.milliseconds << " ms | "
+				<< cacheStats.hits << " desde cach, " << cacheStats.misses << " compilados"
+				<< (GetProgramCache().IsSupported() ? "" : " (el driver no soporta binarios de programa)") << std::endl;
+			shadersReportados = true;
+		}
+
+		if (printQueueStats) {
+			const RenderQueueStats& stats = renderQueue.GetStats();
+			std::cout << "RenderQueue: " << stats.packets << " paquetes | " << stats.drawCalls << " llamadas de dibujo | programas " << stats.programBinds << " (" << stats.programBindsElided << " evitados)"
+				<< " | materiales " << stats.materialBinds << " (" << stats.materialBindsElided << " evitados)"
+				<< " | VAOs " << stats.vaoBinds << " (" << stats.vaoBindsElided << " evitados)"
+				<< " | texturas " << stats.textureBinds << " (" << stats.textureBindsElided << " evitadas)" << std::endl;
+
+			double profundidad = depthTimer.GetMilliseconds();
+			double conPrepass = shadedPrepassTimer.GetMilliseconds();
+			std::cout << "GPU: sin pre-pase " << shadedTimer.GetMilliseconds() << " ms | con pre-pase " << profundidad + conPrepass
+				<< " ms (profundidad " << profundidad << " + iluminacin " << conPrepass << ", " << stats.depthDrawCalls << " llamadas) | pre-pase "
+				<< (useDepthPrepass ? "activo" : "inactivo") << std::endl;
+			if (useStaticLayer) {
+				// Lo de arriba es solo lo que se mueve; tablero y piezas se midieron la ltima vez que se redibuj la capa
+				double profundidadCapa = depthLayerTimer.GetMilliseconds();
+				double conPrepassCapa = shadedPrepassLayerTimer.GetMilliseconds();
+				std::cout << "GPU capa esttica: sin pre-pase " << shadedLayerTimer.GetMilliseconds() << " ms | con pre-pase " << profundidadCapa + conPrepassCapa
+					<< " ms (profundidad " << profundidadCapa << " + iluminacin " << conPrepassCapa << ")" << std::endl;
+			}
+
+			const ClusterStats& clusterStats = clusters.GetStats();
+			std::cout << "Clusters: " << clusterStats.lights << " luces puntuales | " << clusterStats.indices << " ndices | mximo "
+				<< clusterStats.maxPerCluster << " por cluster | reparto " << clusterStats.buildMicroseconds << " us" << std::endl;
+
+			std::cout << "Variantes compiladas: " << lightingShader.GetCompiledCount() << " normales | " << lightingInstancedShader.GetCompiledCount() << " instanciadas | "
+				<< (lightingMultiDrawShader != NULL ? lightingMultiDrawShader->GetCompiledCount() : 0) << " indirectas" << std::endl;
+
+			const TextureCacheStats& texturas = GetTextureCache().GetStats();
+			std::cout << "Texturas: " << texturas.textures << " en cach | " << texturas.misses << " cargadas | " << texturas.hits << " reutilizadas ("
+				<< texturas.contentHits << " por contenido) | " << texturas.bytesSaved / 1024 << " KB ahorrados | " << GetTextureStreamer().GetPendingCount()
+				<< " pendientes | subida " << (GetTextureStreamer().IsPersistent() ? "por PBO persistente" : "desde memoria") << std::endl;
+		}
 
 		// Also draw the lamp object, again binding the appropriate shader
+		GetProfiler().Begin("lamps");
 		lampShader.Use();
 
-		// Get location objects for the matrices on the lamp shader (these could be different on a different shader)
-		modelLoc = glGetUniformLocation(lampShader.Program, "model");
-		viewLoc = glGetUniformLocation(lampShader.Program, "view");
-		projLoc = glGetUniformLocation(lampShader.Program, "projection");
-
-		// Set matrices
-		glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
-		glUniformMatrix4fv(projLoc, 1, GL_FALSE, glm::value_ptr(projection));
+		// Set matrices (lamp locations were resolved before the loop)
+		lampShader.SetMat4(lampViewLoc, view);
+		lampShader.SetMat4(lampProjLoc, projection);
 		model = glm::mat4(1);
 		model = glm::translate(model, lightPos);
 		model = glm::scale(model, glm::vec3(0.2f)); // Make it a smaller cube
-		glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
+		lampShader.SetMat4(lampModelLoc, model);
 
 		// Draw the light object (using light's vertex attributes)
 		for (GLuint i = 0; i < 4; i++)
@@ -441,25 +916,147 @@ int main()
 			model = glm::mat4(1);
 			model = glm::translate(model, pointLightPositions[i]);
 			model = glm::scale(model, glm::vec3(0.2f)); // Make it a smaller cube
-			glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-			glBindVertexArray(VAO);
+
+			if (!culler.IsVisible(esferaLampara.Transform(model))) {
+				continue;
+			}
+
+			lampShader.SetMat4(lampModelLoc, model);
+			GetGLState().BindVertexArray(VAO);
 			glDrawArrays(GL_TRIANGLES, 0, 36);
+			CountDraw(36);
 		}
-		glBindVertexArray(0);
 
-		// Swap the screen buffers
-		glfwSwapBuffers(window);
+		GetProfiler().End();
+
+		// Conteo del culling de este frame (incluye las lmparas)
+		if (printQueueStats) {
+			const RenderStats& frameStats = GetRenderStatsTracker().GetLastFrame();
+			std::cout << "Frame anterior: " << frameStats.drawCalls << " llamadas | " << frameStats.triangles << " tringulos | " << frameStats.vertices << " vrtices | programas "
+				<< frameStats.programBinds << " | VAOs " << frameStats.vaoBinds << " | texturas " << frameStats.textureBinds << " | uniforms " << frameStats.uniformUploads
+				<< " | " << frameStats.bytesUploaded << " bytes subidos" << std::endl;
+
+			const CullStats& cullStats = culler.GetStats();
+			std::cout << "Culling: " << cullStats.visible << " visibles | " << cullStats.culled << " descartados de " << cullStats.tested << std::endl;
+			std::cout << "Capa esttica: " << (useStaticLayer ? "activa" : "inactiva") << " | redibujada " << capaEstatica.GetRebuildCount() << " veces" << std::endl;
+			ritmo.Print();
+			printQueueStats = false;
+		}
+
+		if (validateGLState) {
+			std::cout << "GLState: " << (GetGLState().Validate() ? "coincide con el driver" : "hay diferencias (ver arriba)") << std::endl;
+			validateGLState = false;
+		}
+
+		reporte.Mark("lamps");
+
+		// Swap the screen buffers. Sin ventana se espera a la GPU, as el tiempo del frame incluye el dibujo
+		// Antes del swap el frame espera su turno segn el lmite de fps (duerme y termina girando contra el reloj)
+		GetProfiler().Begin("swap");
+		if (headless.enabled) {
+			glFinish();
+			reporte.Mark("gpu wait");
+
+			GetProfiler().Begin("pacing");
+			ritmo.Wait();
+			GetProfiler().End();
+			reporte.Mark("pacing");
+
+			framesHeadless++;
+			if (framesHeadless == PACER_WARMUP_FRAMES) {
+				ritmo.ResetHistogram();
+			}
+		}
+		else {
+			GetProfiler().Begin("pacing");
+			ritmo.Wait();
+			GetProfiler().End();
+
+			glfwSwapBuffers(window);
+		}
+		GetProfiler().End();
+
+		GetProfiler().End();
+		GetProfiler().EndFrame();
+
+		if (dumpProfile) {
+			GetProfiler().WriteChromeTrace(TRACE_FILE);
+			dumpProfile = false;
+		}
+
+		// Cierra los contadores del frame (y escribe su fila si hay CSV abierto)
+		GetRenderStatsTracker().EndFrame();
+
+		if (toggleStatsCsv) {
+			if (GetRenderStatsTracker().IsWritingCsv()) {
+				GetRenderStatsTracker().CloseCsv();
+				std::cout << "RenderStats: CSV cerrado" << std::endl;
+			}
+			else if (GetRenderStatsTracker().OpenCsv(STATS_CSV_FILE)) {
+				std::cout << "RenderStats: escribiendo " << STATS_CSV_FILE << std::endl;
+			}
+			toggleStatsCsv = false;
+		}
+
+		if (cycleSwapMode) {
+			ritmo.SetSwapMode((SwapMode)((ritmo.GetSwapMode() + 1) % 3));
+			std::cout << "Swap: " << (ritmo.GetSwapMode() == SWAP_MODE_OFF ? "sin vsync" : (ritmo.GetSwapMode() == SWAP_MODE_VSYNC ? "vsync" : "vsync adaptativo")) << std::endl;
+			cycleSwapMode = false;
+		}
+
+		if (cycleFrameCap) {
+			GLuint limites = sizeof(limitesFps) / sizeof(limitesFps[0]), actual = 0;
+			while (actual < limites && std::abs(limitesFps[actual] - ritmo.GetTargetFps()) > 0.01) {
+				actual++;
+			}
+			ritmo.SetTargetFps(limitesFps[(actual + 1) % limites]);
+			std::cout << "Lmite de fps: " << ritmo.GetTargetFps() << " (0 = sin lmite)" << std::endl;
+			ritmo.ResetHistogram();
+			cycleFrameCap = false;
+		}
+
+		reporte.EndFrame(renderQueue.GetStats().triangles + triangulosCapa);
 	}
 
+	reporte.Print(SCREEN_WIDTH, SCREEN_HEIGHT);
+
+	// Sin ventana y con --fps la corrida sirve de prueba del ritmo: sale con error si el periodo medido se sale de la tolerancia
+	int codigoSalida = 0;
+	if (headless.enabled && opcionesRitmo.fpsGiven) {
+		ritmo.Print();
+		if (!ritmo.IsWithinTolerance(opcionesRitmo.tolerance)) {
+			std::cout << "ERROR: el periodo de los frames se sali de la tolerancia (" << opcionesRitmo.tolerance * 100.0 << "% de "
+				<< 1000.0 / opcionesRitmo.targetFps << " ms)" << std::endl;
+			codigoSalida = EXIT_FAILURE;
+		}
+	}
+	GetProfiler().WriteChromeTrace(TRACE_FILE);
+
+	delete lightingMultiDrawShader;
+
+	// Las texturas de los modelos se borran con su ltima referencia, y eso necesita el contexto
+	modelos.clear();
+
 	// Terminate GLFW, clearing any resources allocated by GLFW.
-	glfwTerminate();
+	if (headless.enabled) {
+		contextoHeadless.Destroy();
+	}
+	else {
+		glfwTerminate();
+	}
 
-	return 0;
+	return codigoSalida;
 }
 
 // Moves/alters the camera positions based on user input
 void DoMovement()
 {
+	// Estado que mueve la entrada; si cambia, el siguiente frame se dibuja
+	glm::vec3 posicionAntes = camera.GetPosition();
+	glm::vec3 luzAntes = pointLightPositions[0];
+	float brazoAntes = brazoSteveAngle;
+	float steveAntes = rotSteveY;
+	float manzanaAntes = rotManzanaY;
 
 	// Camera controls
 	if (keys[GLFW_KEY_W] || keys[GLFW_KEY_UP]){
@@ -528,12 +1125,17 @@ void DoMovement()
 		rotManzanaY -= deltaTime * 50.0f;
 	}
 
+	if (camera.GetPosition() != posicionAntes || pointLightPositions[0] != luzAntes || brazoSteveAngle != brazoAntes || rotSteveY != steveAntes || rotManzanaY != manzanaAntes) {
+		frameDirty = true;
+	}
 
 }
 
 // Is called whenever a key is pressed/released via GLFW
 void KeyCallback(GLFWwindow* window, int key, int scancode, int action, int mode)
 {
+	frameDirty = true;
+
 	if (GLFW_KEY_ESCAPE == key && GLFW_PRESS == action){
 		glfwSetWindowShouldClose(window, GL_TRUE);
 	}
@@ -565,10 +1167,58 @@ void KeyCallback(GLFWwindow* window, int key, int scancode, int action, int mode
 		usePerspective = false;
 	}
 
+	if (key == GLFW_KEY_F1 && action == GLFW_PRESS) {
+		printQueueStats = true;
+	}
+
+	if (key == GLFW_KEY_F2 && action == GLFW_PRESS) {
+		runDrawBenchmark = true;
+	}
+
+	if (key == GLFW_KEY_F3 && action == GLFW_PRESS) {
+		validateGLState = true;
+	}
+
+	if (key == GLFW_KEY_F4 && action == GLFW_PRESS) {
+		useDepthPrepass = !useDepthPrepass;
+	}
+
+	if (key == GLFW_KEY_F5 && action == GLFW_PRESS) {
+		nivelLuces = (nivelLuces + 1) % 4;
+	}
+
+	if (key == GLFW_KEY_F6 && action == GLFW_PRESS) {
+		dumpProfile = true;
+	}
+
+	if (key == GLFW_KEY_F7 && action == GLFW_PRESS) {
+		toggleStatsCsv = true;
+	}
+
+	if (key == GLFW_KEY_F9 && action == GLFW_PRESS) {
+		useStaticLayer = !useStaticLayer;
+		std::cout << "Capa esttica: " << (useStaticLayer ? "activa" : "inactiva") << std::endl;
+	}
+
+	if (key == GLFW_KEY_F8 && action == GLFW_PRESS) {
+		renderOnDemand = !renderOnDemand;
+		std::cout << "Dibujo bajo demanda: " << (renderOnDemand ? "activo" : "inactivo") << std::endl;
+	}
+
+	if (key == GLFW_KEY_F10 && action == GLFW_PRESS) {
+		cycleSwapMode = true;
+	}
+
+	if (key == GLFW_KEY_F11 && action == GLFW_PRESS) {
+		cycleFrameCap = true;
+	}
+
 }
 
 void MouseCallback(GLFWwindow* window, double xPos, double yPos)
 {
+	frameDirty = true;
+
 	if (firstMouse){
 		lastX = xPos;
 		lastY = yPos;
@@ -582,4 +1232,14 @@ void MouseCallback(GLFWwindow* window, double xPos, double yPos)
 	lastY = yPos;
 
 	camera.ProcessMouseMovement(xOffset, yOffset);
+}
+
+void WindowRefreshCallback(GLFWwindow* window)
+{
+	frameDirty = true;
+}
+
+void FramebufferSizeCallback(GLFWwindow* window, int width, int height)
+{
+	frameDirty = true;
 }
\ No newline at end of file